@@ -60,6 +60,7 @@
 #define INDEX_HEIGHT(block) block->nHeight
 #define INDEX_TIME(block) block->GetBlockTime()
 #define INDEX_PREV(block) block->pprev
+#define INDEX_ANCESTOR(block, height) block->GetAncestor(height)
 #define INDEX_TARGET(block) block->nBits
 #define DIFF_SWITCHOVER(TEST, MAIN) (GetBoolArg("-testnet", false) ? TEST : MAIN)
 #define DIFF_ABS std::abs
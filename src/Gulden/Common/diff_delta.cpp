@@ -155,9 +155,14 @@ public
             if (INDEX_HEIGHT(pindexLast) - nFirstDeltaBlock <= nLongFrame) {
                 nLongWeight = nLongTimespan = 0;
             } else {
+#ifdef INDEX_ANCESTOR
+                // Use the skip list (where available) to find the start of the long frame in O(log n) instead of walking back nLongFrame blocks.
+                pindexFirst = INDEX_ANCESTOR(pindexLast, INDEX_HEIGHT(pindexLast) - (int)nLongFrame);
+#else
                 pindexFirst = pindexLast;
                 for (unsigned int i = 1; pindexFirst != NULL && i <= nLongFrame; i++)
                     pindexFirst = INDEX_PREV(pindexFirst);
+#endif
 
                 nLongTimespan = INDEX_TIME(pindexLast) - INDEX_TIME(pindexFirst);
             }
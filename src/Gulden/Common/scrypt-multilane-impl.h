@@ -0,0 +1,205 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+/*
+ * Body of the interleaved scrypt(1024,1,1) kernel.
+ *
+ * This file is included by scrypt-multilane.cpp once per instruction set, inside
+ * its own namespace and target region, with SCRYPT_LANES set to the number of
+ * hashes computed per pass. Word k of every lane lives in one vector so that the
+ * salsa20/8 core runs on all lanes at once; only the data dependent reads from
+ * the scratchpad in the second loop are done per lane.
+ *
+ * Do not include this file anywhere else.
+ */
+
+typedef uint32_t scrypt_vec_t __attribute__((vector_size(SCRYPT_LANES * 4)));
+
+#define ROTL_MULTI(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+static inline void xor_salsa8_multi(scrypt_vec_t B[16], const scrypt_vec_t Bx[16])
+{
+    scrypt_vec_t x00, x01, x02, x03, x04, x05, x06, x07, x08, x09, x10, x11, x12, x13, x14, x15;
+    int i;
+
+    x00 = (B[0] ^= Bx[0]);
+    x01 = (B[1] ^= Bx[1]);
+    x02 = (B[2] ^= Bx[2]);
+    x03 = (B[3] ^= Bx[3]);
+    x04 = (B[4] ^= Bx[4]);
+    x05 = (B[5] ^= Bx[5]);
+    x06 = (B[6] ^= Bx[6]);
+    x07 = (B[7] ^= Bx[7]);
+    x08 = (B[8] ^= Bx[8]);
+    x09 = (B[9] ^= Bx[9]);
+    x10 = (B[10] ^= Bx[10]);
+    x11 = (B[11] ^= Bx[11]);
+    x12 = (B[12] ^= Bx[12]);
+    x13 = (B[13] ^= Bx[13]);
+    x14 = (B[14] ^= Bx[14]);
+    x15 = (B[15] ^= Bx[15]);
+    for (i = 0; i < 8; i += 2) {
+        /* Operate on columns. */
+        x04 ^= ROTL_MULTI(x00 + x12, 7);
+        x09 ^= ROTL_MULTI(x05 + x01, 7);
+        x14 ^= ROTL_MULTI(x10 + x06, 7);
+        x03 ^= ROTL_MULTI(x15 + x11, 7);
+
+        x08 ^= ROTL_MULTI(x04 + x00, 9);
+        x13 ^= ROTL_MULTI(x09 + x05, 9);
+        x02 ^= ROTL_MULTI(x14 + x10, 9);
+        x07 ^= ROTL_MULTI(x03 + x15, 9);
+
+        x12 ^= ROTL_MULTI(x08 + x04, 13);
+        x01 ^= ROTL_MULTI(x13 + x09, 13);
+        x06 ^= ROTL_MULTI(x02 + x14, 13);
+        x11 ^= ROTL_MULTI(x07 + x03, 13);
+
+        x00 ^= ROTL_MULTI(x12 + x08, 18);
+        x05 ^= ROTL_MULTI(x01 + x13, 18);
+        x10 ^= ROTL_MULTI(x06 + x02, 18);
+        x15 ^= ROTL_MULTI(x11 + x07, 18);
+
+        /* Operate on rows. */
+        x01 ^= ROTL_MULTI(x00 + x03, 7);
+        x06 ^= ROTL_MULTI(x05 + x04, 7);
+        x11 ^= ROTL_MULTI(x10 + x09, 7);
+        x12 ^= ROTL_MULTI(x15 + x14, 7);
+
+        x02 ^= ROTL_MULTI(x01 + x00, 9);
+        x07 ^= ROTL_MULTI(x06 + x05, 9);
+        x08 ^= ROTL_MULTI(x11 + x10, 9);
+        x13 ^= ROTL_MULTI(x12 + x15, 9);
+
+        x03 ^= ROTL_MULTI(x02 + x01, 13);
+        x04 ^= ROTL_MULTI(x07 + x06, 13);
+        x09 ^= ROTL_MULTI(x08 + x11, 13);
+        x14 ^= ROTL_MULTI(x13 + x12, 13);
+
+        x00 ^= ROTL_MULTI(x03 + x02, 18);
+        x05 ^= ROTL_MULTI(x04 + x07, 18);
+        x10 ^= ROTL_MULTI(x09 + x08, 18);
+        x15 ^= ROTL_MULTI(x14 + x13, 18);
+    }
+    B[0] += x00;
+    B[1] += x01;
+    B[2] += x02;
+    B[3] += x03;
+    B[4] += x04;
+    B[5] += x05;
+    B[6] += x06;
+    B[7] += x07;
+    B[8] += x08;
+    B[9] += x09;
+    B[10] += x10;
+    B[11] += x11;
+    B[12] += x12;
+    B[13] += x13;
+    B[14] += x14;
+    B[15] += x15;
+}
+
+#undef ROTL_MULTI
+
+/* The salsa20/8 based mixing of scrypt(1024,1,1), in place on the PBKDF2 output of every lane. */
+static void scrypt_core_multilane(uint8_t B[SCRYPT_LANES][128], char* scratchpad)
+{
+    uint32_t W[SCRYPT_LANES];
+    uint32_t J[SCRYPT_LANES];
+    scrypt_vec_t X[32];
+    scrypt_vec_t* V;
+    const uint32_t* VW;
+    uint32_t i, k, l;
+
+    V = (scrypt_vec_t*)(((uintptr_t)(scratchpad) + 63) & ~(uintptr_t)(63));
+    VW = (const uint32_t*)V;
+
+    for (k = 0; k < 32; k++) {
+        for (l = 0; l < SCRYPT_LANES; l++)
+            W[l] = le32dec(&B[l][4 * k]);
+        memcpy(&X[k], W, sizeof(W));
+    }
+
+    for (i = 0; i < 1024; i++) {
+        memcpy(&V[i * 32], X, sizeof(X));
+        xor_salsa8_multi(&X[0], &X[16]);
+        xor_salsa8_multi(&X[16], &X[0]);
+    }
+    for (i = 0; i < 1024; i++) {
+        memcpy(W, &X[16], sizeof(W));
+        for (l = 0; l < SCRYPT_LANES; l++)
+            J[l] = 32 * (W[l] & 1023);
+        for (k = 0; k < 32; k++) {
+            scrypt_vec_t T;
+            for (l = 0; l < SCRYPT_LANES; l++)
+                W[l] = VW[(J[l] + k) * SCRYPT_LANES + l];
+            memcpy(&T, W, sizeof(W));
+            X[k] ^= T;
+        }
+        xor_salsa8_multi(&X[0], &X[16]);
+        xor_salsa8_multi(&X[16], &X[0]);
+    }
+
+    for (k = 0; k < 32; k++) {
+        memcpy(W, &X[k], sizeof(W));
+        for (l = 0; l < SCRYPT_LANES; l++)
+            le32enc(&B[l][4 * k], W[l]);
+    }
+}
+
+/* Hash SCRYPT_LANES consecutive 80 byte inputs into SCRYPT_LANES consecutive 32 byte outputs. */
+static void scrypt_1024_1_1_256_sp_multilane(const char* input, char* output, char* scratchpad)
+{
+    uint8_t B[SCRYPT_LANES][128];
+    uint32_t l;
+
+    for (l = 0; l < SCRYPT_LANES; l++)
+        PBKDF2_SHA256((const uint8_t*)&input[80 * l], 80, (const uint8_t*)&input[80 * l], 80, 1, B[l], 128);
+
+    scrypt_core_multilane(B, scratchpad);
+
+    for (l = 0; l < SCRYPT_LANES; l++)
+        PBKDF2_SHA256((const uint8_t*)&input[80 * l], 80, B[l], 128, 1, (uint8_t*)&output[32 * l], 32);
+}
+
+/* As above, for inputs that all start with the 64 bytes 'midstate' was prepared from. */
+static void scrypt_1024_1_1_256_sp_multilane_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad)
+{
+    uint8_t B[SCRYPT_LANES][128];
+    HMAC_SHA256_CTX key[SCRYPT_LANES];
+    uint32_t l;
+
+    for (l = 0; l < SCRYPT_LANES; l++)
+        scrypt_pbkdf2_in_midstate(midstate, &input[80 * l], &key[l], B[l]);
+
+    scrypt_core_multilane(B, scratchpad);
+
+    for (l = 0; l < SCRYPT_LANES; l++)
+        scrypt_pbkdf2_out(&key[l], B[l], &output[32 * l]);
+}
@@ -0,0 +1,200 @@
+// Copyright (c) 2016 The Gulden developers
+// Authored by: Malcolm MacLeod (mmacleod@webmail.co.za)
+// Distributed under the GULDEN software license, see the accompanying
+// file COPYING
+
+// Interleaved (multi-lane) scrypt kernels and the batch hashing entry point.
+// Each kernel computes several independent scrypt(1024,1,1) hashes in one pass,
+// one hash per vector lane, and is compiled for its instruction set with a target
+// region so that the rest of the binary keeps the baseline flags. The widest
+// kernel that the running CPU supports is selected by scrypt_detect_multilane().
+
+#include "scrypt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(USE_SCRYPT_MULTILANE)
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+namespace scrypt_4way
+{
+#define SCRYPT_LANES 4
+#include "scrypt-multilane-impl.h"
+#undef SCRYPT_LANES
+}
+
+void scrypt_1024_1_1_256_sp_4way(const char* input, char* output, char* scratchpad)
+{
+    scrypt_4way::scrypt_1024_1_1_256_sp_multilane(input, output, scratchpad);
+}
+
+void scrypt_1024_1_1_256_sp_4way_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad)
+{
+    scrypt_4way::scrypt_1024_1_1_256_sp_multilane_midstate(midstate, input, output, scratchpad);
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+namespace scrypt_8way
+{
+#define SCRYPT_LANES 8
+#include "scrypt-multilane-impl.h"
+#undef SCRYPT_LANES
+}
+
+void scrypt_1024_1_1_256_sp_8way(const char* input, char* output, char* scratchpad)
+{
+    scrypt_8way::scrypt_1024_1_1_256_sp_multilane(input, output, scratchpad);
+}
+
+void scrypt_1024_1_1_256_sp_8way_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad)
+{
+    scrypt_8way::scrypt_1024_1_1_256_sp_multilane_midstate(midstate, input, output, scratchpad);
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+namespace scrypt_16way
+{
+#define SCRYPT_LANES 16
+#include "scrypt-multilane-impl.h"
+#undef SCRYPT_LANES
+}
+
+void scrypt_1024_1_1_256_sp_16way(const char* input, char* output, char* scratchpad)
+{
+    scrypt_16way::scrypt_1024_1_1_256_sp_multilane(input, output, scratchpad);
+}
+
+void scrypt_1024_1_1_256_sp_16way_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad)
+{
+    scrypt_16way::scrypt_1024_1_1_256_sp_multilane_midstate(midstate, input, output, scratchpad);
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+static unsigned int nScryptLanes = 1;
+
+void scrypt_detect_multilane()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        nScryptLanes = 16;
+        printf("scrypt: using 16-way avx512 kernel for batches.\n");
+    } else if (__builtin_cpu_supports("avx2")) {
+        nScryptLanes = 8;
+        printf("scrypt: using 8-way avx2 kernel for batches.\n");
+    } else if (__builtin_cpu_supports("sse2")) {
+        nScryptLanes = 4;
+        printf("scrypt: using 4-way sse2 kernel for batches.\n");
+    } else {
+        nScryptLanes = 1;
+        printf("scrypt: no multi-lane kernel available, batches are hashed one at a time.\n");
+    }
+}
+
+#else // USE_SCRYPT_MULTILANE
+
+static const unsigned int nScryptLanes = 1;
+
+void scrypt_detect_multilane()
+{
+}
+
+#endif // USE_SCRYPT_MULTILANE
+
+unsigned int scrypt_multilane_width()
+{
+    return nScryptLanes;
+}
+
+void scrypt_1024_1_1_256_batch(const char* input, char* output, unsigned int count)
+{
+    char* scratchpad = (char*)malloc(SCRYPT_MULTILANE_SCRATCHPAD_SIZE(nScryptLanes));
+    if (!scratchpad) {
+        char fallback[SCRYPT_SCRATCHPAD_SIZE];
+        for (unsigned int i = 0; i < count; ++i)
+            scrypt_1024_1_1_256_sp(&input[80 * i], &output[32 * i], fallback);
+        return;
+    }
+
+    // Drain the batch with the widest kernel first and let narrower kernels pick up the remainder.
+    while (count > 0) {
+        unsigned int nDone = 1;
+#if defined(USE_SCRYPT_MULTILANE)
+        if (nScryptLanes >= 16 && count >= 16) {
+            scrypt_1024_1_1_256_sp_16way(input, output, scratchpad);
+            nDone = 16;
+        } else if (nScryptLanes >= 8 && count >= 8) {
+            scrypt_1024_1_1_256_sp_8way(input, output, scratchpad);
+            nDone = 8;
+        } else if (nScryptLanes >= 4 && count >= 4) {
+            scrypt_1024_1_1_256_sp_4way(input, output, scratchpad);
+            nDone = 4;
+        } else
+#endif
+        {
+            scrypt_1024_1_1_256_sp(input, output, scratchpad);
+        }
+        input += 80 * nDone;
+        output += 32 * nDone;
+        count -= nDone;
+    }
+
+    free(scratchpad);
+}
+
+void scrypt_1024_1_1_256_batch_midstate(const scrypt_midstate* midstate, const char* input, char* output, unsigned int count, char* scratchpad)
+{
+    // Same draining order as scrypt_1024_1_1_256_batch. Callers that pass a multiple of the kernel width never reach
+    // the scalar tail, which uses the portable core.
+    while (count > 0) {
+        unsigned int nDone = 1;
+#if defined(USE_SCRYPT_MULTILANE)
+        if (nScryptLanes >= 16 && count >= 16) {
+            scrypt_1024_1_1_256_sp_16way_midstate(midstate, input, output, scratchpad);
+            nDone = 16;
+        } else if (nScryptLanes >= 8 && count >= 8) {
+            scrypt_1024_1_1_256_sp_8way_midstate(midstate, input, output, scratchpad);
+            nDone = 8;
+        } else if (nScryptLanes >= 4 && count >= 4) {
+            scrypt_1024_1_1_256_sp_4way_midstate(midstate, input, output, scratchpad);
+            nDone = 4;
+        } else
+#endif
+        {
+            scrypt_1024_1_1_256_sp_midstate(midstate, input, output, scratchpad);
+        }
+        input += 80 * nDone;
+        output += 32 * nDone;
+        count -= nDone;
+    }
+}
@@ -59,11 +59,6 @@ static inline void be32enc(void* pp, uint32_t x)
     p[0] = (x >> 24) & 0xff;
 }
 
-typedef struct HMAC_SHA256Context {
-    SHA256_CTX ictx;
-    SHA256_CTX octx;
-} HMAC_SHA256_CTX;
-
 /* Initialize an HMAC-SHA256 operation with the given key. */
 static void
 HMAC_SHA256_Init(HMAC_SHA256_CTX* ctx, const void* _K, size_t Klen)
@@ -184,6 +179,63 @@ PBKDF2_SHA256(const uint8_t* passwd, size_t passwdlen, const uint8_t* salt,
     memset(&PShctx, 0, sizeof(HMAC_SHA256_CTX));
 }
 
+/* PBKDF2_SHA256 with c = 1, starting from the HMAC state after processing P and S. */
+static void PBKDF2_SHA256_1(const HMAC_SHA256_CTX* PShctx, uint8_t* buf, size_t dkLen)
+{
+    HMAC_SHA256_CTX hctx;
+    size_t i;
+    uint8_t ivec[4];
+    uint8_t U[32];
+    size_t clen;
+
+    for (i = 0; i * 32 < dkLen; i++) {
+        be32enc(ivec, (uint32_t)(i + 1));
+        memcpy(&hctx, PShctx, sizeof(HMAC_SHA256_CTX));
+        HMAC_SHA256_Update(&hctx, ivec, 4);
+        HMAC_SHA256_Final(U, &hctx);
+
+        clen = dkLen - i * 32;
+        if (clen > 32)
+            clen = 32;
+        memcpy(&buf[i * 32], U, clen);
+    }
+}
+
+void scrypt_1024_1_1_256_prepare(const char* input, scrypt_midstate* midstate)
+{
+    SHA256_Init(&midstate->ctx);
+    SHA256_Update(&midstate->ctx, input, 64);
+}
+
+void scrypt_pbkdf2_in_midstate(const scrypt_midstate* midstate, const char* input, HMAC_SHA256_CTX* key, uint8_t B[128])
+{
+    HMAC_SHA256_CTX PShctx;
+    SHA256_CTX kctx;
+    unsigned char khash[32];
+
+    /* The 80 byte password is longer than a block, so the HMAC key is its SHA256, which the midstate is most of. */
+    memcpy(&kctx, &midstate->ctx, sizeof(SHA256_CTX));
+    SHA256_Update(&kctx, &input[64], 16);
+    SHA256_Final(khash, &kctx);
+    HMAC_SHA256_Init(key, khash, 32);
+
+    memcpy(&PShctx, key, sizeof(HMAC_SHA256_CTX));
+    HMAC_SHA256_Update(&PShctx, input, 80);
+    PBKDF2_SHA256_1(&PShctx, B, 128);
+
+    /* Clean the stack. */
+    memset(khash, 0, 32);
+}
+
+void scrypt_pbkdf2_out(const HMAC_SHA256_CTX* key, const uint8_t B[128], char* output)
+{
+    HMAC_SHA256_CTX PShctx;
+
+    memcpy(&PShctx, key, sizeof(HMAC_SHA256_CTX));
+    HMAC_SHA256_Update(&PShctx, B, 128);
+    PBKDF2_SHA256_1(&PShctx, (uint8_t*)output, 32);
+}
+
 #define ROTL(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
 
 static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
@@ -268,17 +320,14 @@ static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
     B[15] += x15;
 }
 
-void scrypt_1024_1_1_256_sp_generic(const char* input, char* output, char* scratchpad)
+static void scrypt_core(uint8_t B[128], char* scratchpad)
 {
-    uint8_t B[128];
     uint32_t X[32];
     uint32_t* V;
     uint32_t i, j, k;
 
     V = (uint32_t*)(((uintptr_t)(scratchpad) + 63) & ~(uintptr_t)(63));
 
-    PBKDF2_SHA256((const uint8_t*)input, 80, (const uint8_t*)input, 80, 1, B, 128);
-
     for (k = 0; k < 32; k++)
         X[k] = le32dec(&B[4 * k]);
 
@@ -297,10 +346,27 @@ void scrypt_1024_1_1_256_sp_generic(const char* input, char* output, char* scrat
 
     for (k = 0; k < 32; k++)
         le32enc(&B[4 * k], X[k]);
+}
+
+void scrypt_1024_1_1_256_sp_generic(const char* input, char* output, char* scratchpad)
+{
+    uint8_t B[128];
 
+    PBKDF2_SHA256((const uint8_t*)input, 80, (const uint8_t*)input, 80, 1, B, 128);
+    scrypt_core(B, scratchpad);
     PBKDF2_SHA256((const uint8_t*)input, 80, B, 128, 1, (uint8_t*)output, 32);
 }
 
+void scrypt_1024_1_1_256_sp_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad)
+{
+    HMAC_SHA256_CTX key;
+    uint8_t B[128];
+
+    scrypt_pbkdf2_in_midstate(midstate, input, &key, B);
+    scrypt_core(B, scratchpad);
+    scrypt_pbkdf2_out(&key, B, output);
+}
+
 #if defined(USE_SSE2)
 
 void (*scrypt_1024_1_1_256_sp_detected)(const char* input, char* output, char* scratchpad) = &scrypt_1024_1_1_256_sp_generic;
@@ -2,6 +2,7 @@
 #define SCRYPT_H
 #include <stdlib.h>
 #include <stdint.h>
+#include <openssl/sha.h>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
@@ -23,6 +24,55 @@ extern void (*scrypt_1024_1_1_256_sp_detected)(const char* input, char* output,
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+// Scratchpad needed by a kernel that computes 'lanes' hashes in one pass.
+#define SCRYPT_MULTILANE_SCRATCHPAD_SIZE(lanes) (131072 * (lanes) + 63)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_SCRYPT_MULTILANE 1
+// Interleaved kernels: hash 4/8/16 consecutive 80 byte inputs into consecutive 32 byte outputs.
+// Only call a kernel if the CPU supports it, scrypt_1024_1_1_256_batch takes care of this.
+void scrypt_1024_1_1_256_sp_4way(const char* input, char* output, char* scratchpad);
+void scrypt_1024_1_1_256_sp_8way(const char* input, char* output, char* scratchpad);
+void scrypt_1024_1_1_256_sp_16way(const char* input, char* output, char* scratchpad);
+#endif
+
+typedef struct HMAC_SHA256Context {
+    SHA256_CTX ictx;
+    SHA256_CTX octx;
+} HMAC_SHA256_CTX;
+
+// SHA256 state after the first 64 bytes of an 80 byte input. For a block header these hold the version, the previous
+// block hash and most of the merkle root, so a miner computes it once per template and reuses it for every nonce.
+typedef struct scrypt_midstate {
+    SHA256_CTX ctx;
+} scrypt_midstate;
+
+// Compute the midstate shared by all inputs that start with the same 64 bytes as 'input'.
+void scrypt_1024_1_1_256_prepare(const char* input, scrypt_midstate* midstate);
+// Same result as scrypt_1024_1_1_256_sp, for an input whose first 64 bytes went into 'midstate'.
+void scrypt_1024_1_1_256_sp_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad);
+// The PBKDF2 passes before and after the scrypt core, for an input with a midstate. The HMAC key derived by the first
+// pass is kept in 'key' and reused by the second instead of being derived from the input again.
+void scrypt_pbkdf2_in_midstate(const scrypt_midstate* midstate, const char* input, HMAC_SHA256_CTX* key, uint8_t B[128]);
+void scrypt_pbkdf2_out(const HMAC_SHA256_CTX* key, const uint8_t B[128], char* output);
+
+#if defined(USE_SCRYPT_MULTILANE)
+// Interleaved kernels for inputs that share one midstate, with the same restrictions as the kernels above.
+void scrypt_1024_1_1_256_sp_4way_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad);
+void scrypt_1024_1_1_256_sp_8way_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad);
+void scrypt_1024_1_1_256_sp_16way_midstate(const scrypt_midstate* midstate, const char* input, char* output, char* scratchpad);
+#endif
+
+// Select the widest multi-lane kernel supported by the CPU, call once at startup.
+void scrypt_detect_multilane();
+// Number of hashes the selected kernel computes per pass (1 if no multi-lane kernel is in use).
+unsigned int scrypt_multilane_width();
+// Hash 'count' consecutive 80 byte inputs into 'count' consecutive 32 byte outputs.
+void scrypt_1024_1_1_256_batch(const char* input, char* output, unsigned int count);
+// Hash 'count' consecutive 80 byte inputs that share one midstate, using a caller owned scratchpad of at least
+// SCRYPT_MULTILANE_SCRATCHPAD_SIZE(scrypt_multilane_width()) bytes so that mining loops do not allocate per pass.
+void scrypt_1024_1_1_256_batch_midstate(const scrypt_midstate* midstate, const char* input, char* output, unsigned int count, char* scratchpad);
+
 void PBKDF2_SHA256(const uint8_t* passwd, size_t passwdlen, const uint8_t* salt, size_t saltlen, uint64_t c, uint8_t* buf, size_t dkLen);
 
 void PBKDF2_SHA512(const char* pass, size_t passwdlen, const unsigned char* salt, size_t saltlen, int32_t iterations, unsigned char* digest, uint32_t outputbytes);
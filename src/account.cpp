@@ -348,6 +348,23 @@ void CAccountHD::GetPubKey(CExtPubKey& childKey, int nChain) const
     }
 }
 
+uint32_t CAccountHD::ReserveChildIndexes(int nChain, uint32_t nCount)
+{
+    uint32_t& nNextIndex = (nChain == KEYCHAIN_EXTERNAL ? m_nNextChildIndex : m_nNextChangeIndex);
+    uint32_t nFirst = nNextIndex;
+    nNextIndex += nCount;
+    return nFirst;
+}
+
+void CAccountHD::DerivePubKey(CExtPubKey& childKey, int nChain, uint32_t nChild) const
+{
+    if (nChain == KEYCHAIN_EXTERNAL) {
+        primaryChainKeyPub.Derive(childKey, nChild);
+    } else {
+        changeChainKeyPub.Derive(childKey, nChild);
+    }
+}
+
 bool CAccountHD::GetPubKey(const CKeyID& address, CPubKey& vchPubKeyOut) const
 {
     int64_t nKeyIndex = -1;
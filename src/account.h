@@ -306,6 +306,10 @@ public:
     virtual bool AddKeyPubKey(int64_t HDKeyIndex, const CPubKey& pubkey, int keyChain) override;
 
     void GetPubKey(CExtPubKey& childKey, int nChain) const;
+    // Reserve nCount consecutive child indexes on the given chain for later derivation, returns the first one.
+    uint32_t ReserveChildIndexes(int nChain, uint32_t nCount);
+    // Derive child nChild of the given chain; safe to call concurrently as it touches no account state.
+    void DerivePubKey(CExtPubKey& childKey, int nChain, uint32_t nChild) const;
     bool IsHD() const override { return true; };
     uint32_t getIndex();
     std::string getSeedUUID() const;
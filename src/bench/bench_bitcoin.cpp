@@ -4,14 +4,21 @@
 
 #include "bench.h"
 
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "util.h"
+#include <Gulden/Common/scrypt.h>
 
 int
 main(int argc, char** argv)
 {
+    SHA256AutoDetect();
     ECC_Start();
+#if defined(USE_SSE2)
+    scrypt_detect_sse2();
+#endif
+    scrypt_detect_multilane();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
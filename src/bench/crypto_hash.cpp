@@ -13,6 +13,7 @@
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
+#include "consensus/merkle.h"
 
 /* Number of bytes to hash per iteration */
 static const uint64_t BUFFER_SIZE = 1000 * 1000;
@@ -51,6 +52,36 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
+/* The same 1024 hashes one at a time, as the merkle computation used to do them. */
+static void SHA256D64_1024_Serial(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1024; i++)
+            CHash256().Write(&in[64 * i], 64).Finalize(&in[32 * i]);
+    }
+}
+
+static void MerkleRoot(benchmark::State& state)
+{
+    std::vector<uint256> leaves(4096);
+    for (size_t i = 0; i < leaves.size(); i++)
+        *((uint64_t*)leaves[i].begin()) = i;
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        uint256 root = ComputeMerkleRoot(leaves, &mutated);
+        leaves[0] = root;
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -75,4 +106,7 @@ BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(SHA256D64_1024_Serial);
+BENCHMARK(MerkleRoot);
 BENCHMARK(SipHash_32b);
@@ -0,0 +1,72 @@
+// Copyright (c) 2016 The Gulden developers
+// Authored by: Malcolm MacLeod (mmacleod@webmail.co.za)
+// Distributed under the GULDEN software license, see the accompanying
+// file COPYING
+
+#include "bench.h"
+#include "chain.h"
+#include "primitives/block.h"
+#include <Gulden/Common/diff_common.h>
+#include <Gulden/Common/diff_delta.h>
+
+#include <assert.h>
+#include <vector>
+
+static const int DELTA_BENCH_FIRST_BLOCK = 250000;
+static const int DELTA_BENCH_CHAIN_LENGTH = 5000;
+static const int DELTA_BENCH_LONG_FRAME = 576;
+
+/* Synthetic chain of block indexes starting at the DELTA switchover, with skip pointers as in mapBlockIndex. */
+static void BuildDeltaBenchChain(std::vector<CBlockIndex>& blocks)
+{
+    blocks.resize(DELTA_BENCH_CHAIN_LENGTH);
+    for (int i = 0; i < DELTA_BENCH_CHAIN_LENGTH; i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = DELTA_BENCH_FIRST_BLOCK + i;
+        // Alternate fast and slow blocks around the 150 second target so every weighting takes part.
+        blocks[i].nTime = 1476000000 + i * 150 + ((i % 7) - 3) * 40;
+        blocks[i].nBits = 0x1c0fffff;
+        blocks[i].BuildSkip();
+    }
+}
+
+/* The way the start of the long frame used to be found: walk back one block at a time. */
+static void DeltaLongFrameWalk(benchmark::State& state)
+{
+    std::vector<CBlockIndex> blocks;
+    BuildDeltaBenchChain(blocks);
+    const CBlockIndex* pindexLast = &blocks.back();
+    while (state.KeepRunning()) {
+        const CBlockIndex* pindexFirst = pindexLast;
+        for (int i = 1; pindexFirst != NULL && i <= DELTA_BENCH_LONG_FRAME; i++)
+            pindexFirst = pindexFirst->pprev;
+        assert(pindexFirst->nHeight == pindexLast->nHeight - DELTA_BENCH_LONG_FRAME);
+    }
+}
+
+/* The way it is found now: follow the skip list. */
+static void DeltaLongFrameSkipList(benchmark::State& state)
+{
+    std::vector<CBlockIndex> blocks;
+    BuildDeltaBenchChain(blocks);
+    const CBlockIndex* pindexLast = &blocks.back();
+    while (state.KeepRunning()) {
+        const CBlockIndex* pindexFirst = pindexLast->GetAncestor(pindexLast->nHeight - DELTA_BENCH_LONG_FRAME);
+        assert(pindexFirst->nHeight == pindexLast->nHeight - DELTA_BENCH_LONG_FRAME);
+    }
+}
+
+static void DeltaNextWorkRequired(benchmark::State& state)
+{
+    std::vector<CBlockIndex> blocks;
+    BuildDeltaBenchChain(blocks);
+    const CBlockIndex* pindexLast = &blocks.back();
+    CBlockHeader header;
+    header.nTime = pindexLast->nTime + 150;
+    while (state.KeepRunning())
+        GetNextWorkRequired_DELTA(pindexLast, &header, 150, 0x1e0fffff, DELTA_BENCH_FIRST_BLOCK);
+}
+
+BENCHMARK(DeltaLongFrameWalk);
+BENCHMARK(DeltaLongFrameSkipList);
+BENCHMARK(DeltaNextWorkRequired);
@@ -0,0 +1,167 @@
+// Copyright (c) 2016 The Gulden developers
+// Authored by: Malcolm MacLeod (mmacleod@webmail.co.za)
+// Distributed under the GULDEN software license, see the accompanying
+// file COPYING
+
+#include "bench.h"
+#include "primitives/block.h"
+#include <Gulden/Common/scrypt.h>
+
+#include <string.h>
+#include <vector>
+
+/* Number of headers hashed per iteration by the batch benchmarks */
+static const unsigned int SCRYPT_BENCH_BATCH = 16;
+
+static CBlockHeader ScryptBenchHeader(uint32_t nNonce)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = uint256S("6cd3a9f6ff8b5ea3ef2e2b4e07a4b5a1ee6f85d7ba82d5e5c08e5ad3bd1e4c7a");
+    header.hashMerkleRoot = uint256S("1e8a0ff9d19aee1e2c8b9fd5c1f52a67b3e4dd9f0f1b4cbd8ae1e6b3c44af2d0");
+    header.nTime = 1476000000;
+    header.nBits = 0x1c0fffff;
+    header.nNonce = nNonce;
+    return header;
+}
+
+/* SCRYPT_BENCH_BATCH consecutive 80 byte serialised headers, as the batch interface expects them. */
+static std::vector<char> ScryptBenchInput()
+{
+    std::vector<char> input(80 * SCRYPT_BENCH_BATCH);
+    for (unsigned int i = 0; i < SCRYPT_BENCH_BATCH; ++i) {
+        CBlockHeader header = ScryptBenchHeader(i);
+        memcpy(&input[80 * i], BEGIN(header.nVersion), 80);
+    }
+    return input;
+}
+
+static void ScryptGeneric(benchmark::State& state)
+{
+    std::vector<char> input = ScryptBenchInput();
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    char output[32];
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_sp_generic(&input[0], output, &scratchpad[0]);
+}
+
+#if defined(USE_SSE2)
+static void ScryptSSE2(benchmark::State& state)
+{
+    std::vector<char> input = ScryptBenchInput();
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    char output[32];
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_sp_sse2(&input[0], output, &scratchpad[0]);
+}
+#endif
+
+/* SCRYPT_BENCH_BATCH hashes one after the other, the baseline for the batch benchmark below. */
+static void ScryptSerial16(benchmark::State& state)
+{
+    std::vector<char> input = ScryptBenchInput();
+    std::vector<char> output(32 * SCRYPT_BENCH_BATCH);
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < SCRYPT_BENCH_BATCH; ++i)
+            scrypt_1024_1_1_256_sp(&input[80 * i], &output[32 * i], &scratchpad[0]);
+    }
+}
+
+/* The same SCRYPT_BENCH_BATCH hashes through the widest multi-lane kernel the CPU supports. */
+static void ScryptBatch16(benchmark::State& state)
+{
+    std::vector<char> input = ScryptBenchInput();
+    std::vector<char> output(32 * SCRYPT_BENCH_BATCH);
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_batch(&input[0], &output[0], SCRYPT_BENCH_BATCH);
+}
+
+/* The batch above as the miner runs it: the first 64 bytes are hashed once and every pass reuses them. */
+static void ScryptBatchMidstate16(benchmark::State& state)
+{
+    std::vector<char> input = ScryptBenchInput();
+    std::vector<char> output(32 * SCRYPT_BENCH_BATCH);
+    std::vector<char> scratchpad(SCRYPT_MULTILANE_SCRATCHPAD_SIZE(scrypt_multilane_width()));
+    scrypt_midstate midstate;
+    scrypt_1024_1_1_256_prepare(&input[0], &midstate);
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_batch_midstate(&midstate, &input[0], &output[0], SCRYPT_BENCH_BATCH, &scratchpad[0]);
+}
+
+#if defined(USE_SCRYPT_MULTILANE)
+/* One pass of a single kernel; falls back to the batch path where the CPU lacks the instruction set. */
+static void ScryptKernel(benchmark::State& state, unsigned int nLanes, void (*kernel)(const char*, char*, char*))
+{
+    std::vector<char> input = ScryptBenchInput();
+    std::vector<char> output(32 * SCRYPT_BENCH_BATCH);
+    std::vector<char> scratchpad(SCRYPT_MULTILANE_SCRATCHPAD_SIZE(nLanes));
+    bool fSupported = scrypt_multilane_width() >= nLanes;
+    while (state.KeepRunning()) {
+        if (fSupported)
+            kernel(&input[0], &output[0], &scratchpad[0]);
+        else
+            scrypt_1024_1_1_256_batch(&input[0], &output[0], nLanes);
+    }
+}
+
+static void ScryptKernel4Way(benchmark::State& state)
+{
+    ScryptKernel(state, 4, scrypt_1024_1_1_256_sp_4way);
+}
+
+static void ScryptKernel8Way(benchmark::State& state)
+{
+    ScryptKernel(state, 8, scrypt_1024_1_1_256_sp_8way);
+}
+
+static void ScryptKernel16Way(benchmark::State& state)
+{
+    ScryptKernel(state, 16, scrypt_1024_1_1_256_sp_16way);
+}
+#endif
+
+static void BlockGetPoWHash(benchmark::State& state)
+{
+    CBlock block(ScryptBenchHeader(0));
+    while (state.KeepRunning()) {
+        block.GetPoWHash();
+        ++block.nNonce;
+    }
+}
+
+static void BlockGetPoWHashes16(benchmark::State& state)
+{
+    std::vector<CBlockHeader> headers;
+    for (unsigned int i = 0; i < SCRYPT_BENCH_BATCH; ++i)
+        headers.push_back(ScryptBenchHeader(i));
+    std::vector<uint256> hashes(SCRYPT_BENCH_BATCH);
+    while (state.KeepRunning())
+        GetPoWHashes(&headers[0], headers.size(), &hashes[0]);
+}
+
+/* The 2048 round key stretching done when a seed is recovered from its mnemonic. */
+static void PBKDF2SHA512Mnemonic(benchmark::State& state)
+{
+    const char* mnemonic = "abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon about";
+    const char* salt = "mnemonic";
+    unsigned char seed[64];
+    while (state.KeepRunning())
+        PBKDF2_SHA512(mnemonic, strlen(mnemonic), (const unsigned char*)salt, strlen(salt), 2048, seed, 64);
+}
+
+BENCHMARK(ScryptGeneric);
+#if defined(USE_SSE2)
+BENCHMARK(ScryptSSE2);
+#endif
+BENCHMARK(ScryptSerial16);
+BENCHMARK(ScryptBatch16);
+BENCHMARK(ScryptBatchMidstate16);
+#if defined(USE_SCRYPT_MULTILANE)
+BENCHMARK(ScryptKernel4Way);
+BENCHMARK(ScryptKernel8Way);
+BENCHMARK(ScryptKernel16Way);
+#endif
+BENCHMARK(BlockGetPoWHash);
+BENCHMARK(BlockGetPoWHashes16);
+BENCHMARK(PBKDF2SHA512Mnemonic);
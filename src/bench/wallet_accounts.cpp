@@ -0,0 +1,107 @@
+// Copyright (c) 2016 The Gulden developers
+// Authored by: Malcolm MacLeod (mmacleod@webmail.co.za)
+// Distributed under the GULDEN software license, see the accompanying
+// file COPYING
+
+#include "bench.h"
+#include "account.h"
+#include "key.h"
+#include "script/ismine.h"
+#include "script/standard.h"
+#include "tinyformat.h"
+#include "wallet/wallet.h"
+#include <Gulden/mnemonic.h>
+
+#include <assert.h>
+#include <boost/uuid/uuid_generators.hpp>
+#include <vector>
+
+/* Number of accounts and keys per account in the wallet used by the IsMine benchmarks */
+static const int ISMINE_BENCH_ACCOUNTS = 100;
+static const int ISMINE_BENCH_KEYS = 20;
+
+static CExtKey AccountBenchKey()
+{
+    static const std::vector<unsigned char> hashkey = { 'G', 'u', 'l', 'd', 'e', 'n', ' ', 'b', 'i', 'p', '3', '2' };
+    unsigned char seed[64];
+    for (unsigned int i = 0; i < sizeof(seed); ++i)
+        seed[i] = i;
+    CExtKey masterKey;
+    CExtKey accountKey;
+    masterKey.SetMaster(hashkey, seed, sizeof(seed));
+    masterKey.Derive(accountKey, BIP32_HARDENED_KEY_LIMIT);
+    return accountKey;
+}
+
+static void MnemonicToSeed(benchmark::State& state)
+{
+    SecureString mnemonic("abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon about");
+    while (state.KeepRunning()) {
+        unsigned char* seed = seedFromMnemonic(mnemonic);
+        delete[] seed;
+    }
+}
+
+/* Public child derivation, as done for every key added to the keypool. */
+static void AccountHDDerivePubKey(benchmark::State& state)
+{
+    CAccountHD account(AccountBenchKey(), boost::uuids::nil_generator()());
+    CExtPubKey childKey;
+    uint32_t nChild = 0;
+    while (state.KeepRunning())
+        account.DerivePubKey(childKey, KEYCHAIN_EXTERNAL, nChild++);
+}
+
+/* Private child derivation, as done when a key is handed out for signing. */
+static void AccountHDDeriveKey(benchmark::State& state)
+{
+    CAccountHD account(AccountBenchKey(), boost::uuids::nil_generator()());
+    CExtKey childKey;
+    while (state.KeepRunning())
+        account.GetKey(childKey, KEYCHAIN_EXTERNAL);
+}
+
+/* Scripts paying to keys spread over many accounts, and the same number of scripts paying elsewhere. */
+static void IsMineManyAccounts(benchmark::State& state)
+{
+    CWallet wallet;
+    std::vector<CScript> scripts;
+    for (int i = 0; i < ISMINE_BENCH_ACCOUNTS; ++i) {
+        CAccount* account = new CAccount();
+        wallet.addAccount(account, strprintf("bench%d", i));
+
+        LOCK(wallet.cs_wallet);
+        for (int j = 0; j < ISMINE_BENCH_KEYS; ++j) {
+            CKey key;
+            key.MakeNewKey(true);
+            CPubKey pubkey = key.GetPubKey();
+            wallet.AddKeyPubKey(key, pubkey, *account, KEYCHAIN_EXTERNAL);
+            if (j == 0)
+                scripts.push_back(GetScriptForDestination(pubkey.GetID()));
+        }
+    }
+    for (int i = 0; i < ISMINE_BENCH_ACCOUNTS; ++i) {
+        CKey key;
+        key.MakeNewKey(true);
+        scripts.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+    }
+
+    // Every account must be visited for the first half of the scripts to be found.
+    assert(wallet.mapAccounts.size() == (size_t)ISMINE_BENCH_ACCOUNTS);
+    for (int i = 0; i < 2 * ISMINE_BENCH_ACCOUNTS; ++i)
+        assert(::IsMine(wallet, scripts[i]) == (i < ISMINE_BENCH_ACCOUNTS ? ISMINE_SPENDABLE : ISMINE_NO));
+
+    while (state.KeepRunning()) {
+        for (const CScript& script : scripts)
+            ::IsMine(wallet, script);
+    }
+
+    // The wallet does not own its accounts.
+    for (const auto& accountPair : wallet.mapAccounts)
+        delete accountPair.second;
+}
+
+BENCHMARK(MnemonicToSeed);
+BENCHMARK(AccountHDDerivePubKey);
+BENCHMARK(AccountHDDeriveKey);
+BENCHMARK(IsMineManyAccounts);
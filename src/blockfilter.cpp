@@ -0,0 +1,320 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+/** Writes bits most significant first, as BIP158 encodes them. */
+class CBitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    unsigned char nBuffer;
+    int nBits;
+
+public:
+    CBitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBuffer(0), nBits(0) {}
+
+    //! Write the nCount low bits of n
+    void Write(uint64_t n, int nCount)
+    {
+        while (nCount > 0) {
+            int nChunk = std::min(8 - nBits, nCount);
+            nBuffer |= ((n >> (nCount - nChunk)) & ((1 << nChunk) - 1)) << (8 - nBits - nChunk);
+            nBits += nChunk;
+            nCount -= nChunk;
+            if (nBits == 8)
+                Flush();
+        }
+    }
+
+    //! Write any buffered bits, padded with zeroes to a whole byte
+    void Flush()
+    {
+        if (nBits == 0)
+            return;
+        vch.push_back(nBuffer);
+        nBuffer = 0;
+        nBits = 0;
+    }
+};
+
+class CBitReader
+{
+private:
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+    int nBits;
+
+public:
+    CBitReader(const std::vector<unsigned char>& vchIn, size_t nPosIn) : vch(vchIn), nPos(nPosIn), nBits(0) {}
+
+    uint64_t Read(int nCount)
+    {
+        uint64_t n = 0;
+        while (nCount > 0) {
+            if (nPos >= vch.size())
+                throw std::ios_base::failure("end of filter");
+            int nChunk = std::min(8 - nBits, nCount);
+            n = (n << nChunk) | ((vch[nPos] >> (8 - nBits - nChunk)) & ((1 << nChunk) - 1));
+            nBits += nChunk;
+            nCount -= nChunk;
+            if (nBits == 8) {
+                nPos++;
+                nBits = 0;
+            }
+        }
+        return n;
+    }
+};
+
+static void GolombRiceEncode(CBitWriter& writer, int nP, uint64_t n)
+{
+    // Quotient in unary, then the remainder in P bits.
+    for (uint64_t q = n >> nP; q > 0; q--)
+        writer.Write(1, 1);
+    writer.Write(0, 1);
+    writer.Write(n, nP);
+}
+
+static uint64_t GolombRiceDecode(CBitReader& reader, int nP)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1)
+        q++;
+    return (q << nP) + reader.Read(nP);
+}
+
+/** (x * n) >> 64, which maps a uniform 64 bit hash uniformly into [0, n) without a division */
+static uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)n) >> 64);
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xffffffff;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xffffffff;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xffffffff) + (ad & 0xffffffff);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+/** Start an encoded filter with its number of elements */
+static void WriteFilterSize(std::vector<unsigned char>& vch, uint32_t nN)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, nN);
+    vch.assign(ss.begin(), ss.end());
+}
+
+GCSFilter::GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, int nPIn, uint32_t nMIn)
+    : nSipHashK0(nSipHashK0In)
+    , nSipHashK1(nSipHashK1In)
+    , nP(nPIn)
+    , nM(nMIn)
+    , nN(0)
+    , nF(0)
+{
+    WriteFilterSize(vEncoded, nN);
+}
+
+GCSFilter::GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, int nPIn, uint32_t nMIn, const std::vector<unsigned char>& vEncodedIn)
+    : nSipHashK0(nSipHashK0In)
+    , nSipHashK1(nSipHashK1In)
+    , nP(nPIn)
+    , nM(nMIn)
+    , vEncoded(vEncodedIn)
+{
+    CDataStream ss(vEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nCount = ReadCompactSize(ss);
+    if (nCount > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("N must be less than 2^32");
+    nN = nCount;
+    nF = (uint64_t)nN * nM;
+
+    // Decode everything once, so that a filter that was accepted can always be matched against.
+    CBitReader reader(vEncoded, vEncoded.size() - ss.size());
+    for (uint32_t i = 0; i < nN; i++)
+        GolombRiceDecode(reader, nP);
+}
+
+GCSFilter::GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, int nPIn, uint32_t nMIn, const ElementSet& elements)
+    : nSipHashK0(nSipHashK0In)
+    , nSipHashK1(nSipHashK1In)
+    , nP(nPIn)
+    , nM(nMIn)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("N must be less than 2^32");
+    nN = elements.size();
+    nF = (uint64_t)nN * nM;
+
+    WriteFilterSize(vEncoded, nN);
+    if (elements.empty())
+        return;
+
+    CBitWriter writer(vEncoded);
+    uint64_t nLast = 0;
+    std::vector<uint64_t> vHashes = BuildHashedSet(elements);
+    for (std::vector<uint64_t>::const_iterator it = vHashes.begin(); it != vHashes.end(); ++it) {
+        GolombRiceEncode(writer, nP, *it - nLast);
+        nLast = *it;
+    }
+    writer.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t nHash = CSipHasher(nSipHashK0, nSipHashK1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(nHash, nF);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (ElementSet::const_iterator it = elements.begin(); it != elements.end(); ++it)
+        vHashes.push_back(HashToRange(*it));
+    std::sort(vHashes.begin(), vHashes.end());
+    return vHashes;
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* pHashes, size_t nHashes) const
+{
+    CDataStream ss(vEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    ReadCompactSize(ss);
+    CBitReader reader(vEncoded, vEncoded.size() - ss.size());
+
+    // Both lists are sorted, so one pass over the filter answers all queries.
+    uint64_t nValue = 0;
+    size_t nQuery = 0;
+    for (uint32_t i = 0; i < nN && nQuery < nHashes; i++) {
+        nValue += GolombRiceDecode(reader, nP);
+        while (nQuery < nHashes && pHashes[nQuery] < nValue)
+            nQuery++;
+        if (nQuery < nHashes && pHashes[nQuery] == nValue)
+            return true;
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    if (nN == 0)
+        return false;
+    uint64_t nQuery = HashToRange(element);
+    return MatchInternal(&nQuery, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    if (nN == 0 || elements.empty())
+        return false;
+    std::vector<uint64_t> vQueries = BuildHashedSet(elements);
+    return MatchInternal(vQueries.data(), vQueries.size());
+}
+
+std::string BlockFilterTypeName(BlockFilterType filterType)
+{
+    switch (filterType) {
+    case BLOCK_FILTER_BASIC:
+        return "basic";
+    }
+    return "";
+}
+
+bool BlockFilterTypeByName(const std::string& strName, BlockFilterType& filterType)
+{
+    if (strName == "basic") {
+        filterType = BLOCK_FILTER_BASIC;
+        return true;
+    }
+    return false;
+}
+
+static GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& blockundo)
+{
+    GCSFilter::ElementSet elements;
+    for (std::vector<CTransaction>::const_iterator tx = block.vtx.begin(); tx != block.vtx.end(); ++tx) {
+        for (std::vector<CTxOut>::const_iterator txout = tx->vout.begin(); txout != tx->vout.end(); ++txout) {
+            const CScript& script = txout->scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+    for (std::vector<CTxUndo>::const_iterator txundo = blockundo.vtxundo.begin(); txundo != blockundo.vtxundo.end(); ++txundo) {
+        for (std::vector<CTxInUndo>::const_iterator prevout = txundo->vprevout.begin(); prevout != txundo->vprevout.end(); ++prevout) {
+            const CScript& script = prevout->txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+    return elements;
+}
+
+bool BlockFilter::BuildParams(uint64_t& nK0, uint64_t& nK1, int& nP, uint32_t& nM) const
+{
+    // The SipHash key is the first 16 bytes of the block hash, so filters of different blocks are independent.
+    nK0 = ReadLE64(hashBlock.begin());
+    nK1 = ReadLE64(hashBlock.begin() + 8);
+    switch (filterType) {
+    case BLOCK_FILTER_BASIC:
+        nP = BASIC_FILTER_P;
+        nM = BASIC_FILTER_M;
+        return true;
+    }
+    return false;
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockundo)
+    : filterType(filterTypeIn)
+    , hashBlock(block.GetHash())
+{
+    uint64_t nK0, nK1;
+    int nP;
+    uint32_t nM;
+    if (!BuildParams(nK0, nK1, nP, nM))
+        throw std::invalid_argument("unknown filter type");
+    filter = GCSFilter(nK0, nK1, nP, nM, BasicFilterElements(block, blockundo));
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vEncoded)
+    : filterType(filterTypeIn)
+    , hashBlock(hashBlockIn)
+{
+    uint64_t nK0, nK1;
+    int nP;
+    uint32_t nM;
+    if (!BuildParams(nK0, nK1, nP, nM))
+        throw std::invalid_argument("unknown filter type");
+    filter = GCSFilter(nK0, nK1, nP, nM, vEncoded);
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vEncoded = GetEncodedFilter();
+    return Hash(vEncoded.begin(), vEncoded.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& hashPrevHeader) const
+{
+    uint256 hashFilter = GetHash();
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end());
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * A Golomb-coded set as described by BIP158: a sorted list of 64 bit hashes
+ * of its elements, mapped into [0, N * M) and stored as Golomb-Rice coded
+ * differences with parameter P. An element that is not in the set matches
+ * with probability of about 1 / M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+private:
+    uint64_t nSipHashK0;
+    uint64_t nSipHashK1;
+    int nP;
+    uint32_t nM;
+    uint32_t nN;
+    uint64_t nF;
+    //! CompactSize N followed by the coded differences
+    std::vector<unsigned char> vEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    //! Whether any of the sorted hashes is in the set
+    bool MatchInternal(const uint64_t* pHashes, size_t nHashes) const;
+
+public:
+    //! An empty filter
+    GCSFilter(uint64_t nSipHashK0In = 0, uint64_t nSipHashK1In = 0, int nPIn = 0, uint32_t nMIn = 0);
+    //! A filter from its encoding; throws std::ios_base::failure if that is not well formed
+    GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, int nPIn, uint32_t nMIn, const std::vector<unsigned char>& vEncodedIn);
+    //! A filter of the given elements
+    GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, int nPIn, uint32_t nMIn, const ElementSet& elements);
+
+    uint32_t GetN() const { return nN; }
+    const std::vector<unsigned char>& GetEncoded() const { return vEncoded; }
+
+    //! Whether element may be in the set. False positives happen with probability 1 / M.
+    bool Match(const Element& element) const;
+    //! Whether any of elements may be in the set, decoding the filter only once
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+/** Filter types of BIP157; only the basic one is built */
+enum BlockFilterType : uint8_t {
+    BLOCK_FILTER_BASIC = 0,
+};
+
+/** Golomb-Rice parameters of the basic filter */
+static const int BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+/** Name of a filter type as used on the command line and in RPC, or an empty string if unknown */
+std::string BlockFilterTypeName(BlockFilterType filterType);
+bool BlockFilterTypeByName(const std::string& strName, BlockFilterType& filterType);
+
+/**
+ * The filter of one block. The basic filter holds every output script the
+ * block creates, except OP_RETURN outputs, and every script it spends, which
+ * is what a light wallet needs to find its payments and spends.
+ */
+class BlockFilter
+{
+private:
+    BlockFilterType filterType;
+    uint256 hashBlock;
+    GCSFilter filter;
+
+    bool BuildParams(uint64_t& nK0, uint64_t& nK1, int& nP, uint32_t& nM) const;
+
+public:
+    BlockFilter() : filterType(BLOCK_FILTER_BASIC) {}
+    //! The filter of a block, with blockundo providing the outputs it spends
+    BlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockundo);
+    //! A filter from its encoding; throws std::ios_base::failure if that is not well formed
+    BlockFilter(BlockFilterType filterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vEncoded);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+    const uint256& GetBlockHash() const { return hashBlock; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    //! Double SHA-256 of the encoded filter
+    uint256 GetHash() const;
+    //! The filter header, which commits to this filter and to the header of the previous block
+    uint256 ComputeHeader(const uint256& hashPrevHeader) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        uint8_t nFilterType = filterType;
+        READWRITE(nFilterType);
+        READWRITE(hashBlock);
+        std::vector<unsigned char> vEncoded = filter.GetEncoded();
+        READWRITE(vEncoded);
+        if (ser_action.ForRead()) {
+            filterType = (BlockFilterType)nFilterType;
+            uint64_t nK0, nK1;
+            int nP;
+            uint32_t nM;
+            if (!BuildParams(nK0, nK1, nP, nM))
+                throw std::ios_base::failure("unknown filter type");
+            filter = GCSFilter(nK0, nK1, nP, nM, vEncoded);
+        }
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,186 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "main.h"
+#include "undo.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+static const char DB_FILTER = 'f';
+static const char DB_BEST_BLOCK = 'B';
+
+CBlockFilterIndex* pblockfilterindex = NULL;
+
+CBlockFilterIndex::CBlockFilterIndex(BlockFilterType filterTypeIn, size_t nCacheSize, bool fMemory, bool fWipe)
+    : filterType(filterTypeIn)
+    , db(GetDataDir() / "blockfilter" / BlockFilterTypeName(filterTypeIn), nCacheSize, fMemory, fWipe)
+    , fTipChanged(false)
+    , pindexBest(NULL)
+{
+}
+
+void CBlockFilterIndex::Init()
+{
+    uint256 hashBest;
+    if (!db.Read(DB_BEST_BLOCK, hashBest))
+        return;
+    // A best block that is not known any more, e.g. after -reindex, just means indexing starts over.
+    LOCK(cs_main);
+    BlockMap::iterator it = mapBlockIndex.find(hashBest);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    pindexBest = it == mapBlockIndex.end() ? NULL : it->second;
+}
+
+void CBlockFilterIndex::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fTipChanged = true;
+    condTip.notify_all();
+}
+
+const CBlockIndex* CBlockFilterIndex::GetBestBlock()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return pindexBest;
+}
+
+bool CBlockFilterIndex::Sync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        // The next batch of blocks, continuing from where the best block forks off the active chain.
+        std::vector<const CBlockIndex*> vBlocks;
+        std::vector<CDiskBlockPos> vUndoPos;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexFork = chainActive.FindFork(GetBestBlock());
+            for (int nHeight = pindexFork ? pindexFork->nHeight + 1 : 0; nHeight <= chainActive.Height() && vBlocks.size() < BLOCK_FILTER_INDEX_BATCH_SIZE; nHeight++) {
+                const CBlockIndex* pindex = chainActive[nHeight];
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (pindex->pprev && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                    return error("%s: block %s at height %d is not available", __func__, pindex->GetBlockHash().ToString(), nHeight);
+                vBlocks.push_back(pindex);
+                vUndoPos.push_back(pindex->GetUndoPos());
+            }
+        }
+        if (vBlocks.empty())
+            return true;
+
+        uint256 hashPrevHeader;
+        if (vBlocks[0]->pprev && !LookupFilterHeader(vBlocks[0]->pprev, hashPrevHeader))
+            return error("%s: no filter header for block %s", __func__, vBlocks[0]->pprev->GetBlockHash().ToString());
+
+        // Pruning is not allowed with the index, so the files of blocks in the active chain stay where they are.
+        CDBBatch batch(db);
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            const CBlockIndex* pindex = vBlocks[i];
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, consensusParams))
+                return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+            CBlockUndo blockundo;
+            if (pindex->pprev && !UndoReadFromDisk(blockundo, vUndoPos[i], pindex->pprev->GetBlockHash()))
+                return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+
+            BlockFilter filter(filterType, block, blockundo);
+            CBlockFilterIndexEntry entry;
+            entry.hashFilter = filter.GetHash();
+            entry.header = filter.ComputeHeader(hashPrevHeader);
+            entry.vEncoded = filter.GetEncodedFilter();
+            batch.Write(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry);
+            hashPrevHeader = entry.header;
+        }
+        batch.Write(DB_BEST_BLOCK, vBlocks.back()->GetBlockHash());
+        if (!db.WriteBatch(batch))
+            return error("%s: failed to write block filters", __func__);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pindexBest = vBlocks.back();
+        LogPrint("blockfilter", "Block filters indexed up to height %d\n", pindexBest->nHeight);
+    }
+}
+
+void CBlockFilterIndex::ThreadSync()
+{
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fTipChanged = false;
+        }
+        if (!Sync()) {
+            LogPrintf("%s: stopped indexing block filters\n", __func__);
+            return;
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fTipChanged)
+            condTip.wait(lock);
+    }
+}
+
+bool CBlockFilterIndex::ReadEntry(const CBlockIndex* pindex, CBlockFilterIndexEntry& entry) const
+{
+    return db.Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry);
+}
+
+bool CBlockFilterIndex::GetRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<const CBlockIndex*>& vIndex)
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+    vIndex.resize(pindexStop->nHeight - nStartHeight + 1);
+    // Parents never change, so walking back needs no lock.
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev)
+        vIndex[pindex->nHeight - nStartHeight] = pindex;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const
+{
+    CBlockFilterIndexEntry entry;
+    if (!ReadEntry(pindex, entry))
+        return false;
+    filter = BlockFilter(filterType, pindex->GetBlockHash(), entry.vEncoded);
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const
+{
+    CBlockFilterIndexEntry entry;
+    if (!ReadEntry(pindex, entry))
+        return false;
+    header = entry.header;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<BlockFilter>& vFilters) const
+{
+    std::vector<const CBlockIndex*> vIndex;
+    if (!GetRange(nStartHeight, pindexStop, vIndex))
+        return false;
+    vFilters.resize(vIndex.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        if (!LookupFilter(vIndex[i], vFilters[i]))
+            return false;
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes) const
+{
+    std::vector<const CBlockIndex*> vIndex;
+    if (!GetRange(nStartHeight, pindexStop, vIndex))
+        return false;
+    vHashes.resize(vIndex.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        CBlockFilterIndexEntry entry;
+        if (!ReadEntry(vIndex[i], entry))
+            return false;
+        vHashes[i] = entry.hashFilter;
+    }
+    return true;
+}
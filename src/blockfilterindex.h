@@ -0,0 +1,113 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTERINDEX_H
+#define BITCOIN_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "dbwrapper.h"
+#include "serialize.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <stdint.h>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlockIndex;
+
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+/** Largest database cache of the block filter index, in MiB */
+static const int64_t nMaxBlockFilterDBCache = 64;
+/** Blocks indexed per database batch while catching up with the chain */
+static const unsigned int BLOCK_FILTER_INDEX_BATCH_SIZE = 1000;
+/** Most filters a peer may ask for with one getcfilters */
+static const uint32_t MAX_GETCFILTERS_SIZE = 1000;
+/** Most filter hashes a peer may ask for with one getcfheaders */
+static const uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+/** Blocks between the filter headers sent in a cfcheckpt */
+static const int CFCHECKPT_INTERVAL = 1000;
+
+/** What the index keeps for one block */
+struct CBlockFilterIndexEntry {
+    uint256 hashFilter;
+    uint256 header;
+    std::vector<unsigned char> vEncoded;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashFilter);
+        READWRITE(header);
+        READWRITE(vEncoded);
+    }
+};
+
+/**
+ * Compact block filters (BIP158) of every block of the active chain, with
+ * their filter headers, kept in blockfilter/<type>/ and built by a
+ * background thread from the block and undo files. Light clients can then
+ * be served with a database lookup instead of a scan of every block they
+ * ask for.
+ *
+ * Entries are keyed by block hash and a filter header commits to the one of
+ * the parent block, so entries of blocks that were disconnected stay valid
+ * and a reorganisation only needs the new branch indexed.
+ */
+class CBlockFilterIndex : public CValidationInterface
+{
+private:
+    BlockFilterType filterType;
+    CDBWrapper db;
+
+    boost::mutex mutex;
+    boost::condition_variable condTip;
+    bool fTipChanged;
+    //! Last block indexed, which may have been disconnected since
+    const CBlockIndex* pindexBest;
+
+    bool ReadEntry(const CBlockIndex* pindex, CBlockFilterIndexEntry& entry) const;
+    //! Index of every block from pindexStop back to nStartHeight, in height order
+    static bool GetRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<const CBlockIndex*>& vIndex);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+
+public:
+    CBlockFilterIndex(BlockFilterType filterTypeIn, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+
+    //! Pick up where the index was left. Needs the block index to be loaded.
+    void Init();
+
+    /**
+     * Index every block of the active chain that is not indexed yet. Returns
+     * false if a block or its undo data could not be read.
+     */
+    bool Sync();
+
+    //! Keep the index in sync with the active chain until interrupted
+    void ThreadSync();
+
+    //! Last block indexed
+    const CBlockIndex* GetBestBlock();
+
+    bool LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const;
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const;
+    //! Filters of the blocks from height nStartHeight up to pindexStop
+    bool LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<BlockFilter>& vFilters) const;
+    //! Filter hashes of the blocks from height nStartHeight up to pindexStop
+    bool LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes) const;
+};
+
+/** The block filter index, if -blockfilterindex is set */
+extern CBlockFilterIndex* pblockfilterindex;
+
+#endif // BITCOIN_BLOCKFILTERINDEX_H
@@ -7,6 +7,45 @@
 
 using namespace std;
 
+CBlockIndexArena::CBlockIndexArena()
+    : nUsedInSlab(0)
+    , nSize(0)
+{
+}
+
+CBlockIndexArena::~CBlockIndexArena()
+{
+    Clear();
+}
+
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    if (vSlabs.empty() || nUsedInSlab == vSlabs.back().second) {
+        vSlabs.push_back(std::make_pair(new CBlockIndex[SLAB_SIZE], SLAB_SIZE));
+        nUsedInSlab = 0;
+    }
+    nSize++;
+    return &vSlabs.back().first[nUsedInSlab++];
+}
+
+void CBlockIndexArena::Reserve(size_t n)
+{
+    if (!vSlabs.empty() && vSlabs.back().second - nUsedInSlab >= n)
+        return;
+    size_t nSlab = std::max(n, (size_t)SLAB_SIZE);
+    vSlabs.push_back(std::make_pair(new CBlockIndex[nSlab], nSlab));
+    nUsedInSlab = 0;
+}
+
+void CBlockIndexArena::Clear()
+{
+    for (size_t i = 0; i < vSlabs.size(); i++)
+        delete[] vSlabs[i].first;
+    vSlabs.clear();
+    nUsedInSlab = 0;
+    nSize = 0;
+}
+
 /**
  * CChain implementation
  */
@@ -38,6 +38,9 @@ struct CCheckpointData {
     double fTransactionsPerDay;
 };
 
+/** Block hash -> UTXO set hash (as reported by gettxoutsetinfo) of snapshots trusted by -loadutxosnapshot */
+typedef std::map<uint256, uint256> MapAssumeUTXO;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -79,6 +82,7 @@ public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    const MapAssumeUTXO& AssumeUTXO() const { return mapAssumeUTXO; }
 
     virtual void ParseCommandLine(){};
 
@@ -102,6 +106,7 @@ protected:
     bool fMineBlocksOnDemand;
     bool fTestnetToBeDeprecatedFieldRPC;
     CCheckpointData checkpointData;
+    MapAssumeUTXO mapAssumeUTXO;
 };
 
 /**
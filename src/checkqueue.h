@@ -24,7 +24,8 @@ class CCheckQueueControl;
   * One thread (the master) is assumed to push batches of verifications
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
+  * as an N'th worker, until all jobs are done. Several threads may want to
+  * be the master, so CCheckQueueControl takes ControlMutex for its lifetime.
   */
 template <typename T>
 class CCheckQueue {
@@ -145,6 +146,9 @@ public:
             condWorker.notify_all();
     }
 
+    //! Held by the CCheckQueueControl that is currently the master
+    boost::mutex ControlMutex;
+
     ~CCheckQueue()
     {
     }
@@ -173,6 +177,7 @@ public:
     {
 
         if (pqueue != NULL) {
+            pqueue->ControlMutex.lock();
             bool isIdle = pqueue->IsIdle();
             assert(isIdle);
         }
@@ -197,6 +202,8 @@ public:
     {
         if (!fDone)
             Wait();
+        if (pqueue != NULL)
+            pqueue->ControlMutex.unlock();
     }
 };
 
@@ -100,6 +100,18 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256& txid) const
     return ret;
 }
 
+bool CCoinsViewCache::AddFetchedCoins(const uint256& txid, CCoins& coins)
+{
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    if (!ret.second)
+        return false;
+    coins.swap(ret.first->second.coins);
+    if (ret.first->second.coins.IsPruned())
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    cachedCoinsUsage += ret.first->second.coins.DynamicMemoryUsage();
+    return true;
+}
+
 bool CCoinsViewCache::GetCoins(const uint256& txid, CCoins& coins) const
 {
     CCoinsMap::const_iterator it = FetchCoins(txid);
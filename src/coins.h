@@ -439,6 +439,14 @@ public:
      */
     CCoinsModifier ModifyNewCoins(const uint256& txid, bool coinbase);
 
+    /**
+     * Add coins that were read from the base view elsewhere, e.g. on another
+     * thread, unless the cache already has an entry for txid. The caller must
+     * make sure the base view has not been written since they were read.
+     * Takes the contents of coins.
+     */
+    bool AddFetchedCoins(const uint256& txid, CCoins& coins);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
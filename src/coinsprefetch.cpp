@@ -0,0 +1,145 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include <boost/thread.hpp>
+
+CCoinsPrefetcher::CCoinsPrefetcher(size_t nMaxResultsUsageIn)
+    : nResultsUsage(0)
+    , nMaxResultsUsage(nMaxResultsUsageIn)
+    , nEpoch(0)
+    , nWorkers(0)
+{
+}
+
+void CCoinsPrefetcher::Finished(const Request& req)
+{
+    if (!req.fUrgent)
+        return;
+    std::map<uint256, int>::iterator it = mapPending.find(req.hashBlock);
+    if (it != mapPending.end() && --it->second == 0) {
+        mapPending.erase(it);
+        condDone.notify_all();
+    }
+}
+
+void CCoinsPrefetcher::Thread(CCoinsView* base)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nWorkers++;
+    try {
+        while (true) {
+            while (queue.empty())
+                condWorker.wait(lock);
+            Request req = queue.front();
+            queue.pop_front();
+
+            // Nobody asked for this block yet and there is no room for more, so the read would be wasted.
+            if (!req.fUrgent && nResultsUsage >= nMaxResultsUsage)
+                continue;
+
+            // The epoch is taken before reading so that a write racing with the read makes the result stale.
+            uint64_t nReadEpoch = nEpoch;
+            CCoins coins;
+            bool fFound;
+            lock.unlock();
+            try {
+                fFound = base->GetCoins(req.txid, coins);
+            } catch (const std::exception&) {
+                // Left for ConnectBlock to run into and report.
+                fFound = false;
+            }
+            lock.lock();
+
+            if (fFound) {
+                stats.nFetched++;
+                if (nReadEpoch == nEpoch && mapResults.count(req.txid) == 0) {
+                    CCoins& result = mapResults[req.txid];
+                    result.swap(coins);
+                    nResultsUsage += result.DynamicMemoryUsage() + sizeof(CCoins);
+                } else {
+                    stats.nDiscarded++;
+                }
+            }
+            Finished(req);
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Nothing would ever finish the remaining reads, so release anyone waiting for them.
+        if (--nWorkers == 0) {
+            queue.clear();
+            mapPending.clear();
+            condDone.notify_all();
+        }
+        throw;
+    }
+}
+
+void CCoinsPrefetcher::Enqueue(const uint256& hashBlock, const std::vector<uint256>& vTxids, bool fUrgent)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (nWorkers == 0)
+        return;
+    int nQueued = 0;
+    for (std::vector<uint256>::const_iterator it = vTxids.begin(); it != vTxids.end(); ++it) {
+        if (mapResults.count(*it))
+            continue;
+        Request req;
+        req.hashBlock = hashBlock;
+        req.txid = *it;
+        req.fUrgent = fUrgent;
+        if (fUrgent)
+            queue.push_front(req);
+        else
+            queue.push_back(req);
+        nQueued++;
+    }
+    if (nQueued == 0)
+        return;
+    if (fUrgent)
+        mapPending[hashBlock] += nQueued;
+    stats.nRequested += nQueued;
+    if (nQueued == 1)
+        condWorker.notify_one();
+    else
+        condWorker.notify_all();
+}
+
+void CCoinsPrefetcher::Wait(const uint256& hashBlock)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (mapPending.count(hashBlock))
+        condDone.wait(lock);
+}
+
+size_t CCoinsPrefetcher::Apply(CCoinsViewCache& cache)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    size_t nAdded = 0;
+    for (boost::unordered_map<uint256, CCoins, SaltedTxidHasher>::iterator it = mapResults.begin(); it != mapResults.end(); ++it) {
+        if (cache.AddFetchedCoins(it->first, it->second))
+            nAdded++;
+    }
+    stats.nAdded += nAdded;
+    stats.nDiscarded += mapResults.size() - nAdded;
+    mapResults.clear();
+    nResultsUsage = 0;
+    return nAdded;
+}
+
+void CCoinsPrefetcher::Invalidate()
+{
+    // Bumped before taking the lock, so that reads still in flight are dropped by their worker.
+    nEpoch++;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    stats.nDiscarded += mapResults.size();
+    mapResults.clear();
+    nResultsUsage = 0;
+}
+
+CCoinsPrefetchStats CCoinsPrefetcher::GetStats()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return stats;
+}
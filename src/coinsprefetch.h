@@ -0,0 +1,94 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "coins.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+/** Counters of a CCoinsPrefetcher since startup */
+struct CCoinsPrefetchStats {
+    //! Transactions whose coins were queued for reading
+    uint64_t nRequested;
+    //! Of those, found in the database
+    uint64_t nFetched;
+    //! Added to a coins cache ahead of block connection, each one a database read saved there
+    uint64_t nAdded;
+    //! Read but not used, because the cache already had them, the database changed or the buffer was full
+    uint64_t nDiscarded;
+
+    CCoinsPrefetchStats() : nRequested(0), nFetched(0), nAdded(0), nDiscarded(0) {}
+};
+
+/**
+ * Reads the coins spent by blocks that are about to be connected from the
+ * coin database on a pool of threads, so that ConnectBlock finds them in the
+ * cache instead of doing one random read per input.
+ *
+ * Coins read from the database are only valid for a cache while the database
+ * is not written, so every write must be followed by Invalidate(); anything
+ * read before it is dropped.
+ */
+class CCoinsPrefetcher {
+private:
+    struct Request {
+        uint256 hashBlock;
+        uint256 txid;
+        bool fUrgent;
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condDone;
+
+    std::deque<Request> queue;
+    //! Number of queued or running urgent reads per block
+    std::map<uint256, int> mapPending;
+    boost::unordered_map<uint256, CCoins, SaltedTxidHasher> mapResults;
+    size_t nResultsUsage;
+    size_t nMaxResultsUsage;
+    //! Incremented after every write to the database
+    std::atomic<uint64_t> nEpoch;
+    int nWorkers;
+    CCoinsPrefetchStats stats;
+
+    void Finished(const Request& req);
+
+public:
+    CCoinsPrefetcher(size_t nMaxResultsUsageIn);
+
+    //! Worker thread, reading from base until interrupted
+    void Thread(CCoinsView* base);
+
+    /**
+     * Queue reads of the coins of vTxids, spent by block hashBlock. Urgent
+     * reads go before everything else and are kept even when the buffer is
+     * full. Does nothing while no worker is running.
+     */
+    void Enqueue(const uint256& hashBlock, const std::vector<uint256>& vTxids, bool fUrgent);
+
+    //! Wait until all urgent reads queued for hashBlock are done.
+    void Wait(const uint256& hashBlock);
+
+    //! Move everything read since the last Invalidate() into cache, returning the number of coins added.
+    size_t Apply(CCoinsViewCache& cache);
+
+    //! Drop everything read so far. Must be called after the database is written.
+    void Invalidate();
+
+    CCoinsPrefetchStats GetStats();
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
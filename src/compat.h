@@ -73,6 +73,10 @@ typedef u_int SOCKET;
 #define MAX_PATH 1024
 #endif
 
+#if defined(__linux__)
+#define USE_EPOLL 1 // the socket handler waits with epoll, so its peer sockets are not limited by FD_SETSIZE
+#endif
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -0,0 +1,113 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/*
+ * Body of the interleaved double SHA-256 kernel for 64-byte inputs.
+ *
+ * This file is included by sha256_simd.cpp once per instruction set, inside
+ * its own namespace and target region, with SHA256_LANES set to the number of
+ * inputs hashed per call. Word k of every lane lives in one vector so that the
+ * rounds run on all lanes at once.
+ *
+ * Do not include this file anywhere else.
+ */
+
+typedef uint32_t sha256_vec_t __attribute__((vector_size(SHA256_LANES * 4)));
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t INIT[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static inline sha256_vec_t Broadcast(uint32_t x)
+{
+    sha256_vec_t v = {};
+    return v + x;
+}
+
+static inline sha256_vec_t Ch(sha256_vec_t x, sha256_vec_t y, sha256_vec_t z) { return z ^ (x & (y ^ z)); }
+static inline sha256_vec_t Maj(sha256_vec_t x, sha256_vec_t y, sha256_vec_t z) { return (x & y) | (z & (x | y)); }
+static inline sha256_vec_t Sigma0(sha256_vec_t x) { return (x >> 2 | x << 30) ^ (x >> 13 | x << 19) ^ (x >> 22 | x << 10); }
+static inline sha256_vec_t Sigma1(sha256_vec_t x) { return (x >> 6 | x << 26) ^ (x >> 11 | x << 21) ^ (x >> 25 | x << 7); }
+static inline sha256_vec_t sigma0(sha256_vec_t x) { return (x >> 7 | x << 25) ^ (x >> 18 | x << 14) ^ (x >> 3); }
+static inline sha256_vec_t sigma1(sha256_vec_t x) { return (x >> 17 | x << 15) ^ (x >> 19 | x << 13) ^ (x >> 10); }
+
+/** Run the 64 rounds over message block w and add the result into state s. */
+static inline void Compress(sha256_vec_t s[8], sha256_vec_t w[16])
+{
+    sha256_vec_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; ++i) {
+        if (i >= 16)
+            w[i & 15] += sigma1(w[(i - 2) & 15]) + w[(i - 7) & 15] + sigma0(w[(i - 15) & 15]);
+        sha256_vec_t t1 = h + Sigma1(e) + Ch(e, f, g) + K[i] + w[i & 15];
+        sha256_vec_t t2 = Sigma0(a) + Maj(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+    s[4] += e;
+    s[5] += f;
+    s[6] += g;
+    s[7] += h;
+}
+
+/** Double SHA-256 of SHA256_LANES consecutive 64 byte inputs into SHA256_LANES consecutive 32 byte outputs. */
+static void sha256d64_multilane(unsigned char* out, const unsigned char* in)
+{
+    sha256_vec_t s[8];
+    sha256_vec_t w[16];
+    uint32_t W[SHA256_LANES];
+    int k, l;
+
+    // First hash, block 1: the input itself.
+    for (k = 0; k < 16; ++k) {
+        for (l = 0; l < SHA256_LANES; ++l)
+            W[l] = ReadBE32(in + 64 * l + 4 * k);
+        memcpy(&w[k], W, sizeof(W));
+    }
+    for (k = 0; k < 8; ++k)
+        s[k] = Broadcast(INIT[k]);
+    Compress(s, w);
+
+    // First hash, block 2: padding for a 64 byte message.
+    w[0] = Broadcast(0x80000000);
+    for (k = 1; k < 15; ++k)
+        w[k] = Broadcast(0);
+    w[15] = Broadcast(512);
+    Compress(s, w);
+
+    // Second hash: the 32 byte digest of the first, padded in the same block.
+    for (k = 0; k < 8; ++k)
+        w[k] = s[k];
+    w[8] = Broadcast(0x80000000);
+    for (k = 9; k < 15; ++k)
+        w[k] = Broadcast(0);
+    w[15] = Broadcast(256);
+    for (k = 0; k < 8; ++k)
+        s[k] = Broadcast(INIT[k]);
+    Compress(s, w);
+
+    for (k = 0; k < 8; ++k) {
+        memcpy(W, &s[k], sizeof(W));
+        for (l = 0; l < SHA256_LANES; ++l)
+            WriteBE32(out + 32 * l + 4 * k, W[l]);
+    }
+}
@@ -0,0 +1,168 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 transforms for specific instruction sets: a single buffer transform
+// using the SHA extensions, and interleaved 4-way (SSE4.1) and 8-way (AVX2)
+// double SHA-256 of 64-byte inputs. Each is compiled for its instruction set
+// with a target region so that the rest of the binary keeps the baseline flags;
+// SHA256AutoDetect() in sha256.cpp only selects the ones the CPU supports.
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.1,sha"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("sse4.1,sha")
+#endif
+namespace sha256_shani {
+namespace {
+    alignas(16) const uint8_t MASK[16] = {0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04, 0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c};
+
+    alignas(16) const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    /** Four rounds on message quad m (already containing W + K). */
+    inline void QuadRound(__m128i& state0, __m128i& state1, __m128i msg)
+    {
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+    }
+
+    /** Next message quad from the four previous ones: W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16]. */
+    inline __m128i NextMessage(__m128i m4, __m128i m3, __m128i m2, __m128i m1)
+    {
+        return _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m4, m3), _mm_alignr_epi8(m1, m2, 4)), m1);
+    }
+
+    inline __m128i Load(const unsigned char* in)
+    {
+        return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), _mm_load_si128((const __m128i*)MASK));
+    }
+
+    /** Convert the DCBA/HGFE state words into the ABEF/CDGH layout the SHA instructions work on. */
+    inline void Shuffle(__m128i& s0, __m128i& s1)
+    {
+        const __m128i t1 = _mm_shuffle_epi32(s0, 0xB1);
+        const __m128i t2 = _mm_shuffle_epi32(s1, 0x1B);
+        s0 = _mm_alignr_epi8(t1, t2, 0x08);
+        s1 = _mm_blend_epi16(t2, t1, 0xF0);
+    }
+
+    inline void Unshuffle(__m128i& s0, __m128i& s1)
+    {
+        const __m128i t1 = _mm_shuffle_epi32(s0, 0x1B);
+        const __m128i t2 = _mm_shuffle_epi32(s1, 0xB1);
+        s0 = _mm_blend_epi16(t1, t2, 0xF0);
+        s1 = _mm_alignr_epi8(t2, t1, 0x08);
+    }
+} // namespace
+
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i m0, m1, m2, m3, s0, s1, so0, so1;
+
+    s0 = _mm_loadu_si128((const __m128i*)s);
+    s1 = _mm_loadu_si128((const __m128i*)(s + 4));
+    Shuffle(s0, s1);
+
+    while (blocks--) {
+        so0 = s0;
+        so1 = s1;
+
+        m0 = Load(chunk);
+        QuadRound(s0, s1, _mm_add_epi32(m0, _mm_load_si128((const __m128i*)(K + 0))));
+        m1 = Load(chunk + 16);
+        QuadRound(s0, s1, _mm_add_epi32(m1, _mm_load_si128((const __m128i*)(K + 4))));
+        m2 = Load(chunk + 32);
+        QuadRound(s0, s1, _mm_add_epi32(m2, _mm_load_si128((const __m128i*)(K + 8))));
+        m3 = Load(chunk + 48);
+        QuadRound(s0, s1, _mm_add_epi32(m3, _mm_load_si128((const __m128i*)(K + 12))));
+
+        for (int i = 16; i < 64; i += 16) {
+            m0 = NextMessage(m0, m1, m2, m3);
+            QuadRound(s0, s1, _mm_add_epi32(m0, _mm_load_si128((const __m128i*)(K + i))));
+            m1 = NextMessage(m1, m2, m3, m0);
+            QuadRound(s0, s1, _mm_add_epi32(m1, _mm_load_si128((const __m128i*)(K + i + 4))));
+            m2 = NextMessage(m2, m3, m0, m1);
+            QuadRound(s0, s1, _mm_add_epi32(m2, _mm_load_si128((const __m128i*)(K + i + 8))));
+            m3 = NextMessage(m3, m0, m1, m2);
+            QuadRound(s0, s1, _mm_add_epi32(m3, _mm_load_si128((const __m128i*)(K + i + 12))));
+        }
+
+        s0 = _mm_add_epi32(s0, so0);
+        s1 = _mm_add_epi32(s1, so1);
+        chunk += 64;
+    }
+
+    Unshuffle(s0, s1);
+    _mm_storeu_si128((__m128i*)s, s0);
+    _mm_storeu_si128((__m128i*)(s + 4), s1);
+}
+} // namespace sha256_shani
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.1"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+namespace sha256d64_sse41 {
+#define SHA256_LANES 4
+#include "crypto/sha256_multilane_impl.h"
+#undef SHA256_LANES
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    sha256d64_multilane(out, in);
+}
+} // namespace sha256d64_sse41
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+namespace sha256d64_avx2 {
+#define SHA256_LANES 8
+#include "crypto/sha256_multilane_impl.h"
+#undef SHA256_LANES
+
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    sha256d64_multilane(out, in);
+}
+} // namespace sha256d64_avx2
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -19,6 +19,7 @@
 #include "utilstrencodings.h"
 
 #include <boost/algorithm/string.hpp> // boost::trim
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp> //BOOST_FOREACH
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
@@ -184,9 +185,21 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string&)
 
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
 
-        } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+        } else if (valRequest.isArray()) {
+            // Spread the batch over the helper threads and stream the replies out as they complete.
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReplyStart(HTTP_OK);
+            boost::shared_ptr<JSONRPCBatch> batch(new JSONRPCBatch(valRequest.get_array(),
+                                                                   boost::bind(&HTTPRequest::WriteReplyChunk, req, _1)));
+            int nHelpers = std::min((int)valRequest.size(), (int)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS)) - 1;
+            for (int i = 0; i < nHelpers; i++)
+                if (!HTTPRunOnHelper(boost::bind(&JSONRPCBatch::Work, batch)))
+                    break;
+            batch->Work();
+            batch->Wait();
+            req->WriteReplyEnd();
+            return true;
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
         req->WriteHeader("Content-Type", "application/json");
@@ -61,6 +61,22 @@ private:
     HTTPRequestHandler func;
 };
 
+/** Work item running a function for a handler that spreads its work over the worker threads */
+class HTTPFunctionWorkItem : public HTTPClosure {
+public:
+    HTTPFunctionWorkItem(const boost::function<void(void)>& func)
+        : func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
  */
@@ -180,6 +196,8 @@ struct evhttp* eventHTTP = 0;
 static std::vector<CSubNet> rpc_allow_subnets;
 
 static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work that handlers spread over several threads, kept apart from the request queue
+static WorkQueue<HTTPClosure>* helperQueue = 0;
 
 std::vector<HTTPPathHandler> pathHandlers;
 
@@ -425,6 +443,10 @@ bool InitHTTPServer()
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
     workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    // One helper less than there are workers, as the worker running the handler takes part itself.
+    int helperThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L) - 1;
+    if (helperThreads > 0)
+        helperQueue = new WorkQueue<HTTPClosure>(helperThreads);
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -441,6 +463,8 @@ bool StartHTTPServer()
 
     for (int i = 0; i < rpcThreads; i++)
         boost::thread(boost::bind(&HTTPWorkQueueRun, workQueue));
+    for (int i = 0; i < rpcThreads - 1 && helperQueue; i++)
+        boost::thread(boost::bind(&HTTPWorkQueueRun, helperQueue));
     return true;
 }
 
@@ -457,6 +481,8 @@ void InterruptHTTPServer()
     }
     if (workQueue)
         workQueue->Interrupt();
+    if (helperQueue)
+        helperQueue->Interrupt();
 }
 
 void StopHTTPServer()
@@ -467,6 +493,11 @@ void StopHTTPServer()
         workQueue->WaitExit();
         delete workQueue;
     }
+    if (helperQueue) {
+        helperQueue->WaitExit();
+        delete helperQueue;
+        helperQueue = 0;
+    }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
 
@@ -496,6 +527,17 @@ struct event_base* EventBase()
     return eventBase;
 }
 
+bool HTTPRunOnHelper(const boost::function<void(void)>& fn)
+{
+    if (!helperQueue)
+        return false;
+    std::unique_ptr<HTTPClosure> item(new HTTPFunctionWorkItem(fn));
+    if (!helperQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* if true, queue took ownership */
+    return true;
+}
+
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
 {
 
@@ -526,11 +568,15 @@ void HTTPEvent::trigger(struct timeval* tv)
 HTTPRequest::HTTPRequest(struct evhttp_request* req)
     : req(req)
     , replySent(false)
+    , replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyStarted && !replySent) {
+        LogPrintf("%s: Unfinished reply\n", __func__);
+        WriteReplyEnd();
+    } else if (!replySent) {
 
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -582,7 +628,7 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
+    assert(!replySent && !replyStarted && req);
 
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
@@ -594,6 +640,41 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+static void http_reply_chunk(struct evhttp_request* req, struct evbuffer* evb)
+{
+    evhttp_send_reply_chunk(req, evb);
+    evbuffer_free(evb);
+}
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && !replyStarted && req);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+                                  boost::bind(evhttp_send_reply_start, req, nStatus, (const char*)NULL));
+    ev->trigger(0);
+    replyStarted = true;
+}
+
+void HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(replyStarted && !replySent && req);
+    // Events are handled in the order they were triggered, so the pieces go out in order.
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, boost::bind(http_reply_chunk, req, evb));
+    ev->trigger(0);
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(replyStarted && !replySent && req);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, boost::bind(evhttp_send_reply_end, req));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
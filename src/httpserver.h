@@ -49,6 +49,13 @@ void UnregisterHTTPHandler(const std::string& prefix, bool exactMatch);
  */
 struct event_base* EventBase();
 
+/** Run fn on one of the HTTP helper threads, for handlers that spread their
+ * work over several threads. The helpers are separate from the workers that
+ * serve requests, so this never takes space in the request work queue.
+ * Returns false if the helper queue is full.
+ */
+bool HTTPRunOnHelper(const boost::function<void(void)>& fn);
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -56,6 +63,7 @@ class HTTPRequest {
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyStarted;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -111,6 +119,28 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body is sent piece by piece with WriteReplyChunk
+     * and finished with WriteReplyEnd. HTTP/1.1 clients get chunked transfer
+     * encoding.
+     *
+     * @note Call this instead of WriteReply, after WriteHeader.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /**
+     * Send the next piece of a reply started with WriteReplyStart.
+     */
+    void WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Finish a reply started with WriteReplyStart.
+     *
+     * @note As this will give the request back to the main thread, do not
+     * call any other HTTPRequest methods after calling this.
+     */
+    void WriteReplyEnd();
 };
 
 /** Event handler closure.
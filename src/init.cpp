@@ -19,6 +19,7 @@
 #include "addrman.h"
 #include "amount.h"
 #include "chain.h"
+#include "blockfilterindex.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include <Gulden/auto_checkpoints.h>
@@ -36,6 +37,8 @@
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "scriptindex.h"
+#include "stratum.h"
 #include "timedata.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -43,11 +46,13 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utxosnapshot.h"
 #include "validationinterface.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 #endif
+#include <atomic>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -73,6 +78,8 @@
 using namespace std;
 
 bool fFeeEstimatesInitialized = false;
+/** Set once mempool.dat has been loaded, so that a partially loaded mempool never overwrites it */
+static std::atomic<bool> fDumpMempoolLater(false);
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
@@ -146,6 +153,7 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    InterruptStratumServer();
     threadGroup.interrupt_all();
 }
 
@@ -172,7 +180,11 @@ void Shutdown()
     GenerateBitcoins(false, 0, Params());
     StopNode();
     StopTorControl();
+    StopStratumServer();
+    StopBlockTemplateUpdates();
     UnregisterNodeSignals(GetNodeSignals());
+    if (fDumpMempoolLater)
+        DumpMempool();
 
     if (fFeeEstimatesInitialized) {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -188,6 +200,8 @@ void Shutdown()
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            if (GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT))
+                WriteBlockIndexSnapshot();
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
@@ -197,6 +211,13 @@ void Shutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        if (pblockfilterindex) {
+            UnregisterValidationInterface(pblockfilterindex);
+            delete pblockfilterindex;
+            pblockfilterindex = NULL;
+        }
+        delete pscriptindex;
+        pscriptindex = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -278,6 +299,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumeutxohash=<hex>", _("UTXO set hash (as reported by gettxoutsetinfo) the snapshot given with -loadutxosnapshot must match, for blocks without a built in value"));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of compact block filters (BIP158), used by the getblockfilter rpc call (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
+    strUsage += HelpMessageOpt("-blockindexsnapshot", strprintf(_("Write the block index to a flat file at shutdown and load it from there at the next startup (default: %u)"), DEFAULT_BLOCKINDEX_SNAPSHOT));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -294,14 +318,18 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadutxosnapshot=<file>", _("Replace the chain state with a UTXO set written by dumptxoutset, then validate the blocks below it in the background. The block files up to the snapshot block must already be present. Ignored once the chain state has reached the snapshot block"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-mempooldumpinterval=<n>", strprintf(_("Also save the mempool every <n> seconds while running, 0 to only save it on shutdown (default: %u)"), DEFAULT_MEMPOOL_DUMP_INTERVAL));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
                                                      -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads reading the coins spent by incoming blocks ahead of connecting them (0 to %d, default: %d)"), MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode is incompatible with -txindex and -rescan. "
                                                          "Warning: Reverting this setting requires re-downloading the entire blockchain. "
                                                          "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"),
@@ -311,6 +339,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-scriptindex", strprintf(_("Maintain an index of the payments to and from every address, used by the getaddresshistory and getaddressutxos rpc calls (default: %u)"), DEFAULT_SCRIPTINDEX));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -330,9 +359,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
+    strUsage += HelpMessageOpt("-msgprocthreads=<n>", strprintf(_("Number of threads processing peer messages (1-%d, default: %d)"), MAX_MSGPROC_THREADS, DEFAULT_MSGPROC_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers per BIP157, requires -blockfilterindex (default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
@@ -373,6 +404,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
+        strUsage += HelpMessageOpt("-checkblockreadpow", strprintf("Recompute the proof of work of blocks read back from disk instead of relying on the block index (default: %u)", DEFAULT_CHECKBLOCKREADPOW));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
@@ -383,7 +415,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq"; // Don't translate these and qt below
+    string debugCategories = "addrman, alert, bench, blockfilter, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, scriptindex, selectcoins, stratum, tor, zmq"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " + _("If <category> is not supplied or if <category> = 1, output all debugging information.") + _("<category> can be:") + " " + debugCategories + ".");
@@ -427,9 +459,17 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
     strUsage += HelpMessageOpt("-coinbasesignature=<signature>", _("Set a signature to add to the coinbase of any mined blocks."));
+    strUsage += HelpMessageOpt("-keepblocktemplate", strprintf(_("Keep a block template up to date in the background for getblocktemplate and the internal miner (default: %u)"), DEFAULT_KEEP_BLOCK_TEMPLATE));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
 
+    strUsage += HelpMessageGroup(_("Stratum server options:"));
+    strUsage += HelpMessageOpt("-stratum", strprintf(_("Accept Stratum mining connections (default: %u)"), DEFAULT_STRATUM));
+    strUsage += HelpMessageOpt("-stratumaddress=<address>", _("Pay blocks mined through Stratum to this address (default: a key from the wallet)"));
+    strUsage += HelpMessageOpt("-stratumbind=<addr>", _("Bind to given address to listen for Stratum connections. Use [host]:port notation for IPv6 (default: 127.0.0.1)"));
+    strUsage += HelpMessageOpt("-stratumdifficulty=<n>", strprintf(_("Share difficulty given to Stratum miners (default: %g)"), DEFAULT_STRATUM_DIFFICULTY));
+    strUsage += HelpMessageOpt("-stratumport=<port>", strprintf(_("Listen for Stratum connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT));
+
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
@@ -587,6 +627,17 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        fDumpMempoolLater = !fRequestShutdown;
+    }
+}
+
+static void PeriodicDumpMempool()
+{
+    if (fDumpMempoolLater)
+        DumpMempool();
 }
 
 /** Sanity checks
@@ -773,6 +824,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
+        if (GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX))
+            return InitError(_("Prune mode is incompatible with -scriptindex."));
 #ifdef ENABLE_WALLET
         if (GetBoolArg("-rescan", false)) {
             return InitError(_("Rescans are not possible in pruned mode. You will need to use -reindex which will download the whole blockchain again."));
@@ -823,6 +878,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fCheckBlockReadPoW = GetBoolArg("-checkblockreadpow", DEFAULT_CHECKBLOCKREADPOW);
 
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
@@ -904,6 +960,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Cannot set -peerblockfilters without -blockfilterindex."));
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_FILTERS);
+    }
+
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
     fEnableReplacement = GetBoolArg("-mempoolreplacement", DEFAULT_ENABLE_REPLACEMENT);
@@ -915,6 +977,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         fEnableReplacement = (std::find(vstrReplacementModes.begin(), vstrReplacementModes.end(), "fee") != vstrReplacementModes.end());
     }
 
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
 
@@ -940,10 +1004,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    InitSignatureCache();
+
+    LogPrintf("Using %u threads for script and header proof of work verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i = 0; i < nScriptCheckThreads - 1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+            threadGroup.create_thread(&ThreadHeaderPoWCheck);
     }
 
     if (mapArgs.count("-checkpointkey")) {
@@ -978,6 +1046,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #if defined(USE_SSE2)
     scrypt_detect_sse2();
 #endif
+    scrypt_detect_multilane();
 
 #ifdef ENABLE_WALLET
     if (!fDisableWallet) {
@@ -1113,6 +1182,23 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     fReindex = GetBoolArg("-reindex", false);
     bool fReindexChainState = GetBoolArg("-reindex-chainstate", false);
+    bool fLoadUTXOSnapshot = mapArgs.count("-loadutxosnapshot");
+    if (fLoadUTXOSnapshot && (fReindex || fPruneMode))
+        return InitError(_("-loadutxosnapshot is incompatible with -reindex and -prune"));
+    // Blocks below the snapshot have no undo data, which building the filters and the script index needs.
+    if (fLoadUTXOSnapshot && GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+        return InitError(_("-loadutxosnapshot is incompatible with -blockfilterindex"));
+    if (fLoadUTXOSnapshot && GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX))
+        return InitError(_("-loadutxosnapshot is incompatible with -scriptindex"));
+    std::string strUTXOSnapshot = GetArg("-loadutxosnapshot", "");
+    uint256 hashUTXOSnapshotBlock;
+    if (fLoadUTXOSnapshot) {
+        CUTXOSnapshotInfo info;
+        if (!ReadUTXOSnapshotInfo(strUTXOSnapshot, chainparams, info))
+            return InitError(strprintf(_("Unable to load UTXO snapshot %s, see debug.log for details"), strUTXOSnapshot));
+        hashUTXOSnapshotBlock = info.hashBlock;
+    }
+    bool fValidateUTXOSnapshot = false;
 
     boost::filesystem::path blocksDir = GetDataDir() / "blocks";
     if (!boost::filesystem::exists(blocksDir)) {
@@ -1145,6 +1231,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nBlockTreeDBCache = nTotalCache / 8;
     nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nBlockFilterDBCache = 0;
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        nBlockFilterDBCache = std::min(nTotalCache / 8, nMaxBlockFilterDBCache << 20);
+        nTotalCache -= nBlockFilterDBCache;
+    }
+    int64_t nScriptIndexDBCache = 0;
+    if (GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX)) {
+        nScriptIndexDBCache = std::min(nTotalCache / 8, nMaxScriptIndexDBCache << 20);
+        nTotalCache -= nScriptIndexDBCache;
+    }
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
@@ -1152,6 +1248,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    if (nBlockFilterDBCache > 0)
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nBlockFilterDBCache * (1.0 / 1024 / 1024));
+    if (nScriptIndexDBCache > 0)
+        LogPrintf("* Using %.1fMiB for script index database\n", nScriptIndexDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
@@ -1187,6 +1287,43 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                if (fLoadUTXOSnapshot) {
+                    // -loadutxosnapshot is typically left in the configuration after the first start, so a chain
+                    // state that already reached the snapshot block is kept instead of being replaced again.
+                    BlockMap::iterator mi = mapBlockIndex.find(hashUTXOSnapshotBlock);
+                    if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second)) {
+                        InitWarning(strprintf(_("The chain state is already at or past block %s of the UTXO snapshot, -loadutxosnapshot is ignored."), hashUTXOSnapshotBlock.ToString()));
+                        fLoadUTXOSnapshot = false;
+                    } else {
+                        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+                        UnloadBlockIndex();
+                        delete pcoinsTip;
+                        delete pcoinscatcher;
+                        delete pcoinsdbview;
+                        pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, true);
+                        pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                        pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+
+                        CUTXOSnapshotInfo info;
+                        if (!LoadUTXOSnapshot(pcoinsdbview, strUTXOSnapshot, chainparams, uint256S(GetArg("-assumeutxohash", "")), info))
+                            return InitError(strprintf(_("Unable to load UTXO snapshot %s, see debug.log for details"), strUTXOSnapshot));
+
+                        if (!LoadBlockIndex()) {
+                            strLoadError = _("Error loading block database");
+                            break;
+                        }
+                    }
+                }
+
+                uint256 hashSnapshotBlock, hashSnapshotUTXO;
+                if (pcoinsdbview->ReadSnapshotBase(hashSnapshotBlock, hashSnapshotUTXO)) {
+                    BlockMap::iterator mi = mapBlockIndex.find(hashSnapshotBlock);
+                    if (pcoinsdbview->GetBestBlock().IsNull() || mi == mapBlockIndex.end() || mi->second->nChainTx == 0)
+                        return InitError(_("The chain state was loaded from a UTXO snapshot that did not finish loading or whose block is missing from the block files. "
+                                           "Restart with -loadutxosnapshot or -reindex-chainstate."));
+                    fValidateUTXOSnapshot = true;
+                }
+
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
                     return InitError(_("Incorrect or no genesis block found. Wrong datadir for network?"));
 
@@ -1255,6 +1392,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     "", CClientUIInterface::MSG_ERROR | CClientUIInterface::BTN_ABORT);
                 if (fRet) {
                     fReindex = true;
+                    fLoadUTXOSnapshot = false;
                     fRequestShutdown = false;
                 } else {
                     LogPrintf("Aborted block database rebuild. Exiting.\n");
@@ -1272,6 +1410,21 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        // Entries are keyed by block hash, so the index survives -reindex-chainstate but not a new block database.
+        pblockfilterindex = new CBlockFilterIndex(BLOCK_FILTER_BASIC, nBlockFilterDBCache, false, fReindex);
+        pblockfilterindex->Init();
+        RegisterValidationInterface(pblockfilterindex);
+    }
+
+    if (GetBoolArg("-scriptindex", DEFAULT_SCRIPTINDEX)) {
+        // The index follows the chainstate, so it is rebuilt along with it.
+        LOCK(cs_main);
+        pscriptindex = new CScriptIndex(nScriptIndexDBCache, false, fReindex || fReindexChainState);
+        if (!pscriptindex->Init())
+            return InitError(_("Error loading the script index, restart with -reindex-chainstate to rebuild it"));
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
 
@@ -1326,6 +1479,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
 
+    int nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS));
+    LogPrintf("Using %u threads for coin prefetching\n", nPrefetchThreads);
+    for (int i = 0; i < nPrefetchThreads; i++)
+        threadGroup.create_thread(boost::bind(&ThreadCoinsPrefetch, pcoinsdbview));
+
+    if (pblockfilterindex) {
+        boost::function<void()> syncBlockFilters = boost::bind(&CBlockFilterIndex::ThreadSync, pblockfilterindex);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "blockfilter", syncBlockFilters));
+    }
+
+    if (pscriptindex) {
+        boost::function<void()> syncScriptIndex = boost::bind(&CScriptIndex::ThreadSync, pscriptindex);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "scriptindex", syncScriptIndex));
+    }
+
+    if (fValidateUTXOSnapshot) {
+        boost::function<void()> validateSnapshot = boost::bind(&ThreadValidateUTXOSnapshot, pcoinsdbview);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "utxocheck", validateSnapshot));
+    }
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
     {
@@ -1352,8 +1525,18 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     StartNode(threadGroup, scheduler);
 
+    int64_t nMempoolDumpInterval = GetArg("-mempooldumpinterval", DEFAULT_MEMPOOL_DUMP_INTERVAL);
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL) && nMempoolDumpInterval > 0)
+        scheduler.scheduleEvery(&PeriodicDumpMempool, nMempoolDumpInterval);
+
+    if (GetBoolArg("-keepblocktemplate", DEFAULT_KEEP_BLOCK_TEMPLATE))
+        StartBlockTemplateUpdates(threadGroup, chainparams);
+
     GenerateBitcoins(GetBoolArg("-gen", DEFAULT_GENERATE), GetArg("-genproclimit", DEFAULT_GENERATE_THREADS), chainparams);
 
+    if (!StartStratumServer(threadGroup, chainparams))
+        return false;
+
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
@@ -16,10 +16,12 @@
 #include "alert.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "blockfilterindex.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "Gulden/auto_checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
@@ -37,6 +39,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "scriptindex.h"
 #include "tinyformat.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -74,8 +77,12 @@ using namespace std;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+/** Owns the entries of mapBlockIndex */
+static CBlockIndexArena arenaBlockIndex;
 CChain chainActive;
 CBlockIndex* pindexBestHeader = NULL;
+/** Replaced through boost::atomic_store, read through boost::atomic_load */
+static boost::shared_ptr<const CChainTipSnapshot> pchainTipSnapshot(new CChainTipSnapshot());
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
@@ -89,6 +96,7 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fCheckBlockReadPoW = DEFAULT_CHECKBLOCKREADPOW;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
@@ -1023,7 +1031,7 @@ std::string FormatStateMessage(const CValidationState& state)
 }
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
                               std::vector<uint256>& vHashTxnToUncache)
 {
     const uint256 hash = tx.GetHash();
@@ -1149,7 +1157,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
         unsigned int nSize = entry.GetTxSize();
 
         if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
@@ -1333,11 +1341,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
     std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
     if (!res) {
         BOOST_FOREACH (const uint256& hashTx, vHashTxToUncache)
             pcoinsTip->Uncache(hashTx);
@@ -1345,13 +1353,20 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, nAbsurdFee);
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::Params& consensusParams, uint256& hashBlock, bool fAllowSlow)
 {
     CBlockIndex* pindexSlow = NULL;
 
-    LOCK(cs_main);
-
+    // The mempool and the transaction index have their own locking, and
+    // -txindex cannot be combined with pruning, so only the slow path below
+    // needs cs_main.
     std::shared_ptr<const CTransaction> ptx = mempool.get(hash);
     if (ptx) {
         txOut = *ptx;
@@ -1381,6 +1396,7 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        LOCK(cs_main);
         int nHeight = -1;
         {
             const CCoinsViewCache& view = *pcoinsTip;
@@ -1427,7 +1443,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
     block.SetNull();
 
@@ -1442,7 +1458,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
@@ -1450,7 +1466,11 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    // Every block index entry went through AcceptBlockHeader, which checked the scrypt proof of work,
+    // before it was added to (and written to) the block index. A block that hashes to the index entry
+    // therefore has a header identical to an already verified one, so the expensive scrypt hash is only
+    // redone if explicitly asked for with -checkblockreadpow.
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams, fCheckBlockReadPoW))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1458,6 +1478,55 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart)
+{
+    block.clear();
+
+    // The block is preceded by the message start and its size, see WriteBlockToDisk.
+    CDiskBlockPos hpos = pos;
+    if (hpos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk: invalid position %s", pos.ToString());
+    hpos.nPos -= MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkStart) >> nSize;
+        if (memcmp(blkStart, messageStart, MESSAGE_START_SIZE) != 0)
+            return error("ReadRawBlockFromDisk: block magic mismatch at %s", pos.ToString());
+        if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("ReadRawBlockFromDisk: block size %u too large at %s", nSize, pos.ToString());
+        block.resize(nSize);
+        filein.read((char*)block.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: Read or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    // Only the header is decoded, to make sure these are the bytes of the block that was asked for.
+    CBlockHeader header;
+    try {
+        CDataStream ssHeader((const char*)block.data(), (const char*)block.data() + block.size(), SER_DISK, CLIENT_VERSION);
+        ssHeader >> header;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    if (header.GetHash() != hash)
+        return error("ReadRawBlockFromDisk: GetHash() doesn't match %s at %s", hash.ToString(), pos.ToString());
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    return ReadRawBlockFromDisk(block, pindex->GetBlockPos(), pindex->GetBlockHash(), messageStart);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     CAmount nSubsidy = 0;
@@ -1662,8 +1731,8 @@ bool CScriptCheck::operator()()
 {
     const CScript& scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness* witness = (nIn < ptxTo->wit.vtxinwit.size()) ? &ptxTo->wit.vtxinwit[nIn].scriptWitness : NULL;
-    if (!VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata), &error)) {
-        return false;
+    if (!VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata, pvCacheEntries), &error)) {
+        return pvCacheEntries != NULL;
     }
     return true;
 }
@@ -1778,6 +1847,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
 
@@ -1803,6 +1874,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage = "")
 {
@@ -1856,7 +1929,7 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CBlockUndo* pblockundo)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1908,6 +1981,9 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
+    if (pblockundo)
+        pblockundo->vtxundo.swap(blockUndo.vtxundo);
+
     if (pfClean) {
         *pfClean = fClean;
         return true;
@@ -1949,6 +2025,89 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CHeaderPoWCheck> headerpowcheckqueue(16);
+
+void ThreadHeaderPoWCheck()
+{
+    RenameThread("Gulden-powch");
+    headerpowcheckqueue.Thread();
+}
+
+static CCoinsPrefetcher coinsprefetcher(MAX_PREFETCH_BUFFER);
+
+void ThreadCoinsPrefetch(CCoinsView* base)
+{
+    RenameThread("Gulden-prefetch");
+    coinsprefetcher.Thread(base);
+}
+
+CCoinsPrefetchStats GetCoinsPrefetchStats()
+{
+    return coinsprefetcher.GetStats();
+}
+
+/** Queue reads of the coins spent by block that are neither in the coins cache nor created by the block itself. */
+static void PrefetchBlockInputs(const CBlock& block, bool fUrgent)
+{
+    AssertLockHeld(cs_main);
+    std::set<uint256> setCreated;
+    std::set<uint256> setSpent;
+    std::vector<uint256> vTxids;
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+                const uint256& txid = txin.prevout.hash;
+                if (!setCreated.count(txid) && setSpent.insert(txid).second && !pcoinsTip->HaveCoinsInCache(txid))
+                    vTxids.push_back(txid);
+            }
+        }
+        setCreated.insert(tx.GetHash());
+    }
+    coinsprefetcher.Enqueue(block.GetHash(), vTxids, fUrgent);
+}
+
+bool CHeaderPoWCheck::operator()()
+{
+    std::vector<uint256> vHashes(vHeaders.size());
+    GetPoWHashes(&vHeaders[0], vHeaders.size(), &vHashes[0]);
+    for (unsigned int i = 0; i < vHeaders.size(); ++i) {
+        if (!CheckProofOfWork(vHashes[i], vHeaders[i].nBits, *pConsensusParams))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Check the proof of work of all headers in a headers message that are not in the block index yet,
+ * in parallel and without holding cs_main. Returns false if any header fails, the caller should then
+ * check the headers one by one so that the offending header is found and reported.
+ */
+static bool CheckHeadersProofOfWork(const std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams)
+{
+    std::vector<CBlockHeader> vUnknown;
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH (const CBlockHeader& header, headers) {
+            if (mapBlockIndex.find(header.GetHash()) == mapBlockIndex.end())
+                vUnknown.push_back(header);
+        }
+    }
+    if (vUnknown.empty())
+        return true;
+
+    const unsigned int nGroupSize = scrypt_multilane_width();
+    std::vector<CHeaderPoWCheck> vChecks;
+    vChecks.reserve((vUnknown.size() + nGroupSize - 1) / nGroupSize);
+    for (unsigned int i = 0; i < vUnknown.size(); i += nGroupSize) {
+        unsigned int nEnd = std::min((unsigned int)vUnknown.size(), i + nGroupSize);
+        vChecks.push_back(CHeaderPoWCheck(vUnknown.begin() + i, vUnknown.begin() + nEnd, consensusParams));
+    }
+
+    CCheckQueueControl<CHeaderPoWCheck> control(&headerpowcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 VersionBitsCache versionbitscache;
 
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
@@ -2001,7 +2160,7 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, CBlockUndo* pblockundo, std::vector<int>* pvPrevHeights)
 {
     AssertLockHeld(cs_main);
 
@@ -2103,6 +2262,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             for (size_t j = 0; j < tx.vin.size(); j++) {
                 prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
             }
+            if (pvPrevHeights)
+                pvPrevHeights->insert(pvPrevHeights->end(), prevheights.begin(), prevheights.end());
 
             for (size_t j = 0; j < tx.vin.size(); j++) {
                 auto itByPrev = mapOrphanTransactionsByPrev.find(tx.vin[j].prevout);
@@ -2189,6 +2350,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     view.SetBestBlock(pindex->GetBlockHash());
 
+    if (pblockundo)
+        pblockundo->vtxundo.swap(blockundo.vtxundo);
+
     int64_t nTime5 = GetTimeMicros();
     nTimeIndex += nTime5 - nTime4;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime5 - nTime4), nTimeIndex * 0.000001);
@@ -2306,6 +2470,8 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            // Coins read ahead from the database before this write may be stale now.
+            coinsprefetcher.Invalidate();
             nLastFlush = nNow;
         }
         if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2333,10 +2499,60 @@ void PruneAndFlush()
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+const CBlockIndex* CChainTipSnapshot::operator[](int nHeightIn) const
+{
+    if (nHeightIn < 0 || nHeightIn > nHeight)
+        return NULL;
+    return pindexTip->GetAncestor(nHeightIn);
+}
+
+bool CChainTipSnapshot::Contains(const CBlockIndex* pindex) const
+{
+    return pindex && (*this)[pindex->nHeight] == pindex;
+}
+
+const CBlockIndex* CChainTipSnapshot::Next(const CBlockIndex* pindex) const
+{
+    if (Contains(pindex))
+        return (*this)[pindex->nHeight + 1];
+    return NULL;
+}
+
+boost::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot()
+{
+    return boost::atomic_load(&pchainTipSnapshot);
+}
+
+CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    LOCK(cs_main);
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    return it == mapBlockIndex.end() ? NULL : it->second;
+}
+
+/** Publish chainActive and pindexBestHeader as a new CChainTipSnapshot. */
+static void PublishChainTipSnapshot()
+{
+    AssertLockHeld(cs_main);
+    boost::shared_ptr<CChainTipSnapshot> snapshot(new CChainTipSnapshot());
+    CBlockIndex* pindexTip = chainActive.Tip();
+    snapshot->pindexTip = pindexTip;
+    snapshot->pindexBestHeader = pindexBestHeader;
+    if (pindexTip) {
+        snapshot->nHeight = pindexTip->nHeight;
+        snapshot->hashBlock = pindexTip->GetBlockHash();
+        snapshot->nChainWork = pindexTip->nChainWork;
+        snapshot->nMedianTimePast = pindexTip->GetMedianTimePast(pindexTip->nHeight);
+        snapshot->dVerificationProgress = Checkpoints::GuessVerificationProgress(Params().Checkpoints(), pindexTip);
+    }
+    boost::atomic_store(&pchainTipSnapshot, boost::shared_ptr<const CChainTipSnapshot>(snapshot));
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex* pindexNew, const CChainParams& chainParams)
 {
     chainActive.SetTip(pindexNew);
+    PublishChainTipSnapshot();
 
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
@@ -2404,8 +2620,12 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CBlockUndo blockundo;
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, pscriptindex ? &blockundo : NULL))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        // Only the active chain goes into the index, not the scratch views of VerifyDB.
+        if (pscriptindex && !pscriptindex->DisconnectBlock(block, pindexDelete, blockundo))
+            return AbortNode(state, "Failed to write script index");
         assert(view.Flush());
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
@@ -2440,6 +2660,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
@@ -2464,15 +2685,28 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+
+    // Whatever was not read ahead since the block arrived is read now, in parallel rather than one input at a time.
+    PrefetchBlockInputs(*pblock, true);
+    coinsprefetcher.Wait(pblock->GetHash());
+    size_t nPrefetched = coinsprefetcher.Apply(*pcoinsTip);
+    int64_t nTime2b = GetTimeMicros();
+    nTimePrefetch += nTime2b - nTime2;
+    LogPrint("bench", "  - Prefetch %u coins: %.2fms [%.2fs]\n", (unsigned int)nPrefetched, (nTime2b - nTime2) * 0.001, nTimePrefetch * 0.000001);
+    nTime2 = nTime2b;
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
+        CBlockUndo blockundo;
+        std::vector<int> vPrevHeights;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, false, pscriptindex ? &blockundo : NULL, pscriptindex ? &vPrevHeights : NULL);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
                 InvalidBlockFound(pindexNew, state);
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
+        if (pscriptindex && !pscriptindex->ConnectBlock(*pblock, pindexNew, blockundo, vPrevHeights))
+            return AbortNode(state, "Failed to write script index");
         mapBlockSource.erase(pindexNew->GetBlockHash());
         nTime3 = GetTimeMicros();
         nTimeConnectTotal += nTime3 - nTime2;
@@ -2829,8 +3063,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     if (it != mapBlockIndex.end())
         return it->second;
 
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = arenaBlockIndex.Allocate();
+    *pindexNew = CBlockIndex(block);
 
     pindexNew->nSequenceId = 0;
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
@@ -2843,8 +3077,10 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
-    if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
+    if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork) {
         pindexBestHeader = pindexNew;
+        PublishChainTipSnapshot();
+    }
 
     setDirtyBlockIndex.insert(pindexNew);
 
@@ -3205,7 +3441,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex = NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex = NULL, bool fCheckPOW = true)
 {
     AssertLockHeld(cs_main);
 
@@ -3224,7 +3460,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         CBlockIndex* pindexPrev = NULL;
@@ -3309,6 +3545,10 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
         return AbortNode(state, std::string("System error: ") + e.what());
     }
 
+    // Start reading the coins it spends while the blocks before it are still being connected.
+    if (fHasMoreWork)
+        PrefetchBlockInputs(block, false);
+
     if (fCheckForPruning)
         FlushStateToDisk(state, FLUSH_STATE_NONE); // we just allocated more disk space for block files
 
@@ -3544,33 +3784,244 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error(std::string(__func__) + ": new CBlockIndex failed");
+    CBlockIndex* pindexNew = arenaBlockIndex.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+/**
+ * One entry of the block index snapshot. All fields have a fixed size, and pprev/pskip
+ * are stored as the position of the referenced entry in the file, which is always an
+ * earlier one because entries are written in order of height.
+ */
+struct CBlockIndexSnapshotEntry {
+    uint256 hash;
+    int32_t nPrev;
+    int32_t nSkip;
+    int32_t nHeight;
+    int32_t nFile;
+    uint32_t nDataPos;
+    uint32_t nUndoPos;
+    uint256 nChainWork;
+    uint32_t nTx;
+    uint32_t nStatus;
+    int32_t nVersion;
+    uint256 hashMerkleRoot;
+    uint32_t nTime;
+    uint32_t nBits;
+    uint32_t nNonce;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionSer)
+    {
+        READWRITE(hash);
+        READWRITE(nPrev);
+        READWRITE(nSkip);
+        READWRITE(nHeight);
+        READWRITE(nFile);
+        READWRITE(nDataPos);
+        READWRITE(nUndoPos);
+        READWRITE(nChainWork);
+        READWRITE(nTx);
+        READWRITE(nStatus);
+        READWRITE(nVersion);
+        READWRITE(hashMerkleRoot);
+        READWRITE(nTime);
+        READWRITE(nBits);
+        READWRITE(nNonce);
+    }
+};
+
+/** Whether mapBlockIndex was loaded in full this run, so that it may be written out as a snapshot. */
+static bool fBlockIndexLoaded = false;
+
+boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+
+    // The snapshot has to describe exactly what is in the block tree database.
+    if (!fBlockIndexLoaded || pblocktree == NULL || pcoinsTip == NULL || !setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty())
+        return false;
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<CBlockIndex*> vIndex;
+    vIndex.reserve(mapBlockIndex.size());
+    BOOST_FOREACH (const BlockMap::value_type& item, mapBlockIndex) {
+        if (item.second)
+            vIndex.push_back(item.second);
+    }
+    std::stable_sort(vIndex.begin(), vIndex.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+    boost::unordered_map<const CBlockIndex*, int32_t> mapPosition;
+    mapPosition.reserve(vIndex.size());
+    for (size_t i = 0; i < vIndex.size(); i++)
+        mapPosition[vIndex[i]] = i;
+
+    boost::filesystem::path pathTmp = GetBlockIndexSnapshotPath();
+    pathTmp += ".new";
+    try {
+        FILE* filestr = fopen(pathTmp.string().c_str(), "wb");
+        if (!filestr)
+            return false;
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        uint32_t nVersion = BLOCKINDEX_SNAPSHOT_VERSION;
+        int nLastFile = nLastBlockFile;
+        uint256 hashBestCoins = pcoinsTip->GetBestBlock();
+        uint64_t nCount = vIndex.size();
+        file << nVersion << FLATDATA(Params().MessageStart()) << hashBestCoins << nLastFile << nCount;
+        hasher << nVersion << FLATDATA(Params().MessageStart()) << hashBestCoins << nLastFile << nCount;
+        BOOST_FOREACH (const CBlockIndex* pindex, vIndex) {
+            CBlockIndexSnapshotEntry entry;
+            entry.hash = pindex->GetBlockHash();
+            entry.nPrev = pindex->pprev ? mapPosition[pindex->pprev] : -1;
+            entry.nSkip = pindex->pskip ? mapPosition[pindex->pskip] : -1;
+            entry.nHeight = pindex->nHeight;
+            entry.nFile = pindex->nFile;
+            entry.nDataPos = pindex->nDataPos;
+            entry.nUndoPos = pindex->nUndoPos;
+            entry.nChainWork = ArithToUint256(pindex->nChainWork);
+            entry.nTx = pindex->nTx;
+            entry.nStatus = pindex->nStatus;
+            entry.nVersion = pindex->nVersion;
+            entry.hashMerkleRoot = pindex->hashMerkleRoot;
+            entry.nTime = pindex->nTime;
+            entry.nBits = pindex->nBits;
+            entry.nNonce = pindex->nNonce;
+            file << entry;
+            hasher << entry;
+        }
+        file << hasher.GetHash();
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, GetBlockIndexSnapshotPath()))
+            return false;
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to write block index snapshot: %s\n", e.what());
+        return false;
+    }
+    LogPrintf("Wrote block index snapshot with %u entries (%dms)\n", vIndex.size(), (GetTimeMicros() - nStart) / 1000);
+    return true;
+}
+
+/**
+ * Load mapBlockIndex from the snapshot written at the last clean shutdown, in one pass
+ * and without hashing the headers or recomputing chain work and skip pointers. Returns
+ * the entries in order of height; on any mismatch nothing is loaded.
+ */
+bool ReadBlockIndexSnapshot(std::vector<CBlockIndex*>& vSortedByHeight)
+{
+    FILE* filestr = fopen(GetBlockIndexSnapshotPath().string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull() || !mapBlockIndex.empty())
+        return false;
+
+    int64_t nStart = GetTimeMicros();
+    try {
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        uint32_t nVersion;
+        CMessageHeader::MessageStartChars messageStart;
+        uint256 hashBestCoins;
+        int nLastFile;
+        uint64_t nCount;
+        file >> nVersion >> FLATDATA(messageStart) >> hashBestCoins >> nLastFile >> nCount;
+        hasher << nVersion << FLATDATA(messageStart) << hashBestCoins << nLastFile << nCount;
+
+        int nLastFileDB = 0;
+        pblocktree->ReadLastBlockFile(nLastFileDB);
+        if (nVersion != BLOCKINDEX_SNAPSHOT_VERSION || memcmp(messageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0 ||
+            hashBestCoins != pcoinsTip->GetBestBlock() || nLastFile != nLastFileDB || nCount > (uint64_t)std::numeric_limits<int32_t>::max())
+            throw std::runtime_error("snapshot does not match the block tree database");
+
+        vSortedByHeight.reserve(nCount);
+        arenaBlockIndex.Reserve(nCount);
+        mapBlockIndex.reserve(nCount);
+        for (uint64_t i = 0; i < nCount; i++) {
+            if (i % 65536 == 0)
+                boost::this_thread::interruption_point();
+            CBlockIndexSnapshotEntry entry;
+            file >> entry;
+            hasher << entry;
+            if (entry.nPrev >= (int64_t)i || entry.nSkip >= (int64_t)i || entry.nPrev < -1 || entry.nSkip < -1)
+                throw std::runtime_error("invalid entry");
+
+            CBlockIndex* pindex = arenaBlockIndex.Allocate();
+            std::pair<BlockMap::iterator, bool> ins = mapBlockIndex.insert(std::make_pair(entry.hash, pindex));
+            if (!ins.second)
+                throw std::runtime_error("duplicate entry");
+            pindex->phashBlock = &ins.first->first;
+            pindex->pprev = entry.nPrev < 0 ? NULL : vSortedByHeight[entry.nPrev];
+            pindex->pskip = entry.nSkip < 0 ? NULL : vSortedByHeight[entry.nSkip];
+            pindex->nHeight = entry.nHeight;
+            pindex->nFile = entry.nFile;
+            pindex->nDataPos = entry.nDataPos;
+            pindex->nUndoPos = entry.nUndoPos;
+            pindex->nChainWork = UintToArith256(entry.nChainWork);
+            pindex->nTx = entry.nTx;
+            pindex->nStatus = entry.nStatus;
+            pindex->nVersion = entry.nVersion;
+            pindex->hashMerkleRoot = entry.hashMerkleRoot;
+            pindex->nTime = entry.nTime;
+            pindex->nBits = entry.nBits;
+            pindex->nNonce = entry.nNonce;
+            vSortedByHeight.push_back(pindex);
+        }
+
+        uint256 hashChecksum;
+        file >> hashChecksum;
+        if (hashChecksum != hasher.GetHash())
+            throw std::runtime_error("checksum mismatch");
+    } catch (const std::exception& e) {
+        LogPrintf("Not using block index snapshot: %s\n", e.what());
+        vSortedByHeight.clear();
+        mapBlockIndex.clear();
+        arenaBlockIndex.Clear();
+        return false;
+    }
+
+    LogPrintf("Loaded %u block index entries from snapshot (%dms)\n", vSortedByHeight.size(), (GetTimeMicros() - nStart) / 1000);
+    return true;
+}
+
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
-        return false;
 
-    boost::this_thread::interruption_point();
+    // Entries from the snapshot come sorted, with chain work and skip pointers already set.
+    std::vector<CBlockIndex*> vSortedByHeight;
+    bool fFromSnapshot = GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT) && ReadBlockIndexSnapshot(vSortedByHeight);
+    if (!fFromSnapshot) {
+        if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+            return false;
 
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    BOOST_FOREACH (const PAIRTYPE(uint256, CBlockIndex*)&item, mapBlockIndex) {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        boost::this_thread::interruption_point();
+
+        vector<pair<int, CBlockIndex*> > vHeightIndex;
+        vHeightIndex.reserve(mapBlockIndex.size());
+        BOOST_FOREACH (const PAIRTYPE(uint256, CBlockIndex*)&item, mapBlockIndex) {
+            CBlockIndex* pindex = item.second;
+            vHeightIndex.push_back(make_pair(pindex->nHeight, pindex));
+        }
+        sort(vHeightIndex.begin(), vHeightIndex.end());
+        vSortedByHeight.reserve(vHeightIndex.size());
+        BOOST_FOREACH (const PAIRTYPE(int, CBlockIndex*)&item, vHeightIndex)
+            vSortedByHeight.push_back(item.second);
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH (const PAIRTYPE(int, CBlockIndex*)&item, vSortedByHeight) {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+
+    boost::this_thread::interruption_point();
+
+    BOOST_FOREACH (CBlockIndex* pindex, vSortedByHeight) {
+        if (!fFromSnapshot)
+            pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
 
         if (pindex->nTx > 0) {
             if (pindex->pprev) {
@@ -3588,7 +4039,7 @@ bool static LoadBlockIndexDB()
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
-        if (pindex->pprev)
+        if (pindex->pprev && !fFromSnapshot)
             pindex->BuildSkip();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
@@ -3640,6 +4091,7 @@ bool static LoadBlockIndexDB()
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    PublishChainTipSnapshot();
 
     PruneBlockIndexCandidates();
 
@@ -3836,6 +4288,7 @@ void UnloadBlockIndex()
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    PublishChainTipSnapshot();
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
@@ -3856,19 +4309,24 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH (BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    arenaBlockIndex.Clear();
+    fBlockIndexLoaded = false;
     fHavePruned = false;
 }
 
 bool LoadBlockIndex()
 {
 
-    if (!fReindex && !LoadBlockIndexDB())
-        return false;
-    return true;
+    bool fRet = fReindex || LoadBlockIndexDB();
+
+    // A snapshot only matches the database at the shutdown it was written at, never use it twice. If loading
+    // failed part way, the index in memory is incomplete and is not written out at shutdown either.
+    boost::system::error_code ec;
+    boost::filesystem::remove(GetBlockIndexSnapshotPath(), ec);
+    fBlockIndexLoaded = fRet;
+
+    return fRet;
 }
 
 bool InitBlockIndex(const CChainParams& chainparams)
@@ -3913,7 +4371,9 @@ bool InitBlockIndex(const CChainParams& chainparams)
                     return error("LoadBlockIndex() : failed to reset sync-checkpoint");
             }
 
-            return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+            // The index of a new block database is complete once the genesis block is in it.
+            fBlockIndexLoaded = FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+            return fBlockIndexLoaded;
         }
         catch (const std::runtime_error& e) {
             return error("LoadBlockIndex(): failed to initialize block database: %s", e.what());
@@ -4307,8 +4767,8 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
+    // cs_main is only held to decide what to send; reading blocks from disk and
+    // serialising them to the peer happens without it.
     while (it != pfrom->vRecvGetData.end()) {
 
         if (pfrom->nSendSize >= SendBufferSize())
@@ -4320,38 +4780,70 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             it++;
 
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK) {
-                bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end()) {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) && (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                bool fHaveBlock = false;
+                CDiskBlockPos blockPos;
+                bool fWitnessBlock = false;
+                bool fSendCmpct = false;
+                uint256 hashContinueTip;
+                {
+                    LOCK(cs_main);
+                    bool send = false;
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end()) {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            static const int nOneMonth = 30 * 24 * 60 * 60;
+
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) && (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
+                            if (!send) {
+                                LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                            }
                         }
                     }
-                }
 
-                static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
-                if (send && CNode::OutboundTargetReached(true) && (((pindexBestHeader != NULL) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted) {
-                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+                    static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
+                    if (send && CNode::OutboundTargetReached(true) && (((pindexBestHeader != NULL) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted) {
+                        LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
 
-                    pfrom->fDisconnect = true;
-                    send = false;
+                        pfrom->fDisconnect = true;
+                        send = false;
+                    }
+
+                    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                        fHaveBlock = true;
+                        blockPos = mi->second->GetBlockPos();
+                        fWitnessBlock = IsWitnessEnabled(mi->second->pprev, consensusParams);
+                        fSendCmpct = mi->second->nHeight >= chainActive.Height() - 10;
+                        if (inv.hash == pfrom->hashContinue)
+                            hashContinueTip = chainActive.Tip()->GetBlockHash();
+                    }
                 }
 
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                if (fHaveBlock) {
 
+                    // The stored bytes are the witness serialisation, which is also what a plain block
+                    // request gets for blocks from before segwit. Those are sent as read, without decoding.
+                    bool fRaw = inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_BLOCK && !fWitnessBlock);
+                    std::vector<unsigned char> vRawBlock;
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    bool fRead = false;
+                    if (fRaw)
+                        fRead = ReadRawBlockFromDisk(vRawBlock, blockPos, inv.hash, Params().MessageStart());
+                    else
+                        fRead = ReadBlockFromDisk(block, blockPos, consensusParams, fCheckBlockReadPoW) && block.GetHash() == inv.hash;
+                    if (!fRead) {
+                        // Only pruning can take the block away after the check above.
+                        if (!fPruneMode)
+                            assert(!"cannot load block from disk");
+                        LogPrint("net", "%s: block %s was pruned before it could be sent to peer=%d\n", __func__, inv.hash.ToString(), pfrom->GetId());
+                        vNotFound.push_back(inv);
+                        break;
+                    }
+                    if (fRaw)
+                        pfrom->PushMessage(NetMsgType::BLOCK, CFlatData(vRawBlock));
+                    else if (inv.type == MSG_BLOCK)
                         pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        pfrom->PushMessage(NetMsgType::BLOCK, block);
                     else if (inv.type == MSG_FILTERED_BLOCK) {
                         bool send = false;
                         CMerkleBlock merkleBlock;
@@ -4372,17 +4864,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
                     } else if (inv.type == MSG_CMPCT_BLOCK) {
 
-                        if (mi->second->nHeight >= chainActive.Height() - 10) {
+                        if (fSendCmpct) {
                             CBlockHeaderAndShortTxIDs cmpctblock(block);
                             pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
                         } else
                             pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
                     }
 
-                    if (inv.hash == pfrom->hashContinue) {
+                    if (!hashContinueTip.IsNull()) {
 
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        vInv.push_back(CInv(MSG_BLOCK, hashContinueTip));
                         pfrom->PushMessage(NetMsgType::INV, vInv);
                         pfrom->hashContinue.SetNull();
                     }
@@ -4390,11 +4882,15 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             } else if (inv.type == MSG_TX || inv.type == MSG_WITNESS_TX) {
 
                 bool push = false;
-                auto mi = mapRelay.find(inv.hash);
-                if (mi != mapRelay.end()) {
-                    pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
-                    push = true;
-                } else if (pfrom->timeLastMempoolReq) {
+                {
+                    LOCK(cs_main);
+                    auto mi = mapRelay.find(inv.hash);
+                    if (mi != mapRelay.end()) {
+                        pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
+                        push = true;
+                    }
+                }
+                if (!push && pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
 
                     if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
@@ -4431,6 +4927,39 @@ uint32_t GetFetchFlags(CNode* pfrom, CBlockIndex* pprev, const Consensus::Params
     return nFetchFlags;
 }
 
+/**
+ * Check a BIP157 request for the filters of the blocks from nStartHeight up to
+ * hashStop, which must be in the active chain and at most nMaxCount blocks
+ * apart. Peers asking for something we do not serve are disconnected.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, uint32_t nStartHeight, const uint256& hashStop, uint32_t nMaxCount, const CBlockIndex*& pindexStop)
+{
+    if (!(nLocalServices & NODE_COMPACT_FILTERS) || !pblockfilterindex || nFilterType != pblockfilterindex->GetFilterType()) {
+        LogPrint("net", "peer %d requested unsupported block filter type %d\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::iterator it = mapBlockIndex.find(hashStop);
+        if (it == mapBlockIndex.end() || !chainActive.Contains(it->second)) {
+            LogPrint("net", "peer %d requested block filters up to unknown block %s\n", pfrom->id, hashStop.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        pindexStop = it->second;
+    }
+
+    uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight || nStopHeight - nStartHeight >= nMaxCount) {
+        LogPrint("net", "peer %d requested block filters for invalid range %d to %d\n", pfrom->id, nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    return true;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -4816,23 +5345,30 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         BlockTransactionsRequest req;
         vRecv >> req;
 
-        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
-        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
-            LogPrintf("Peer %d sent us a getblocktxn for a block we don't have", pfrom->id);
-            return true;
-        }
+        CBlockIndex* pindex = NULL;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+            if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrintf("Peer %d sent us a getblocktxn for a block we don't have", pfrom->id);
+                return true;
+            }
 
-        if (it->second->nHeight < chainActive.Height() - 15) {
-            LogPrint("net", "Peer %d sent us a getblocktxn for a block > 15 deep", pfrom->id);
-            return true;
+            if (it->second->nHeight < chainActive.Height() - 15) {
+                LogPrint("net", "Peer %d sent us a getblocktxn for a block > 15 deep", pfrom->id);
+                return true;
+            }
+            pindex = it->second;
         }
 
+        // Blocks this recent are never pruned, so the read can happen without cs_main.
         CBlock block;
-        assert(ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()));
+        assert(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
 
         BlockTransactions resp(req);
         for (size_t i = 0; i < req.indexes.size(); i++) {
             if (req.indexes[i] >= block.vtx.size()) {
+                LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), 100);
                 LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
                 return true;
@@ -4842,6 +5378,64 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCKTXN, resp);
     }
 
+    else if (strCommand == NetMsgType::GETCFILTERS) {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        const CBlockIndex* pindexStop;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFILTERS_SIZE, pindexStop))
+            return true;
+
+        std::vector<BlockFilter> vFilters;
+        if (!pblockfilterindex->LookupFilterRange(nStartHeight, pindexStop, vFilters)) {
+            LogPrint("net", "Block filters from height %d to %s are not indexed yet, peer=%d\n", nStartHeight, hashStop.ToString(), pfrom->id);
+            return true;
+        }
+        BOOST_FOREACH (const BlockFilter& filter, vFilters)
+            pfrom->PushMessage(NetMsgType::CFILTER, filter);
+    }
+
+    else if (strCommand == NetMsgType::GETCFHEADERS) {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        const CBlockIndex* pindexStop;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFHEADERS_SIZE, pindexStop))
+            return true;
+
+        uint256 hashPrevHeader;
+        std::vector<uint256> vFilterHashes;
+        if ((nStartHeight > 0 && !pblockfilterindex->LookupFilterHeader(pindexStop->GetAncestor(nStartHeight - 1), hashPrevHeader)) ||
+            !pblockfilterindex->LookupFilterHashRange(nStartHeight, pindexStop, vFilterHashes)) {
+            LogPrint("net", "Block filter headers from height %d to %s are not indexed yet, peer=%d\n", nStartHeight, hashStop.ToString(), pfrom->id);
+            return true;
+        }
+        pfrom->PushMessage(NetMsgType::CFHEADERS, nFilterType, hashStop, hashPrevHeader, vFilterHashes);
+    }
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT) {
+        uint8_t nFilterType;
+        uint256 hashStop;
+        vRecv >> nFilterType >> hashStop;
+
+        const CBlockIndex* pindexStop;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, 0, hashStop, std::numeric_limits<uint32_t>::max(), pindexStop))
+            return true;
+
+        std::vector<uint256> vHeaders(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+        for (size_t i = 0; i < vHeaders.size(); i++) {
+            if (!pblockfilterindex->LookupFilterHeader(pindexStop->GetAncestor((i + 1) * CFCHECKPT_INTERVAL), vHeaders[i])) {
+                LogPrint("net", "Block filter headers up to %s are not indexed yet, peer=%d\n", hashStop.ToString(), pfrom->id);
+                return true;
+            }
+        }
+        pfrom->PushMessage(NetMsgType::CFCHECKPT, nFilterType, hashStop, vHeaders);
+    }
+
     else if (strCommand == NetMsgType::GETHEADERS) {
         CBlockLocator locator;
         uint256 hashStop;
@@ -5027,6 +5621,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CBlockHeaderAndShortTxIDs cmpctblock;
         vRecv >> cmpctblock;
 
+        // Match the short ids against the mempool before taking cs_main; this is the expensive
+        // part of reconstruction and only needs the mempool lock.
+        PartiallyDownloadedBlock tempBlock(&mempool);
+        ReadStatus tempStatus = tempBlock.InitData(cmpctblock);
+
         LOCK(cs_main);
 
         if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
@@ -5087,7 +5686,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 }
 
                 PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
-                ReadStatus status = partialBlock.InitData(cmpctblock);
+                partialBlock = tempBlock;
+                ReadStatus status = tempStatus;
                 if (status == READ_STATUS_INVALID) {
                     MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
                     Misbehaving(pfrom->GetId(), 100);
@@ -5143,18 +5743,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         BlockTransactions resp;
         vRecv >> resp;
 
-        LOCK(cs_main);
+        // Take a copy of the partial block so that filling it in and checking the
+        // result (merkle root, proof of work) happens without cs_main.
+        PartiallyDownloadedBlock partialBlock(&mempool);
+        {
+            LOCK(cs_main);
 
-        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
-        if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock || it->second.first != pfrom->GetId()) {
-            LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
-            return true;
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+            if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock || it->second.first != pfrom->GetId()) {
+                LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            partialBlock = *it->second.second->partialBlock;
         }
 
-        PartiallyDownloadedBlock& partialBlock = *it->second.second->partialBlock;
         CBlock block;
         ReadStatus status = partialBlock.FillBlock(block, resp.txn);
         if (status == READ_STATUS_INVALID) {
+            LOCK(cs_main);
             MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
             Misbehaving(pfrom->GetId(), 100);
             LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
@@ -5196,6 +5803,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // If the whole batch passes, skip the serial PoW check in AcceptBlockHeader below.
+        bool fPoWChecked = CheckHeadersProofOfWork(headers, chainparams.GetConsensus());
+
         {
             LOCK(cs_main);
 
@@ -5230,7 +5840,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     Misbehaving(pfrom->GetId(), 20);
                     return error("non-continuous headers sequence");
                 }
-                if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+                if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, !fPoWChecked)) {
                     int nDoS;
                     if (state.IsInvalid(nDoS)) {
                         if (nDoS > 0)
@@ -6086,16 +6696,200 @@ ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::D
     return VersionBitsState(chainActive.Tip(), params, pos, versionbitscache);
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+/**
+ * Check the scripts of a batch of transactions read from mempool.dat on the script check threads.
+ * The signatures that verify are collected per transaction in vCacheEntries rather than cached, and
+ * LoadMempool only keeps them in the signature cache for transactions AcceptToMemoryPool takes. A
+ * failing script does not stop the checks of the other transactions. Transactions spending outputs that are
+ * neither in the chain nor in the mempool yet (usually parents from the same batch) are left to
+ * AcceptToMemoryPool.
+ */
+static void PrecheckMempoolBatch(const std::vector<CTransaction>& vtx, std::vector<std::vector<uint256> >& vCacheEntries)
+{
+    AssertLockHeld(cs_main);
+    vCacheEntries.assign(vtx.size(), std::vector<uint256>());
+    if (nScriptCheckThreads == 0)
+        return;
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    size_t nInputs = 0;
+    {
+        LOCK(mempool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        view.SetBackend(viewMemPool);
+        BOOST_FOREACH (const CTransaction& tx, vtx) {
+            BOOST_FOREACH (const CTxIn& txin, tx.vin)
+                view.AccessCoins(txin.prevout.hash);
+            nInputs += tx.vin.size();
+        }
+        view.SetBackend(dummy);
+    }
+
+    // Inputs of one transaction may be checked on different threads, so each input collects its own entries.
+    std::vector<std::vector<uint256> > vInputEntries(nInputs);
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        size_t nInput = 0;
+        BOOST_FOREACH (const CTransaction& tx, vtx) {
+            txdata.emplace_back(tx);
+            std::vector<CScriptCheck> vChecks;
+            for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                const COutPoint& prevout = tx.vin[i].prevout;
+                const CCoins* coins = view.AccessCoins(prevout.hash);
+                if (!coins || !coins->IsAvailable(prevout.n)) {
+                    vChecks.clear();
+                    break;
+                }
+                vChecks.push_back(CScriptCheck(*coins, tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, false, &txdata.back(), &vInputEntries[nInput + i]));
+            }
+            nInput += tx.vin.size();
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+
+    size_t nInput = 0;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        for (size_t j = 0; j < vtx[i].vin.size(); j++, nInput++)
+            vCacheEntries[i].insert(vCacheEntries[i].end(), vInputEntries[nInput].begin(), vInputEntries[nInput].end());
+    }
+}
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    int64_t nNow = GetTime();
+    int64_t nCount = 0;
+    int64_t nSkipped = 0;
+    int64_t nFailed = 0;
+    int64_t nExpired = 0;
+
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("Unknown mempool file version %d. Continuing anyway.\n", nVersion);
+            return false;
+        }
+
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t nRemaining;
+        file >> nRemaining;
+        while (nRemaining > 0) {
+            std::vector<CTransaction> vtx;
+            std::vector<int64_t> vTime;
+            while (nRemaining > 0 && vtx.size() < MEMPOOL_LOAD_BATCH_SIZE) {
+                CTransaction tx;
+                int64_t nTime;
+                file >> tx;
+                file >> nTime;
+                --nRemaining;
+                if (nTime + nExpiryTimeout <= nNow) {
+                    ++nExpired;
+                    continue;
+                }
+                vtx.push_back(tx);
+                vTime.push_back(nTime);
+            }
+
+            LOCK(cs_main);
+            std::vector<std::vector<uint256> > vCacheEntries;
+            PrecheckMempoolBatch(vtx, vCacheEntries);
+            for (unsigned int i = 0; i < vtx.size(); i++) {
+                if (mempool.exists(vtx[i].GetHash())) {
+                    ++nSkipped;
+                    continue;
+                }
+                // The signatures checked above save AcceptToMemoryPool from verifying them again, and are evicted
+                // first if the transaction is rejected. Nothing else verifies scripts while cs_main is held.
+                AddSignatureCacheEntries(vCacheEntries[i]);
+                CValidationState state;
+                if (AcceptToMemoryPoolWithTime(mempool, state, vtx[i], true, NULL, vTime[i])) {
+                    ++nCount;
+                } else {
+                    EraseSignatureCacheEntries(vCacheEntries[i]);
+                    ++nFailed;
+                }
+            }
+
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired, %i already present (%dms)\n", nCount, nFailed, nExpired, nSkipped, (GetTimeMicros() - nStart) / 1000);
+    return true;
+}
+
+bool DumpMempool()
+{
+    static CCriticalSection cs_dumpMempool;
+    LOCK(cs_dumpMempool);
+
+    int64_t nStart = GetTimeMicros();
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<TxMempoolInfo> vInfo;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vInfo = mempool.infoAll();
+    }
+    int64_t nCopied = GetTimeMicros();
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr)
+            return false;
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        uint64_t nVersion = MEMPOOL_DUMP_VERSION;
+        file << nVersion;
+        file << mapDeltas;
+        file << (uint64_t)vInfo.size();
+        BOOST_FOREACH (const TxMempoolInfo& info, vInfo) {
+            file << *(info.tx);
+            file << info.nTime;
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat"))
+            return false;
+        LogPrint("mempool", "Dumped mempool: %gs to copy, %gs to dump\n", (nCopied - nStart) * 0.000001, (GetTimeMicros() - nCopied) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
 class CMainCleanup {
 public:
     CMainCleanup() {}
     ~CMainCleanup()
     {
 
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        arenaBlockIndex.Clear();
 
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
@@ -34,10 +34,12 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
 class CInv;
@@ -47,6 +49,7 @@ class CValidationInterface;
 class CValidationState;
 
 struct PrecomputedTransactionData;
+struct CCoinsPrefetchStats;
 struct CNodeStateStats;
 struct LockPoints;
 
@@ -80,6 +83,12 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool, save the mempool on shutdown and load it on startup */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -mempooldumpinterval, time in seconds between snapshots of the mempool (0 = only on shutdown) */
+static const int64_t DEFAULT_MEMPOOL_DUMP_INTERVAL = 15 * 60;
+/** Number of transactions from mempool.dat that have their scripts checked together while loading */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 256;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -94,6 +103,12 @@ static const int64_t DUST_HARD_LIMIT = 1000; // 0.00001 NLG mininput
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of coin prefetching threads allowed */
+static const int MAX_PREFETCH_THREADS = 64;
+/** -prefetchthreads default (number of threads reading the coins spent by incoming blocks, 0 = off) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Memory for coins read ahead of the blocks that spend them, in bytes */
+static const size_t MAX_PREFETCH_BUFFER = 32 << 20;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -138,7 +153,13 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -checkblockreadpow, re-verify the proof of work of blocks that are read back from disk */
+static const bool DEFAULT_CHECKBLOCKREADPOW = false;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -blockindexsnapshot, write the block index to a flat file at shutdown for a faster startup */
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = true;
+/** Version of the block index snapshot format */
+static const uint32_t BLOCKINDEX_SNAPSHOT_VERSION = 1;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
@@ -178,6 +199,7 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+extern bool fCheckBlockReadPoW;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -255,6 +277,12 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof of work checking thread */
+void ThreadHeaderPoWCheck();
+/** Run an instance of the coin prefetching thread, reading from the coin database base */
+void ThreadCoinsPrefetch(CCoinsView* base);
+/** Counters of the coin prefetching threads */
+CCoinsPrefetchStats GetCoinsPrefetchStats();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -308,6 +336,25 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit = false, const CAmount nAbsurdFee = 0);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit = false, const CAmount nAbsurdFee = 0);
+
+/** Dump the mempool to disk. */
+bool DumpMempool();
+
+/** Load the mempool from disk. */
+bool LoadMempool();
+
+/** Location of the block index snapshot, blocks/index.snapshot. */
+boost::filesystem::path GetBlockIndexSnapshotPath();
+
+/** Write the block index to blocks/index.snapshot; only valid right after the final flush at shutdown, and refused unless the index loaded in full. */
+bool WriteBlockIndexSnapshot();
+
+/** Fill an empty mapBlockIndex from the snapshot, returning the entries in order of height. Nothing is loaded if it does not match the block tree database. */
+bool ReadBlockIndexSnapshot(std::vector<CBlockIndex*>& vSortedByHeight);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState& state);
 
@@ -413,6 +460,8 @@ private:
     bool cacheStore;
     ScriptError error;
     PrecomputedTransactionData* txdata;
+    //! Collects the signature cache entries of a check that only prepares for a later one; such a check never fails
+    std::vector<uint256>* pvCacheEntries;
 
 public:
     CScriptCheck()
@@ -422,9 +471,10 @@ public:
         , nFlags(0)
         , cacheStore(false)
         , error(SCRIPT_ERR_UNKNOWN_ERROR)
+        , pvCacheEntries(NULL)
     {
     }
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn)
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn, std::vector<uint256>* pvCacheEntriesIn = NULL)
         : scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey)
         , amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue)
         , ptxTo(&txToIn)
@@ -433,6 +483,7 @@ public:
         , cacheStore(cacheIn)
         , error(SCRIPT_ERR_UNKNOWN_ERROR)
         , txdata(txdataIn)
+        , pvCacheEntries(pvCacheEntriesIn)
     {
     }
 
@@ -448,15 +499,56 @@ public:
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        std::swap(pvCacheEntries, check.pvCacheEntries);
     }
 
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the proof of work check of a group of headers.
+ * Headers messages are split into groups sized for the multi-lane scrypt
+ * kernels and verified in parallel on a CCheckQueue.
+ */
+class CHeaderPoWCheck {
+private:
+    std::vector<CBlockHeader> vHeaders;
+    const Consensus::Params* pConsensusParams;
+
+public:
+    CHeaderPoWCheck()
+        : pConsensusParams(NULL)
+    {
+    }
+    CHeaderPoWCheck(std::vector<CBlockHeader>::const_iterator itBegin, std::vector<CBlockHeader>::const_iterator itEnd, const Consensus::Params& consensusParams)
+        : vHeaders(itBegin, itEnd)
+        , pConsensusParams(&consensusParams)
+    {
+    }
+
+    bool operator()();
+
+    void swap(CHeaderPoWCheck& check)
+    {
+        vHeaders.swap(check.vHeaders);
+        std::swap(pConsensusParams, check.pConsensusParams);
+    }
+};
+
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW = true);
+/** Read the block belonging to an index entry. The proof of work is only recomputed with -checkblockreadpow, see implementation. */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read the serialised block at pos exactly as stored, without decoding the transactions or checking the
+ * proof of work. The stored form is the network serialisation including witness data; only the header
+ * is decoded to check that it is the block with the given hash.
+ */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+/** Read the undo data stored at pos for the block with the given parent, checking its checksum */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -472,15 +564,17 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons). If pblockundo is
+ *  given it receives the undo data of the block and pvPrevHeights the heights of
+ *  the outputs it spends, in input order. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, CBlockUndo* pblockundo = NULL, std::vector<int>* pvPrevHeights = NULL);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
  *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CBlockUndo* pblockundo = NULL);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
@@ -517,6 +611,41 @@ bool ResetBlockFailureFlags(CBlockIndex* pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/**
+ * Immutable copy of the state of chainActive and pindexBestHeader, replaced
+ * as a whole whenever either changes, so read-only callers can use it without
+ * cs_main. This works because block index entries are not freed while the
+ * node runs, and their hash, header, height, chain work, pprev and pskip do
+ * not change once they are linked in; their status flags do, and still need
+ * cs_main.
+ */
+struct CChainTipSnapshot {
+    const CBlockIndex* pindexTip;
+    const CBlockIndex* pindexBestHeader;
+    int nHeight;
+    uint256 hashBlock;
+    arith_uint256 nChainWork;
+    int64_t nMedianTimePast;
+    double dVerificationProgress;
+
+    CChainTipSnapshot() : pindexTip(NULL), pindexBestHeader(NULL), nHeight(-1), nMedianTimePast(0), dVerificationProgress(0) {}
+
+    /** Block of the active chain at height nHeightIn, or NULL if out of range. */
+    const CBlockIndex* operator[](int nHeightIn) const;
+
+    /** Whether pindex is part of the active chain. */
+    bool Contains(const CBlockIndex* pindex) const;
+
+    /** Successor of pindex in the active chain, or NULL if it is the tip or not part of the chain. */
+    const CBlockIndex* Next(const CBlockIndex* pindex) const;
+};
+
+/** The most recently published CChainTipSnapshot. Does not need cs_main. */
+boost::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
+
+/** Find a block index entry by hash, or NULL. Takes cs_main only for the lookup. */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
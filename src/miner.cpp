@@ -34,9 +34,12 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <atomic>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
+#include <set>
 
 #include <Gulden/Common/diff.h>
 #include <Gulden/Common/hash/hash.h>
@@ -74,6 +77,7 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 
 BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
     : chainparams(_chainparams)
+    , pindexPrev(NULL)
 {
 
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
@@ -115,21 +119,29 @@ void BlockAssembler::resetBlock()
 }
 
 CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    if (!AssembleBlock(scriptPubKeyIn))
+        return NULL;
+    return pblocktemplate.release();
+}
+
+bool BlockAssembler::AssembleBlock(const CScript& scriptPubKeyIn)
 {
     resetBlock();
 
     pblocktemplate.reset(new CBlockTemplate());
 
     if (!pblocktemplate.get())
-        return NULL;
+        return false;
     pblock = &pblocktemplate->block; // pointer for convenience
+    scriptPubKey = scriptPubKeyIn;
 
     pblock->vtx.push_back(CTransaction());
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
     LOCK2(cs_main, mempool.cs);
-    CBlockIndex* pindexPrev = chainActive.Tip();
+    pindexPrev = chainActive.Tip();
     nHeight = pindexPrev->nHeight + 1;
 
     pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
@@ -154,30 +166,65 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     nLastBlockWeight = nBlockWeight;
     LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOpsCost);
 
+    UpdateCoinbase();
+
+    pblock->hashPrevBlock = pindexPrev->GetBlockHash();
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+    pblock->nNonce = 0;
+
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    }
+
+    return true;
+}
+
+void BlockAssembler::UpdateCoinbase()
+{
     CMutableTransaction coinbaseTx;
     coinbaseTx.vin.resize(1);
     coinbaseTx.vin[0].prevout.SetNull();
     coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKey;
     coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
     std::string coinbaseSignature = GetArg("-coinbasesignature", "");
     coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0 << std::vector<unsigned char>(coinbaseSignature.begin(), coinbaseSignature.end());
     pblock->vtx[0] = coinbaseTx;
     pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
     pblocktemplate->vTxFees[0] = -nFees;
-
-    pblock->hashPrevBlock = pindexPrev->GetBlockHash();
-    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
-    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-    pblock->nNonce = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
+}
 
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
-    }
+bool BlockAssembler::AppendTransaction(CTxMemPool::txiter iter)
+{
+    AssertLockHeld(mempool.cs);
+    assert(pblocktemplate.get());
 
-    return pblocktemplate.release();
+    if (inBlock.count(iter))
+        return true;
+    // Assembly would not take it on its own either; a child paying for it shows up as a missing parent.
+    if (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(iter->GetTxSize()))
+        return true;
+    if (isStillDependent(iter))
+        return false;
+    if (!TestPackage(iter->GetTxSize(), iter->GetSigOpCost()))
+        return false;
+    CTxMemPool::setEntries package;
+    package.insert(iter);
+    if (!TestPackageTransactions(package))
+        return false;
+
+    AddToBlock(iter);
+    return true;
+}
+
+CBlockTemplate* BlockAssembler::CopyBlock()
+{
+    assert(pblocktemplate.get());
+    UpdateCoinbase();
+    return new CBlockTemplate(*pblocktemplate);
 }
 
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
@@ -502,6 +549,236 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
+/**
+ * Keeps the block template served by getblocktemplate and the internal
+ * miner. The mempool and tip notifications only record what changed, the
+ * work happens on the keeper's thread.
+ */
+class CBlockTemplateKeeper : public CValidationInterface {
+private:
+    //! Appending more than this many transactions at once is left to a new assembly
+    static const size_t MAX_PENDING_APPENDS = 10000;
+    //! Assemble again at least this often, in milliseconds, for changes no notification covers (lock times, priorities, fee deltas)
+    static const int64_t REFRESH_INTERVAL = 20000;
+
+    const CChainParams& chainparams;
+
+    boost::mutex mutex;
+    boost::condition_variable condChanged;
+    boost::condition_variable condPublished;
+    //! Transactions that entered the mempool since the thread last looked
+    std::vector<uint256> vAdded;
+    //! Something left the mempool, or could not be appended
+    bool fAssemble;
+    //! The tip changed, which does not wait for BLOCK_TEMPLATE_REBUILD_INTERVAL
+    bool fTipChanged;
+    int64_t nLastAssembled;
+    boost::shared_ptr<const CBlockTemplate> ptemplate;
+    unsigned int nTransactionsUpdated;
+
+    //! Only used by the thread
+    std::unique_ptr<BlockAssembler> passembler;
+
+    void Publish(CBlockTemplate* pnew, unsigned int nTransactionsUpdatedIn)
+    {
+        boost::shared_ptr<const CBlockTemplate> p(pnew);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        ptemplate = p;
+        nTransactionsUpdated = nTransactionsUpdatedIn;
+        condPublished.notify_all();
+    }
+
+    void Assemble()
+    {
+        passembler.reset();
+        if (IsInitialBlockDownload()) {
+            // Nobody mines on an old tip; the first tip change after syncing starts again.
+            Publish(NULL, 0);
+            return;
+        }
+        unsigned int nTransactionsUpdatedNow = mempool.GetTransactionsUpdated();
+        std::unique_ptr<BlockAssembler> assembler(new BlockAssembler(chainparams));
+        try {
+            if (!assembler->AssembleBlock(CScript() << OP_TRUE))
+                throw std::runtime_error("out of memory");
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            Publish(NULL, 0);
+            return;
+        }
+        passembler.swap(assembler);
+        Publish(passembler->CopyBlock(), nTransactionsUpdatedNow);
+    }
+
+    void Append(const std::vector<uint256>& vTxids)
+    {
+        if (!passembler)
+            return;
+        bool fAppended = false;
+        bool fFailed = false;
+        unsigned int nTransactionsUpdatedNow;
+        {
+            LOCK(mempool.cs);
+            {
+                // Anything removed since the assembly leaves the assembler pointing at entries that are gone.
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fAssemble || fTipChanged)
+                    return;
+            }
+            nTransactionsUpdatedNow = mempool.GetTransactionsUpdated();
+            BOOST_FOREACH (const uint256& txid, vTxids) {
+                CTxMemPool::txiter it = mempool.mapTx.find(txid);
+                if (it == mempool.mapTx.end())
+                    continue;
+                if (!passembler->AppendTransaction(it)) {
+                    fFailed = true;
+                    break;
+                }
+                fAppended = true;
+            }
+        }
+        if (fFailed) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fAssemble = true;
+        }
+        if (fAppended)
+            Publish(passembler->CopyBlock(), nTransactionsUpdatedNow);
+    }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fTipChanged = true;
+        condChanged.notify_one();
+    }
+
+public:
+    CBlockTemplateKeeper(const CChainParams& chainparamsIn)
+        : chainparams(chainparamsIn)
+        , fAssemble(true)
+        , fTipChanged(false)
+        , nLastAssembled(0)
+        , nTransactionsUpdated(0)
+    {
+    }
+
+    void TransactionAdded(const uint256& txid)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!ptemplate || vAdded.size() >= MAX_PENDING_APPENDS)
+            fAssemble = true;
+        else
+            vAdded.push_back(txid);
+        condChanged.notify_one();
+    }
+
+    void TransactionRemoved(const uint256& txid)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fAssemble = true;
+        condChanged.notify_one();
+    }
+
+    void Thread()
+    {
+        while (true) {
+            std::vector<uint256> vTxids;
+            bool fAssembleNow;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (true) {
+                    int64_t nNow = GetTimeMillis();
+                    int64_t nNext = nLastAssembled + (fAssemble ? BLOCK_TEMPLATE_REBUILD_INTERVAL : REFRESH_INTERVAL);
+                    if (fTipChanged || nNow >= nNext) {
+                        fAssembleNow = true;
+                        break;
+                    }
+                    if (!fAssemble && !vAdded.empty()) {
+                        fAssembleNow = false;
+                        break;
+                    }
+                    condChanged.timed_wait(lock, boost::posix_time::milliseconds(nNext - nNow));
+                }
+                if (fAssembleNow) {
+                    fAssemble = false;
+                    fTipChanged = false;
+                    nLastAssembled = GetTimeMillis();
+                    vAdded.clear();
+                } else {
+                    vTxids.swap(vAdded);
+                }
+            }
+            if (fAssembleNow)
+                Assemble();
+            else
+                Append(vTxids);
+        }
+    }
+
+    boost::shared_ptr<const CBlockTemplate> Get(unsigned int& nTransactionsUpdatedOut)
+    {
+        boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(BLOCK_TEMPLATE_MAX_WAIT);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!ptemplate || ptemplate->block.hashPrevBlock != GetChainTipSnapshot()->hashBlock) {
+            if (!condPublished.timed_wait(lock, deadline))
+                return boost::shared_ptr<const CBlockTemplate>();
+        }
+        nTransactionsUpdatedOut = nTransactionsUpdated;
+        return ptemplate;
+    }
+};
+
+static CBlockTemplateKeeper* pblocktemplatekeeper = NULL;
+
+void StartBlockTemplateUpdates(boost::thread_group& threadGroup, const CChainParams& chainparams)
+{
+    assert(!pblocktemplatekeeper);
+    pblocktemplatekeeper = new CBlockTemplateKeeper(chainparams);
+    mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateKeeper::TransactionAdded, pblocktemplatekeeper, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateKeeper::TransactionRemoved, pblocktemplatekeeper, _1));
+    RegisterValidationInterface(pblocktemplatekeeper);
+    boost::function<void()> keeper = boost::bind(&CBlockTemplateKeeper::Thread, pblocktemplatekeeper);
+    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "blocktemplate", keeper));
+}
+
+void StopBlockTemplateUpdates()
+{
+    if (!pblocktemplatekeeper)
+        return;
+    UnregisterValidationInterface(pblocktemplatekeeper);
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&CBlockTemplateKeeper::TransactionAdded, pblocktemplatekeeper, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&CBlockTemplateKeeper::TransactionRemoved, pblocktemplatekeeper, _1));
+    delete pblocktemplatekeeper;
+    pblocktemplatekeeper = NULL;
+}
+
+boost::shared_ptr<const CBlockTemplate> GetKeptBlockTemplate(unsigned int& nTransactionsUpdated)
+{
+    if (!pblocktemplatekeeper)
+        return boost::shared_ptr<const CBlockTemplate>();
+    return pblocktemplatekeeper->Get(nTransactionsUpdated);
+}
+
+CBlockTemplate* CreateBlockTemplate(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    unsigned int nTransactionsUpdated;
+    boost::shared_ptr<const CBlockTemplate> pkept = GetKeptBlockTemplate(nTransactionsUpdated);
+    const CBlockIndex* pindexPrev = pkept ? LookupBlockIndex(pkept->block.hashPrevBlock) : NULL;
+    if (!pindexPrev)
+        return BlockAssembler(chainparams).CreateNewBlock(scriptPubKeyIn);
+
+    // Only the coinbase output differs; the witness commitment does not cover the coinbase.
+    CBlockTemplate* pblocktemplate = new CBlockTemplate(*pkept);
+    CBlock* pblock = &pblocktemplate->block;
+    CMutableTransaction coinbaseTx(pblock->vtx[0]);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    pblock->vtx[0] = coinbaseTx;
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+    return pblocktemplate;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
 
@@ -616,10 +893,67 @@ bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainparams)
 
 double dBestHashesPerSec = 0.0;
 double dHashesPerSec = 0.0;
-int64_t nHPSTimerStart = 0;
-int64_t nHashCounter = 0;
 int64_t nHashThrottle = -1;
-static CCriticalSection timerCS;
+
+static CCriticalSection cs_hashCounters;
+
+/**
+ * Hashes done by one mining thread. Only the owning thread writes its
+ * counter, so mining threads never contend on a shared one; the combined rate
+ * is sampled from all of them about once a second.
+ */
+class CMinerHashCounter
+{
+public:
+    std::atomic<uint64_t> nHashes;
+
+    CMinerHashCounter();
+    ~CMinerHashCounter();
+
+    void Add(unsigned int n) { nHashes.store(nHashes.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+};
+
+static std::set<const CMinerHashCounter*> setHashCounters;
+//! Hashes done by threads that have stopped mining, so that the total never goes backwards
+static uint64_t nHashesRetired = 0;
+static uint64_t nHashesSampled = 0;
+static int64_t nHashesSampledTime = 0;
+static std::atomic<int> nMiningThreads(0);
+
+CMinerHashCounter::CMinerHashCounter() : nHashes(0)
+{
+    LOCK(cs_hashCounters);
+    setHashCounters.insert(this);
+    nMiningThreads++;
+}
+
+CMinerHashCounter::~CMinerHashCounter()
+{
+    LOCK(cs_hashCounters);
+    setHashCounters.erase(this);
+    nHashesRetired += nHashes.load();
+    nMiningThreads--;
+}
+
+/** Update dHashesPerSec if a second has passed since the last sample; whichever thread gets here first does it. */
+static void SampleHashesPerSec()
+{
+    TRY_LOCK(cs_hashCounters, lockSample);
+    if (!lockSample)
+        return;
+    int64_t nNow = GetTimeMillis();
+    if (nNow - nHashesSampledTime < 1000)
+        return;
+    uint64_t nTotal = nHashesRetired;
+    BOOST_FOREACH (const CMinerHashCounter* pcounter, setHashCounters)
+        nTotal += pcounter->nHashes.load(std::memory_order_relaxed);
+    if (nHashesSampledTime != 0) {
+        dHashesPerSec = 1000.0 * (nTotal - nHashesSampled) / (nNow - nHashesSampledTime);
+        dBestHashesPerSec = std::max(dBestHashesPerSec, dHashesPerSec);
+    }
+    nHashesSampled = nTotal;
+    nHashesSampledTime = nNow;
+}
 
 void static BitcoinMiner(const CChainParams& chainparams)
 {
@@ -631,14 +965,14 @@ void static BitcoinMiner(const CChainParams& chainparams)
     boost::shared_ptr<CReserveScript> coinbaseScript;
     GetMainSignals().ScriptForMining(coinbaseScript);
 
-    if (nHPSTimerStart == 0) {
-        LOCK(timerCS);
-        if (nHPSTimerStart == 0) {
-            nHPSTimerStart = GetTimeMillis();
-            nHashCounter = 0;
-            dHashesPerSec = 0;
-        }
-    }
+    CMinerHashCounter hashCounter;
+    // Each pass hashes as many consecutive nonces as the widest scrypt kernel takes.
+    const unsigned int nLanes = scrypt_multilane_width();
+    std::vector<char> scratchpad(SCRYPT_MULTILANE_SCRATCHPAD_SIZE(nLanes));
+    std::vector<char> vHeaders(80 * nLanes);
+    std::vector<uint256> vHashes(nLanes);
+    int64_t nThrottleStart = GetTimeMillis();
+    uint64_t nThrottleHashes = 0;
 
     try {
 
@@ -663,34 +997,35 @@ void static BitcoinMiner(const CChainParams& chainparams)
             unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
             CBlockIndex* pindexPrev = chainActive.Tip();
 
-            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams).CreateNewBlock(coinbaseScript->reserveScript));
+            std::unique_ptr<CBlockTemplate> pblocktemplate(CreateBlockTemplate(chainparams, coinbaseScript->reserveScript));
             if (!pblocktemplate.get()) {
                 LogPrintf("Error in GuldenMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
                 return;
             }
             CBlock* pblock = &pblocktemplate->block;
+            if (pblock->hashPrevBlock != pindexPrev->GetBlockHash())
+                continue; // the tip moved on while the template was fetched
             IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
 
             LogPrintf("Running GuldenMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
                       ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
 
+            // Only the time, bits and nonce in the last 16 bytes of the header change from here on.
+            scrypt_midstate midstate;
+            scrypt_1024_1_1_256_prepare(BEGIN(pblock->nVersion), &midstate);
+
             int64_t nStart = GetTime();
+            int64_t nLastCheck = GetTimeMillis();
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
-            uint256 hash;
             uint32_t nNonce = 0;
             while (true) {
 
-                arith_uint256 thash;
+                bool fFound = false;
+                uint256 hashFound;
                 while (true) {
-                    if (GetTimeMillis() - nHPSTimerStart > 1000) {
-                        TRY_LOCK(timerCS, lockhc);
-                        if (lockhc && GetTimeMillis() - nHPSTimerStart > 1000) {
-                            int64_t nTemp = nHashCounter;
-                            nHashCounter = 0;
-                            dHashesPerSec = 1000 * (nTemp / (GetTimeMillis() - nHPSTimerStart));
-                            dBestHashesPerSec = std::max(dBestHashesPerSec, dHashesPerSec);
-                            nHPSTimerStart = GetTimeMillis();
-                        }
+                    if (GetTimeMillis() - nLastCheck > 1000) {
+                        nLastCheck = GetTimeMillis();
+                        SampleHashesPerSec();
                         UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
                         arith_uint256 compBits = pblock->nBits;
                         if (GetNextWorkRequired(chainActive.Tip(), pblock, Params().GetConsensus()) != compBits) {
@@ -698,13 +1033,26 @@ void static BitcoinMiner(const CChainParams& chainparams)
                         }
                     }
 
-                    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-                    scrypt_1024_1_1_256_sp(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-
-                    if (thash <= hashTarget) {
+                    for (unsigned int i = 0; i < nLanes; ++i) {
+                        memcpy(&vHeaders[80 * i], BEGIN(pblock->nVersion), 80);
+                        uint32_t nLaneNonce = pblock->nNonce + i;
+                        memcpy(&vHeaders[80 * i + 76], &nLaneNonce, 4);
+                    }
+                    scrypt_1024_1_1_256_batch_midstate(&midstate, &vHeaders[0], (char*)&vHashes[0], nLanes, &scratchpad[0]);
+                    hashCounter.Add(nLanes);
+
+                    for (unsigned int i = 0; i < nLanes; ++i) {
+                        if (UintToArith256(vHashes[i]) <= hashTarget) {
+                            pblock->nNonce += i;
+                            hashFound = vHashes[i];
+                            fFound = true;
+                            break;
+                        }
+                    }
+                    if (fFound) {
 
                         LogPrintf("GuldenMiner:\n");
-                        LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", thash.GetHex(), hashTarget.GetHex());
+                        LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hashFound.GetHex(), hashTarget.GetHex());
                         ProcessBlockFound(pblock, chainparams);
                         coinbaseScript->KeepScript();
 
@@ -713,18 +1061,16 @@ void static BitcoinMiner(const CChainParams& chainparams)
 
                         break;
                     }
-                    pblock->nNonce += 1;
-                    nHashCounter++;
-                    while (nHashThrottle != -1 && nHashCounter >= nHashThrottle) {
-                        if (GetTimeMillis() - nHPSTimerStart > 1000) {
-                            TRY_LOCK(timerCS, lockhc);
-                            if (lockhc && GetTimeMillis() - nHPSTimerStart > 1000) {
-                                int64_t nTemp = nHashCounter;
-                                nHashCounter = 0;
-                                dHashesPerSec = 1000 * (nTemp / (GetTimeMillis() - nHPSTimerStart));
-                                dBestHashesPerSec = std::max(dBestHashesPerSec, dHashesPerSec);
-                                nHPSTimerStart = GetTimeMillis();
-                            }
+                    pblock->nNonce += nLanes;
+                    nNonce += nLanes;
+
+                    // The throttle is shared out evenly between the mining threads.
+                    nThrottleHashes += nLanes;
+                    while (nHashThrottle != -1 && nThrottleHashes >= (uint64_t)(nHashThrottle / std::max(1, nMiningThreads.load()))) {
+                        if (GetTimeMillis() - nThrottleStart > 1000) {
+                            nThrottleStart = GetTimeMillis();
+                            nThrottleHashes = 0;
+                            break;
                         }
                         MilliSleep(1);
                     }
@@ -732,6 +1078,8 @@ void static BitcoinMiner(const CChainParams& chainparams)
                     if ((pblock->nNonce & 0xFF) == 0)
                         break;
                 }
+                if (fFound)
+                    break;
 
                 boost::this_thread::interruption_point();
 
@@ -14,10 +14,12 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "script/script.h"
 #include "txmempool.h"
 
 #include <stdint.h>
 #include <memory>
+#include <boost/shared_ptr.hpp>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
@@ -26,12 +28,14 @@
 class CBlockIndex;
 class CChainParams;
 class CReserveKey;
-class CScript;
 class CWallet;
 
+namespace boost {
+class thread_group;
+} // namespace boost
+
 extern double dBestHashesPerSec;
 extern double dHashesPerSec;
-extern int64_t nHPSTimerStart;
 extern int64_t nHashThrottle;
 
 bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey);
@@ -47,6 +51,13 @@ static const int DEFAULT_GENERATE_THREADS = 1;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
 
+/** Default for -keepblocktemplate */
+static const bool DEFAULT_KEEP_BLOCK_TEMPLATE = true;
+/** Minimum time between assembling the kept block template again while the tip stays the same, in milliseconds */
+static const int64_t BLOCK_TEMPLATE_REBUILD_INTERVAL = 1000;
+/** How long to wait for the kept block template to catch up with a new tip before assembling one directly, in milliseconds */
+static const int64_t BLOCK_TEMPLATE_MAX_WAIT = 2000;
+
 struct CBlockTemplate {
     CBlock block;
     std::vector<CAmount> vTxFees;
@@ -163,6 +174,8 @@ private:
     int nHeight;
     int64_t nLockTimeCutoff;
     const CChainParams& chainparams;
+    CBlockIndex* pindexPrev;
+    CScript scriptPubKey;
 
     int lastFewTxs;
     bool blockFinished;
@@ -172,9 +185,23 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
 
+    /** Like CreateNewBlock, but keep the block so that transactions can be appended to it */
+    bool AssembleBlock(const CScript& scriptPubKeyIn);
+    /**
+     * Append a transaction that entered the mempool after AssembleBlock to
+     * the kept block. Returns false if the block has to be assembled again
+     * to take it, because it has unconfirmed parents outside the block or
+     * does not fit.
+     */
+    bool AppendTransaction(CTxMemPool::txiter iter);
+    /** Copy of the kept block, its coinbase collecting the fees of everything appended */
+    CBlockTemplate* CopyBlock();
+
 private:
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Create the coinbase for the transactions in the block */
+    void UpdateCoinbase();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
@@ -207,6 +234,23 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx);
 };
 
+/**
+ * Keep a block template for the current tip up to date in the background,
+ * appending transactions as they enter the mempool and assembling it again
+ * when the tip changes or appending is not enough.
+ */
+void StartBlockTemplateUpdates(boost::thread_group& threadGroup, const CChainParams& chainparams);
+void StopBlockTemplateUpdates();
+/**
+ * The kept block template, paying to OP_TRUE, once it builds on the current
+ * tip, and the mempool update counter it reflects. Waits up to
+ * BLOCK_TEMPLATE_MAX_WAIT for it to catch up with a new tip. Returns NULL if
+ * no template is being kept or it does not catch up in time.
+ */
+boost::shared_ptr<const CBlockTemplate> GetKeptBlockTemplate(unsigned int& nTransactionsUpdated);
+/** New block template paying to scriptPubKeyIn, copied from the kept one if possible */
+CBlockTemplate* CreateBlockTemplate(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
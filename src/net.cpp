@@ -34,6 +34,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -94,6 +98,15 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
+//! Set while the epoll socket loop runs, which services descriptors of any value
+static std::atomic<bool> fEpollSockets(false);
+
+/** Whether the running socket loop can service s: select() needs it below FD_SETSIZE, epoll does not. */
+static bool IsServiceableSocket(SOCKET s)
+{
+    return fEpollSockets || IsSelectableSocket(s);
+}
+
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
 bool fAddressesInitialized = false;
@@ -114,6 +127,8 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+static boost::mutex mutexMsgProc;
+static uint64_t nMsgProcWakeSeq = 0; // protected by mutexMsgProc, bumped by every WakeMessageHandler()
 
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
@@ -378,7 +393,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool fCountFailure
     SOCKET hSocket;
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) : ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsServiceableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -704,7 +719,7 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
             i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
 
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            WakeMessageHandler();
         }
     }
 
@@ -967,7 +982,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket)
         return;
     }
 
-    if (!IsSelectableSocket(hSocket)) {
+    if (!IsServiceableSocket(hSocket)) {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
         return;
@@ -1007,59 +1022,132 @@ static void AcceptConnection(const ListenSocket& hListenSocket)
     }
 }
 
-void ThreadSocketHandler()
+/** Remove disconnected nodes from vNodes and delete the ones nobody references any more. */
+static void SocketCleanupNodes(unsigned int& nPrevNodeCount)
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true) {
-
-        {
-            LOCK(cs_vNodes);
+    {
+        LOCK(cs_vNodes);
 
-            std::vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                if (pnode->fDisconnect || (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+        std::vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            if (pnode->fDisconnect || (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
 
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    pnode->grantOutbound.Release();
+                pnode->grantOutbound.Release();
 
-                    pnode->CloseSocketDisconnect();
+                pnode->CloseSocketDisconnect();
 
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
+    }
+    {
+
+        std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
 
-            std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
-
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
                 }
             }
         }
-        if (vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+    if (vNodes.size() != nPrevNodeCount) {
+        nPrevNodeCount = vNodes.size();
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+/** True if the node has complete messages waiting and more than the receive flood size buffered. */
+static bool IsRecvFlooded(CNode* pnode)
+{
+    return !pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() && pnode->GetTotalRecvSize() > ReceiveFloodSize();
+}
+
+/**
+ * Read once from the node's socket, cs_vRecvMsg must be held.
+ * Returns true if the read filled the buffer, so more data may still be waiting.
+ */
+static bool SocketRecvData(CNode* pnode)
+{
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0) {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return nBytes == (int)sizeof(pchBuf);
+    } else if (nBytes == 0) {
+
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else if (nBytes < 0) {
+
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
         }
+    }
+    return false;
+}
+
+/** Disconnect the node if it stopped talking to us or stopped answering pings. */
+static void InactivityCheck(CNode* pnode, int64_t nTime)
+{
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+/** Whether a socket can be put in an fd_set; with epoll available connections are accepted past FD_SETSIZE. */
+static bool IsFdSetSocket(SOCKET s)
+{
+#ifdef WIN32
+    return true;
+#else
+    return (s < FD_SETSIZE);
+#endif
+}
+
+static void ThreadSocketHandlerSelect()
+{
+    unsigned int nPrevNodeCount = 0;
+    while (true) {
+        SocketCleanupNodes(nPrevNodeCount);
 
         struct timeval timeout;
         timeout.tv_sec = 0;
@@ -1083,7 +1171,7 @@ void ThreadSocketHandler()
         {
             LOCK(cs_vNodes);
             BOOST_FOREACH (CNode* pnode, vNodes) {
-                if (pnode->hSocket == INVALID_SOCKET)
+                if (pnode->hSocket == INVALID_SOCKET || !IsFdSetSocket(pnode->hSocket))
                     continue;
                 FD_SET(pnode->hSocket, &fdsetError);
                 hSocketMax = std::max(hSocketMax, pnode->hSocket);
@@ -1098,7 +1186,7 @@ void ThreadSocketHandler()
                 }
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() || pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    if (lockRecv && !IsRecvFlooded(pnode))
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
@@ -1136,37 +1224,12 @@ void ThreadSocketHandler()
         BOOST_FOREACH (CNode* pnode, vNodesCopy) {
             boost::this_thread::interruption_point();
 
-            if (pnode->hSocket == INVALID_SOCKET)
+            if (pnode->hSocket == INVALID_SOCKET || !IsFdSetSocket(pnode->hSocket))
                 continue;
             if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                if (lockRecv)
+                    SocketRecvData(pnode);
             }
 
             if (pnode->hSocket == INVALID_SOCKET)
@@ -1177,30 +1240,204 @@ void ThreadSocketHandler()
                     SocketSendData(pnode);
             }
 
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            InactivityCheck(pnode, GetTime());
+        }
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodesCopy)
+                pnode->Release();
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+/** Maximum number of reads from one socket per pass, so that a single busy peer cannot starve the others. */
+static const int MAX_EPOLL_RECV_PER_PASS = 4;
+/** Maximum number of events taken from the kernel per epoll_wait() call. */
+static const int MAX_EPOLL_EVENTS = 256;
+
+/**
+ * Socket handler loop for epoll. Peer sockets are registered edge-triggered, so a
+ * wakeup only reports the sockets that changed state and the loop costs O(ready peers)
+ * instead of O(peers). The readiness is remembered in the node (fRecvReady/fSendReady)
+ * until a read or write runs into EAGAIN. Nodes with work left over after a pass (read
+ * cap hit, lock contended, receive buffer full) are kept referenced and queued for the
+ * next pass; a full pass over vNodes only runs once a second for the inactivity checks.
+ */
+static void ThreadSocketHandlerEpoll(int hEpoll)
+{
+    unsigned int nPrevNodeCount = 0;
+    int64_t nLastFullPass = 0;
+    std::vector<CNode*> vNodesMore;     // read cap hit, more data waiting in the kernel: poll again immediately
+    std::vector<CNode*> vNodesRetry;    // blocked on a lock or a full receive buffer: retry on the next wakeup
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    // Listening sockets stay level-triggered, one connection is accepted per wakeup.
+    BOOST_FOREACH (ListenSocket& hListenSocket, vhListenSocket) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &hListenSocket;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &ev) != 0)
+            LogPrintf("epoll_ctl failed for listening socket: %s\n", NetworkErrorString(WSAGetLastError()));
+    }
+
+    while (true) {
+        SocketCleanupNodes(nPrevNodeCount);
+
+        // A closed socket leaves the epoll set by itself, only new ones need adding.
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodes) {
+                if (pnode->fSocketRegistered || pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                ev.data.ptr = pnode;
+                if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &ev) != 0) {
+                    LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
                     pnode->fDisconnect = true;
                 }
+                pnode->fSocketRegistered = true;
             }
         }
+
+        int nEvents = epoll_wait(hEpoll, events, MAX_EPOLL_EVENTS, vNodesMore.empty() ? 50 : 0);
+        boost::this_thread::interruption_point();
+
+        if (nEvents < 0) {
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR) {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+                MilliSleep(50);
+            }
+            nEvents = 0;
+        }
+
+        std::vector<CNode*> vNodesReady;
+        vNodesReady.swap(vNodesMore);
+        vNodesReady.insert(vNodesReady.end(), vNodesRetry.begin(), vNodesRetry.end());
+        vNodesRetry.clear();
         {
             LOCK(cs_vNodes);
-            BOOST_FOREACH (CNode* pnode, vNodesCopy)
+            for (int i = 0; i < nEvents; i++) {
+                const ListenSocket* pListen = NULL;
+                BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+                    if (events[i].data.ptr == &hListenSocket)
+                        pListen = &hListenSocket;
+                }
+                if (pListen) {
+                    AcceptConnection(*pListen);
+                    continue;
+                }
+
+                // Nodes are only deleted by this thread after their socket was closed, which
+                // removes it from the epoll set, so the pointer is valid.
+                CNode* pnode = (CNode*)events[i].data.ptr;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    pnode->fRecvReady = true;
+                if (events[i].events & (EPOLLOUT | EPOLLERR))
+                    pnode->fSendReady = true;
+                if (!pnode->fSocketPending) {
+                    pnode->fSocketPending = true;
+                    pnode->AddRef();
+                    vNodesReady.push_back(pnode);
+                }
+            }
+
+            // Once a second: inactivity checks, and pick up any node whose readiness is still
+            // set but which fell out of the queues (e.g. data queued after its write edge).
+            int64_t nTime = GetTime();
+            if (nTime != nLastFullPass) {
+                nLastFullPass = nTime;
+                BOOST_FOREACH (CNode* pnode, vNodes) {
+                    InactivityCheck(pnode, nTime);
+                    if (!pnode->fSocketPending && (pnode->fRecvReady || (pnode->fSendReady && pnode->nSendSize > 0))) {
+                        pnode->fSocketPending = true;
+                        pnode->AddRef();
+                        vNodesReady.push_back(pnode);
+                    }
+                }
+            }
+        }
+
+        std::vector<CNode*> vNodesDone;
+        BOOST_FOREACH (CNode* pnode, vNodesReady) {
+            boost::this_thread::interruption_point();
+
+            bool fMore = false;
+            bool fRetry = false;
+
+            if (pnode->fRecvReady && pnode->hSocket != INVALID_SOCKET) {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (!lockRecv) {
+                    fRetry = true;
+                } else {
+                    for (int n = 0; pnode->hSocket != INVALID_SOCKET; n++) {
+                        if (IsRecvFlooded(pnode)) {
+                            fRetry = true;
+                            break;
+                        }
+                        if (n == MAX_EPOLL_RECV_PER_PASS) {
+                            fMore = true;
+                            break;
+                        }
+                        if (!SocketRecvData(pnode)) {
+                            pnode->fRecvReady = false;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (pnode->fSendReady && pnode->hSocket != INVALID_SOCKET) {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (!lockSend) {
+                    fRetry = true;
+                } else if (!pnode->vSendMsg.empty()) {
+                    SocketSendData(pnode);
+                    // Anything left means the kernel buffer is full; EPOLLOUT reports when it drains.
+                    if (!pnode->vSendMsg.empty())
+                        pnode->fSendReady = false;
+                }
+            }
+
+            if (pnode->hSocket == INVALID_SOCKET || (!fMore && !fRetry)) {
+                pnode->fSocketPending = false;
+                vNodesDone.push_back(pnode);
+            } else if (fMore) {
+                vNodesMore.push_back(pnode);
+            } else {
+                vNodesRetry.push_back(pnode);
+            }
+        }
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodesDone)
                 pnode->Release();
         }
     }
 }
+#endif
+
+void ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    int hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpoll != -1) {
+        LogPrintf("Using epoll for network sockets\n");
+        fEpollSockets = true;
+        try {
+            ThreadSocketHandlerEpoll(hEpoll);
+        } catch (...) {
+            fEpollSockets = false;
+            close(hEpoll);
+            throw;
+        }
+    }
+    LogPrintf("epoll_create1 failed: %s, falling back to select\n", NetworkErrorString(WSAGetLastError()));
+#endif
+    ThreadSocketHandlerSelect();
+}
 
 #ifdef USE_UPNP
 void ThreadMapPort()
@@ -1608,11 +1845,25 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
     return true;
 }
 
-void ThreadMessageHandler()
+void WakeMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
+    {
+        boost::lock_guard<boost::mutex> lock(mutexMsgProc);
+        nMsgProcWakeSeq++;
+    }
+    messageHandlerCondition.notify_all();
+}
 
+/**
+ * One of the message processing workers. Every node is handled by at most one worker
+ * at a time (fProcessingMessages), which keeps its messages in order. The node's owner
+ * (id modulo the number of workers) also runs SendMessages for it, the other workers only
+ * pick it up when it has received messages waiting, so a peer stuck behind a slow request
+ * on one worker does not hold up the others.
+ */
+void ThreadMessageHandler(int nWorker, int nWorkers)
+{
+    uint64_t nWakeSeqSeen = 0;
     while (true) {
         std::vector<CNode*> vNodesCopy;
         {
@@ -1625,13 +1876,19 @@ void ThreadMessageHandler()
 
         bool fSleep = true;
 
-        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+        // Start at a different place in every worker so they do not all contend for the same nodes.
+        for (size_t i = 0; i < vNodesCopy.size(); i++) {
+            CNode* pnode = vNodesCopy[(i + nWorker * vNodesCopy.size() / nWorkers) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
+            bool fOwner = (pnode->GetId() % nWorkers) == nWorker;
+            if (pnode->fProcessingMessages.exchange(true))
+                continue;
+
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
+                if (lockRecv && (fOwner || !pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))) {
                     if (!GetNodeSignals().ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
@@ -1644,11 +1901,12 @@ void ThreadMessageHandler()
             }
             boost::this_thread::interruption_point();
 
-            {
+            if (fOwner) {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
                     GetNodeSignals().SendMessages(pnode);
             }
+            pnode->fProcessingMessages = false;
             boost::this_thread::interruption_point();
         }
 
@@ -1658,8 +1916,17 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        // A wakeup that arrived while processing ends the wait at once.
+        // The timeout only paces the periodic work done by SendMessages (pings, inventory trickle).
+        boost::unique_lock<boost::mutex> lock(mutexMsgProc);
+        if (fSleep) {
+            boost::system_time timeout = boost::get_system_time() + boost::posix_time::milliseconds(100);
+            while (nMsgProcWakeSeq == nWakeSeqSeen) {
+                if (!messageHandlerCondition.timed_wait(lock, timeout))
+                    break;
+            }
+        }
+        nWakeSeqSeen = nMsgProcWakeSeq;
     }
 }
 
@@ -1858,7 +2125,10 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    int nMsgProcThreads = std::max(1, std::min((int)GetArg("-msgprocthreads", DEFAULT_MSGPROC_THREADS), MAX_MSGPROC_THREADS));
+    LogPrintf("Using %d threads for peer message processing\n", nMsgProcThreads);
+    for (int i = 0; i < nMsgProcThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&ThreadMessageHandler, i, nMsgProcThreads))));
 
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
 }
@@ -2188,6 +2458,11 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fSocketRegistered = false;
+    fSocketPending = false;
+    fProcessingMessages = false;
+    fRecvReady = false;
+    fSendReady = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -80,6 +80,10 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER = 1 * 1000;
+/** Default number of threads processing peer messages */
+static const int DEFAULT_MSGPROC_THREADS = 4;
+/** Maximum number of threads processing peer messages */
+static const int MAX_MSGPROC_THREADS = 16;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
@@ -104,6 +108,8 @@ bool BindListenPort(const CService& bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode* pnode);
+/** Wake the message handler thread, called when a node has a complete message to process. */
+void WakeMessageHandler();
 
 struct CombinerAll {
     typedef bool result_type;
@@ -352,6 +358,13 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    std::atomic<bool> fProcessingMessages; // claimed by a message processing worker
+
+    // Readiness of hSocket as reported by the epoll socket handler; only used by that thread.
+    bool fSocketRegistered;
+    bool fSocketPending; // queued for the next pass of the socket handler, which holds a reference
+    bool fRecvReady;
+    bool fSendReady;
 
     bool fRelayTxes; //protected by cs_filter
     bool fSentAddr;
@@ -27,6 +27,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <poll.h>
+#endif
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
 #include <boost/thread.hpp>
@@ -479,11 +483,25 @@ bool static ConnectSocketDirectly(const CService& addrConnect, SOCKET& hSocketRe
         int nErr = WSAGetLastError();
 
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
+#ifdef USE_EPOLL
+            // poll() takes any descriptor, unlike an fd_set.
+            struct pollfd pollfd;
+            pollfd.fd = hSocket;
+            pollfd.events = POLLOUT;
+            pollfd.revents = 0;
+            int nRet = poll(&pollfd, 1, nTimeout);
+#else
+            if (!IsSelectableSocket(hSocket)) {
+                LogPrintf("Cannot connect to %s: non-selectable socket created (fd >= FD_SETSIZE ?)\n", addrConnect.ToString());
+                CloseSocket(hSocket);
+                return false;
+            }
             struct timeval timeout = MillisToTimeval(nTimeout);
             fd_set fdset;
             FD_ZERO(&fdset);
             FD_SET(hSocket, &fdset);
             int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
+#endif
             if (nRet == 0) {
                 LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
                 CloseSocket(hSocket);
@@ -58,6 +58,31 @@ uint256 CBlock::GetPoWHash() const
     return ArithToUint256(thash);
 }
 
+void GetPoWHashes(const CBlockHeader* pHeaders, unsigned int nCount, uint256* pHashes)
+{
+    if (nCount == 0)
+        return;
+
+    if (GetBoolArg("-testnetaccel", false)) {
+        for (unsigned int i = 0; i < nCount; ++i)
+            pHashes[i] = CBlock(pHeaders[i]).GetPoWHash();
+        return;
+    }
+
+    std::vector<char> vInput(80 * nCount);
+    std::vector<char> vOutput(32 * nCount);
+    for (unsigned int i = 0; i < nCount; ++i)
+        memcpy(&vInput[80 * i], BEGIN(pHeaders[i].nVersion), 80);
+
+    scrypt_1024_1_1_256_batch(&vInput[0], &vOutput[0], nCount);
+
+    for (unsigned int i = 0; i < nCount; ++i) {
+        arith_uint256 thash;
+        memcpy(BEGIN(thash), &vOutput[32 * i], 32);
+        pHashes[i] = ArithToUint256(thash);
+    }
+}
+
 int64_t GetBlockWeight(const CBlock& block)
 {
 
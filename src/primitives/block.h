@@ -163,6 +163,9 @@ struct CBlockLocator {
     }
 };
 
+/** Compute the proof of work hashes of nCount headers at once, using the multi-lane scrypt kernels where possible. */
+void GetPoWHashes(const CBlockHeader* pHeaders, unsigned int nCount, uint256* pHashes);
+
 /** Compute the consensus-critical block weight (see BIP 141). */
 int64_t GetBlockWeight(const CBlock& tx);
 
@@ -255,6 +255,35 @@ extern const char* GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char* BLOCKTXN;
+/**
+ * getcfilters requests the compact filters of a range of blocks.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by BIP157.
+ */
+extern const char* GETCFILTERS;
+/**
+ * cfilter is the reply to getcfilters, one message per block.
+ */
+extern const char* CFILTER;
+/**
+ * getcfheaders requests the filter hashes of a range of blocks, and the filter
+ * header of the block before them.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by BIP157.
+ */
+extern const char* GETCFHEADERS;
+/**
+ * cfheaders is the reply to getcfheaders.
+ */
+extern const char* CFHEADERS;
+/**
+ * getcfcheckpt requests the filter headers of evenly spaced blocks up to a
+ * given block, so that a client can fetch the rest from several peers.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by BIP157.
+ */
+extern const char* GETCFCHECKPT;
+/**
+ * cfcheckpt is the reply to getcfcheckpt.
+ */
+extern const char* CFCHECKPT;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -273,6 +302,9 @@ enum ServiceFlags : uint64_t {
 
     NODE_WITNESS = (1 << 3),
 
+    // NODE_COMPACT_FILTERS means the node serves the compact block filters of BIP157/158.
+    NODE_COMPACT_FILTERS = (1 << 6),
+
 };
 
 /** A CService with information about it as peer */
@@ -150,14 +150,13 @@ static bool rest_headers(HTTPRequest* req,
     std::vector<const CBlockIndex*> headers;
     headers.reserve(count);
     {
-        LOCK(cs_main);
-        BlockMap::const_iterator it = mapBlockIndex.find(hash);
-        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
-        while (pindex != NULL && chainActive.Contains(pindex)) {
+        boost::shared_ptr<const CChainTipSnapshot> chain = GetChainTipSnapshot();
+        const CBlockIndex* pindex = LookupBlockIndex(hash);
+        while (pindex != NULL && chain->Contains(pindex)) {
             headers.push_back(pindex);
             if (headers.size() == (unsigned long)count)
                 break;
-            pindex = chainActive.Next(pindex);
+            pindex = chain->Next(pindex);
         }
     }
 
@@ -212,6 +211,7 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    std::vector<unsigned char> vRawBlock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -222,23 +222,24 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        // Binary and hex replies are the block as stored on disk, only JSON needs it decoded.
+        if (rf == RF_BINARY || rf == RF_HEX) {
+            if (!ReadRawBlockFromDisk(vRawBlock, pblockindex, Params().MessageStart()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        } else if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        string binaryBlock(vRawBlock.begin(), vRawBlock.end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = HexStr(vRawBlock.begin(), vRawBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
@@ -395,6 +396,69 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+UniValue getaddresshistory(const UniValue& params, bool fHelp);
+UniValue getaddressutxos(const UniValue& params, bool fHelp);
+
+/** Serve /rest/address/<kind>/<address>[/<count>[/<cursor>]].json from the matching script index rpc call */
+static bool rest_address(HTTPRequest* req, const std::string& strURIPart, rpcfn_type fn)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() < 1 || path.size() > 3)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/address/<history|utxos>/<address>[/<count>[/<cursor>]].json.");
+
+    UniValue rpcParams(UniValue::VARR);
+    rpcParams.push_back(path[0]);
+    if (path.size() > 1) {
+        int32_t nCount;
+        if (!ParseInt32(path[1], &nCount))
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid count: " + path[1]);
+        // The history call takes a height range before the page.
+        if (fn == &getaddresshistory) {
+            rpcParams.push_back(0);
+            rpcParams.push_back(std::numeric_limits<int>::max());
+        }
+        rpcParams.push_back(nCount);
+        if (path.size() > 2)
+            rpcParams.push_back(path[2]);
+    }
+
+    switch (rf) {
+    case RF_JSON: {
+        UniValue result;
+        try {
+            result = fn(rpcParams, false);
+        } catch (const UniValue& objError) {
+            return RESTERR(req, HTTP_BAD_REQUEST, find_value(objError, "message").get_str());
+        }
+        string strJSON = result.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_address_history(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_address(req, strURIPart, &getaddresshistory);
+}
+
+static bool rest_address_utxos(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_address(req, strURIPart, &getaddressutxos);
+}
+
 static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -586,6 +650,8 @@ static const struct {
       { "/rest/mempool/contents", rest_mempool_contents },
       { "/rest/headers/", rest_headers },
       { "/rest/getutxos", rest_getutxos },
+      { "/rest/address/history/", rest_address_history },
+      { "/rest/address/utxos/", rest_address_utxos },
   };
 
 bool StartREST()
@@ -11,26 +11,35 @@
 // file COPYING
 
 #include "amount.h"
+#include "base58.h"
+#include "blockfilterindex.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "coinsprefetch.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
+#include "script/standard.h"
+#include "scriptindex.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "utxosnapshot.h"
 #include "hash.h"
 
 #include <stdint.h>
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 using namespace std;
@@ -66,12 +75,13 @@ double GetDifficulty(const CBlockIndex* blockindex)
 
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
+    boost::shared_ptr<const CChainTipSnapshot> chain = GetChainTipSnapshot();
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
 
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain->Contains(blockindex))
+        confirmations = chain->nHeight - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", blockindex->nVersion));
@@ -86,7 +96,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex* pnext = chainActive.Next(blockindex);
+    const CBlockIndex* pnext = chain->Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
@@ -145,8 +155,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleCli("getblockcount", "")
             + HelpExampleRpc("getblockcount", ""));
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainTipSnapshot()->nHeight;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -161,8 +170,7 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleCli("getbestblockhash", "")
             + HelpExampleRpc("getbestblockhash", ""));
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainTipSnapshot()->hashBlock.GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -177,8 +185,8 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
             + HelpExampleCli("getdifficulty", "")
             + HelpExampleRpc("getdifficulty", ""));
 
-    LOCK(cs_main);
-    return GetDifficulty();
+    boost::shared_ptr<const CChainTipSnapshot> chain = GetChainTipSnapshot();
+    return chain->pindexTip ? GetDifficulty(chain->pindexTip) : 1.0;
 }
 
 std::string EntryDescriptionString()
@@ -459,13 +467,13 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
             + HelpExampleCli("getblockhash", "1000")
             + HelpExampleRpc("getblockhash", "1000"));
 
-    LOCK(cs_main);
+    boost::shared_ptr<const CChainTipSnapshot> chain = GetChainTipSnapshot();
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > chain->nHeight)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    const CBlockIndex* pblockindex = (*chain)[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -502,8 +510,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             + HelpExampleCli("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\""));
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -511,11 +517,11 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    // Only the header fields and chain position are used, so cs_main is not needed beyond the lookup.
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
     if (!fVerbose) {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << pblockindex->GetBlockHeader();
@@ -526,6 +532,243 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+UniValue getblockfilter(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getblockfilter \"hash\" ( \"filtertype\" )\n"
+            "\nReturns the BIP158 compact filter of a block and its filter header. Requires -blockfilterindex.\n"
+            "\nArguments:\n"
+            "1. \"hash\"          (string, required) The block hash\n"
+            "2. \"filtertype\"    (string, optional, default=\"basic\") The type of filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"xxxx\",   (string) The hex encoded filter\n"
+            "  \"header\" : \"xxxx\"    (string) The hex encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\""));
+
+    uint256 hash(uint256S(params[0].get_str()));
+    BlockFilterType filterType = BLOCK_FILTER_BASIC;
+    if (params.size() > 1 && !BlockFilterTypeByName(params[1].get_str(), filterType))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+    if (!pblockfilterindex || pblockfilterindex->GetFilterType() != filterType)
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + BlockFilterTypeName(filterType));
+
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    BlockFilter filter;
+    uint256 header;
+    if (!pblockfilterindex->LookupFilter(pblockindex, filter) || !pblockfilterindex->LookupFilterHeader(pblockindex, header))
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not found. Block filters are still being indexed.");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+    ret.push_back(Pair("header", header.GetHex()));
+    return ret;
+}
+
+/** Script of an address, or the script itself given in hex */
+static CScript ScriptFromParam(const UniValue& param)
+{
+    const std::string& str = param.get_str();
+    CBitcoinAddress address(str);
+    if (address.IsValid())
+        return GetScriptForDestination(address.Get());
+    if (IsHex(str)) {
+        std::vector<unsigned char> data(ParseHex(str));
+        return CScript(data.begin(), data.end());
+    }
+    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address or script");
+}
+
+static size_t CountFromParam(const UniValue& param)
+{
+    int nCount = param.get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    return std::min((size_t)nCount, (size_t)MAX_SCRIPT_INDEX_RESULTS);
+}
+
+/** Cursor of the page following an entry: the hex encoded index key of the entry */
+template <typename K>
+static std::string EncodeCursor(const K& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+template <typename K>
+static K DecodeCursor(const UniValue& param)
+{
+    CDataStream ss(ParseHexV(param, "cursor"), SER_DISK, CLIENT_VERSION);
+    K key;
+    try {
+        ss >> key;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    if (!ss.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    return key;
+}
+
+/** Height the script index had reached when a query read it */
+static int IndexedHeight(const uint256& hashBest)
+{
+    const CBlockIndex* pindex = hashBest.IsNull() ? NULL : LookupBlockIndex(hashBest);
+    return pindex ? pindex->nHeight : -1;
+}
+
+UniValue getaddresshistory(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 5)
+        throw runtime_error(
+            "getaddresshistory \"address\" ( fromheight toheight count \"cursor\" )\n"
+            "\nReturns the payments to and spends from an address in the active chain, in height order. Requires -scriptindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string, required) The address, or a hex encoded output script\n"
+            "2. fromheight        (numeric, optional, default=0) The first height to include\n"
+            "3. toheight          (numeric, optional, default=the height indexed) The last height to include\n"
+            "4. count             (numeric, optional, default=" + strprintf("%u", MAX_SCRIPT_INDEX_RESULTS) + ") The most entries to return, at most " + strprintf("%u", MAX_SCRIPT_INDEX_RESULTS) + "\n"
+            "5. \"cursor\"        (string, optional) The \"next\" value of the previous page, to continue after it\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,        (numeric) The height the index is up to\n"
+            "  \"history\" : [\n"
+            "    {\n"
+            "      \"height\" : n,    (numeric) The height of the block holding the transaction\n"
+            "      \"txid\" : \"hash\", (string) The transaction id\n"
+            "      \"vout\" : n,      (numeric, payments only) The output paying the address\n"
+            "      \"vin\" : n,       (numeric, spends only) The input spending from the address\n"
+            "      \"value\" : x.xxx, (numeric) The amount paid or spent\n"
+            "      \"prevout\" : {    (json object, spends only) The output spent\n"
+            "        \"txid\" : \"hash\",\n"
+            "        \"vout\" : n,\n"
+            "        \"height\" : n\n"
+            "      }\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"next\" : \"cursor\"  (string, only if the page is full) The cursor of the next page\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresshistory", "\"GPSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\" 0 1000 100")
+            + HelpExampleRpc("getaddresshistory", "\"GPSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", 0, 1000, 100"));
+
+    if (!pscriptindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Script index is not enabled, use -scriptindex");
+
+    uint256 hashScript = ScriptIndexHash(ScriptFromParam(params[0]));
+    int nFromHeight = params.size() > 1 ? params[1].get_int() : 0;
+    int nToHeight = params.size() > 2 ? params[2].get_int() : std::numeric_limits<int>::max();
+    size_t nCount = params.size() > 3 ? CountFromParam(params[3]) : MAX_SCRIPT_INDEX_RESULTS;
+    CScriptHistoryKey keyAfter;
+    bool fAfter = params.size() > 4 && !params[4].isNull();
+    if (fAfter) {
+        keyAfter = DecodeCursor<CScriptHistoryKey>(params[4]);
+        if (keyAfter.hashScript != hashScript)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor is for another address");
+    }
+
+    // Read without cs_main, from a snapshot of the index.
+    uint256 hashBest;
+    std::vector<CScriptHistoryEntry> vEntries;
+    pscriptindex->GetHistory(hashScript, nFromHeight, nToHeight, fAfter ? &keyAfter : NULL, nCount, vEntries, hashBest);
+
+    UniValue history(UniValue::VARR);
+    for (std::vector<CScriptHistoryEntry>::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("height", it->nHeight));
+        entry.push_back(Pair("txid", it->txid.GetHex()));
+        entry.push_back(Pair(it->fSpend ? "vin" : "vout", (int64_t)it->n));
+        entry.push_back(Pair("value", ValueFromAmount(it->nValue)));
+        if (it->fSpend) {
+            UniValue prevout(UniValue::VOBJ);
+            prevout.push_back(Pair("txid", it->prevout.hash.GetHex()));
+            prevout.push_back(Pair("vout", (int64_t)it->prevout.n));
+            prevout.push_back(Pair("height", it->nPrevHeight));
+            entry.push_back(Pair("prevout", prevout));
+        }
+        history.push_back(entry);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", IndexedHeight(hashBest)));
+    ret.push_back(Pair("history", history));
+    if (nCount > 0 && vEntries.size() == nCount)
+        ret.push_back(Pair("next", EncodeCursor(CScriptHistoryKey(hashScript, vEntries.back()))));
+    return ret;
+}
+
+UniValue getaddressutxos(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddressutxos \"address\" ( count \"cursor\" )\n"
+            "\nReturns the unspent outputs of an address in the active chain. Requires -scriptindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string, required) The address, or a hex encoded output script\n"
+            "2. count             (numeric, optional, default=" + strprintf("%u", MAX_SCRIPT_INDEX_RESULTS) + ") The most outputs to return, at most " + strprintf("%u", MAX_SCRIPT_INDEX_RESULTS) + "\n"
+            "3. \"cursor\"        (string, optional) The \"next\" value of the previous page, to continue after it\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,        (numeric) The height the index is up to\n"
+            "  \"utxos\" : [\n"
+            "    {\n"
+            "      \"txid\" : \"hash\", (string) The transaction id\n"
+            "      \"vout\" : n,      (numeric) The output index\n"
+            "      \"height\" : n,    (numeric) The height of the block holding the transaction\n"
+            "      \"value\" : x.xxx  (numeric) The amount of the output\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"next\" : \"cursor\"  (string, only if the page is full) The cursor of the next page\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"GPSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\" 100")
+            + HelpExampleRpc("getaddressutxos", "\"GPSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", 100"));
+
+    if (!pscriptindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Script index is not enabled, use -scriptindex");
+
+    uint256 hashScript = ScriptIndexHash(ScriptFromParam(params[0]));
+    size_t nCount = params.size() > 1 ? CountFromParam(params[1]) : MAX_SCRIPT_INDEX_RESULTS;
+    std::pair<uint256, COutPoint> keyAfter;
+    bool fAfter = params.size() > 2 && !params[2].isNull();
+    if (fAfter) {
+        keyAfter = DecodeCursor<std::pair<uint256, COutPoint> >(params[2]);
+        if (keyAfter.first != hashScript)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor is for another address");
+    }
+
+    uint256 hashBest;
+    std::vector<CScriptUnspent> vUnspent;
+    pscriptindex->GetUnspent(hashScript, fAfter ? &keyAfter.second : NULL, nCount, vUnspent, hashBest);
+
+    UniValue utxos(UniValue::VARR);
+    for (std::vector<CScriptUnspent>::const_iterator it = vUnspent.begin(); it != vUnspent.end(); ++it) {
+        UniValue utxo(UniValue::VOBJ);
+        utxo.push_back(Pair("txid", it->out.hash.GetHex()));
+        utxo.push_back(Pair("vout", (int64_t)it->out.n));
+        utxo.push_back(Pair("height", it->nHeight));
+        utxo.push_back(Pair("value", ValueFromAmount(it->nValue)));
+        utxos.push_back(utxo);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", IndexedHeight(hashBest)));
+    ret.push_back(Pair("utxos", utxos));
+    if (nCount > 0 && vUnspent.size() == nCount)
+        ret.push_back(Pair("next", EncodeCursor(std::make_pair(hashScript, vUnspent.back().out))));
+    return ret;
+}
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -584,16 +827,17 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
-
     if (!fVerbose) {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        // The block is stored in its network serialisation, so it does not need decoding.
+        std::vector<unsigned char> vRawBlock;
+        if (!ReadRawBlockFromDisk(vRawBlock, pblockindex, Params().MessageStart()))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        return HexStr(vRawBlock.begin(), vRawBlock.end());
     }
 
+    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
     return blockToJSON(block, pblockindex);
 }
 
@@ -634,18 +878,15 @@ static bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats)
         CCoins coins;
         if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
             stats.nTransactions++;
-            ss << key;
+            UTXOSetHashAdd(ss, key, coins);
             for (unsigned int i = 0; i < coins.vout.size(); i++) {
                 const CTxOut& out = coins.vout[i];
                 if (!out.IsNull()) {
                     stats.nTransactionOutputs++;
-                    ss << VARINT(i + 1);
-                    ss << out;
                     nTotalAmount += out.nValue;
                 }
             }
             stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
         } else {
             return error("%s: unable to read value", __func__);
         }
@@ -670,7 +911,7 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash, as checked when loading a snapshot from dumptxoutset\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
@@ -693,6 +934,59 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set at the current tip to a file, which can be\n"
+            "passed to -loadutxosnapshot to bootstrap another node.\n"
+            "Only the current tip is supported: the coin database holds a single chainstate and\n"
+            "cannot be rewound to an earlier block.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\":n,                (numeric) The height of the block the snapshot was taken at\n"
+            "  \"bestblock\": \"hex\",        (string) The hash of that block\n"
+            "  \"transactions\": n,         (numeric) The number of transactions written\n"
+            "  \"hash_serialized\": \"hash\", (string) The hash of the set, as reported by gettxoutsetinfo\n"
+            "  \"path\": \"path\"             (string) The full path of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+
+    boost::filesystem::path path(params[0].get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    // The cursor reads a consistent view of the database, so only taking it needs the lock.
+    boost::scoped_ptr<CCoinsViewCursor> pcursor;
+    int nHeight;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsTip->Cursor());
+        nHeight = mapBlockIndex.find(pcursor->GetBestBlock())->second->nHeight;
+    }
+
+    CUTXOSnapshotInfo info;
+    if (!DumpUTXOSnapshot(pcursor.get(), path, Params(), info))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write UTXO snapshot, see debug.log for details");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", nHeight));
+    ret.push_back(Pair("bestblock", info.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)info.nTransactions));
+    ret.push_back(Pair("hash_serialized", info.hashSerialized.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -798,10 +1092,10 @@ UniValue verifychain(const UniValue& params, bool fHelp)
 }
 
 /** Implementation of IsSuperMajority with better feedback */
-static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
+static UniValue SoftForkMajorityDesc(int minVersion, const CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
 {
     int nFound = 0;
-    CBlockIndex* pstart = pindex;
+    const CBlockIndex* pstart = pindex;
     for (int i = 0; i < consensusParams.nMajorityWindow && pstart != NULL; i++) {
         if (pstart->nVersion >= minVersion)
             ++nFound;
@@ -816,7 +1110,7 @@ static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nR
     return rv;
 }
 
-static UniValue SoftForkDesc(const std::string& name, int version, CBlockIndex* pindex, const Consensus::Params& consensusParams)
+static UniValue SoftForkDesc(const std::string& name, int version, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     UniValue rv(UniValue::VOBJ);
     rv.push_back(Pair("id", name));
@@ -862,6 +1156,52 @@ void BIP9SoftForkDescPushBack(UniValue& bip9_softforks, const std::string& name,
         bip9_softforks.push_back(Pair(name, BIP9SoftForkDesc(consensusParams, id)));
 }
 
+/**
+ * The parts of getblockchaininfo that need cs_main, worked out once per tip.
+ * The prune height can lag behind by one block, as pruning does not move
+ * the tip.
+ */
+struct CTipStatusCache {
+    uint256 hashBlock;
+    UniValue bip9_softforks;
+    int nPruneHeight;
+
+    CTipStatusCache() : bip9_softforks(UniValue::VOBJ), nPruneHeight(0) {}
+};
+
+static boost::mutex csTipStatusCache;
+static CTipStatusCache tipStatusCache;
+
+static CTipStatusCache GetTipStatus(const uint256& hashTip)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csTipStatusCache);
+        if (!tipStatusCache.hashBlock.IsNull() && tipStatusCache.hashBlock == hashTip)
+            return tipStatusCache;
+    }
+
+    CTipStatusCache status;
+    {
+        LOCK(cs_main);
+        const Consensus::Params& consensusParams = Params().GetConsensus();
+        CBlockIndex* tip = chainActive.Tip();
+        if (tip)
+            status.hashBlock = tip->GetBlockHash();
+        BIP9SoftForkDescPushBack(status.bip9_softforks, "csv", consensusParams, Consensus::DEPLOYMENT_CSV);
+        BIP9SoftForkDescPushBack(status.bip9_softforks, "segwit", consensusParams, Consensus::DEPLOYMENT_SEGWIT);
+        if (fPruneMode && tip) {
+            CBlockIndex* block = tip;
+            while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+                block = block->pprev;
+            status.nPruneHeight = block->nHeight;
+        }
+    }
+
+    boost::unique_lock<boost::mutex> lock(csTipStatusCache);
+    tipStatusCache = status;
+    return status;
+}
+
 UniValue getblockchaininfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -906,38 +1246,32 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             + HelpExampleCli("getblockchaininfo", "")
             + HelpExampleRpc("getblockchaininfo", ""));
 
-    LOCK(cs_main);
+    boost::shared_ptr<const CChainTipSnapshot> chain = GetChainTipSnapshot();
+    if (!chain->pindexTip)
+        throw JSONRPCError(RPC_MISC_ERROR, "No active chain");
 
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("chain", Params().NetworkIDString()));
-    obj.push_back(Pair("blocks", (int)chainActive.Height()));
-    obj.push_back(Pair("headers", pindexBestHeader ? pindexBestHeader->nHeight : -1));
-    obj.push_back(Pair("bestblockhash", chainActive.Tip()->GetBlockHash().GetHex()));
-    obj.push_back(Pair("difficulty", (double)GetDifficulty()));
-    obj.push_back(Pair("mediantime", (int64_t)chainActive.Tip()->GetMedianTimePast(chainActive.Tip()->nHeight)));
-    obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(Params().Checkpoints(), chainActive.Tip())));
-    obj.push_back(Pair("chainwork", chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("blocks", chain->nHeight));
+    obj.push_back(Pair("headers", chain->pindexBestHeader ? chain->pindexBestHeader->nHeight : -1));
+    obj.push_back(Pair("bestblockhash", chain->hashBlock.GetHex()));
+    obj.push_back(Pair("difficulty", (double)GetDifficulty(chain->pindexTip)));
+    obj.push_back(Pair("mediantime", chain->nMedianTimePast));
+    obj.push_back(Pair("verificationprogress", chain->dVerificationProgress));
+    obj.push_back(Pair("chainwork", chain->nChainWork.GetHex()));
     obj.push_back(Pair("pruned", fPruneMode));
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
-    CBlockIndex* tip = chainActive.Tip();
+    CTipStatusCache status = GetTipStatus(chain->hashBlock);
     UniValue softforks(UniValue::VARR);
-    UniValue bip9_softforks(UniValue::VOBJ);
-    softforks.push_back(SoftForkDesc("bip34", 2, tip, consensusParams));
-    softforks.push_back(SoftForkDesc("bip66", 3, tip, consensusParams));
-    softforks.push_back(SoftForkDesc("bip65", 4, tip, consensusParams));
-    BIP9SoftForkDescPushBack(bip9_softforks, "csv", consensusParams, Consensus::DEPLOYMENT_CSV);
-    BIP9SoftForkDescPushBack(bip9_softforks, "segwit", consensusParams, Consensus::DEPLOYMENT_SEGWIT);
+    softforks.push_back(SoftForkDesc("bip34", 2, chain->pindexTip, consensusParams));
+    softforks.push_back(SoftForkDesc("bip66", 3, chain->pindexTip, consensusParams));
+    softforks.push_back(SoftForkDesc("bip65", 4, chain->pindexTip, consensusParams));
     obj.push_back(Pair("softforks", softforks));
-    obj.push_back(Pair("bip9_softforks", bip9_softforks));
-
-    if (fPruneMode) {
-        CBlockIndex* block = chainActive.Tip();
-        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
-            block = block->pprev;
+    obj.push_back(Pair("bip9_softforks", status.bip9_softforks));
 
-        obj.push_back(Pair("pruneheight", block->nHeight));
-    }
+    if (fPruneMode)
+        obj.push_back(Pair("pruneheight", status.nPruneHeight));
     return obj;
 }
 
@@ -1087,6 +1421,62 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the signature cache used during script verification.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx,            (numeric) Number of signatures the cache can hold\n"
+            "  \"bytes\": xxxxx,              (numeric) Memory allocated to the cache\n"
+            "  \"hits\": xxxxx,               (numeric) Signature checks answered from the cache since startup\n"
+            "  \"misses\": xxxxx,             (numeric) Signature checks not found in the cache since startup\n"
+            "  \"inserts\": xxxxx,            (numeric) Signatures added to the cache since startup\n"
+            "  \"evictions\": xxxxx           (numeric) Cached signatures dropped to make room for new ones\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", ""));
+
+    CSignatureCacheStats stats = GetSignatureCacheStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)stats.nEntries));
+    ret.push_back(Pair("bytes", (int64_t)stats.nBytes));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (int64_t)stats.nMisses));
+    ret.push_back(Pair("inserts", (int64_t)stats.nInserts));
+    ret.push_back(Pair("evictions", (int64_t)stats.nEvictions));
+    return ret;
+}
+
+UniValue getcoinsprefetchinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcoinsprefetchinfo\n"
+            "\nReturns details on the threads reading the coins spent by incoming blocks ahead of connecting them.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"requested\": xxxxx,          (numeric) Transactions whose coins were queued for reading since startup\n"
+            "  \"fetched\": xxxxx,            (numeric) Of those, found in the coin database\n"
+            "  \"added\": xxxxx,              (numeric) Added to the coins cache before their block was connected, each a database read saved there\n"
+            "  \"discarded\": xxxxx           (numeric) Read but not used, because they were cached already, the database was written or the buffer was full\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcoinsprefetchinfo", "")
+            + HelpExampleRpc("getcoinsprefetchinfo", ""));
+
+    CCoinsPrefetchStats stats = GetCoinsPrefetchStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("requested", (int64_t)stats.nRequested));
+    ret.push_back(Pair("fetched", (int64_t)stats.nFetched));
+    ret.push_back(Pair("added", (int64_t)stats.nAdded));
+    ret.push_back(Pair("discarded", (int64_t)stats.nDiscarded));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -1163,9 +1553,12 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 static const CRPCCommand commands[] = { //  category              name                      actor (function)         okSafeMode
 
     { "blockchain", "getblockchaininfo", &getblockchaininfo, true },
+    { "blockchain", "getaddresshistory", &getaddresshistory, true },
+    { "blockchain", "getaddressutxos", &getaddressutxos, true },
     { "blockchain", "getbestblockhash", &getbestblockhash, true },
     { "blockchain", "getblockcount", &getblockcount, true },
     { "blockchain", "getblock", &getblock, true },
+    { "blockchain", "getblockfilter", &getblockfilter, true },
     { "blockchain", "getblockhash", &getblockhash, true },
     { "blockchain", "getblockheader", &getblockheader, true },
     { "blockchain", "getchaintips", &getchaintips, true },
@@ -1175,8 +1568,11 @@ static const CRPCCommand commands[] = { //  category              name
     { "blockchain", "getmempoolentry", &getmempoolentry, true },
     { "blockchain", "getmempoolinfo", &getmempoolinfo, true },
     { "blockchain", "getrawmempool", &getrawmempool, true },
+    { "blockchain", "getsigcacheinfo", &getsigcacheinfo, true },
+    { "blockchain", "getcoinsprefetchinfo", &getcoinsprefetchinfo, true },
     { "blockchain", "gettxout", &gettxout, true },
     { "blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true },
+    { "blockchain", "dumptxoutset", &dumptxoutset, true },
     { "blockchain", "verifychain", &verifychain, true },
 
     /* Not shown in help */
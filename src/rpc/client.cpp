@@ -81,6 +81,10 @@ static const CRPCConvertParam vRPCConvertParams[] = {
     { "listunspent", 0 },
     { "listunspent", 1 },
     { "listunspent", 2 },
+    { "getaddresshistory", 1 },
+    { "getaddresshistory", 2 },
+    { "getaddresshistory", 3 },
+    { "getaddressutxos", 1 },
     { "getblock", 1 },
     { "getblockheader", 1 },
     { "gettransaction", 1 },
@@ -545,8 +545,6 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     static unsigned int nTransactionsUpdatedLast;
 
-    bool forceBlockUpdate = false;
-    static int64_t nStart;
     if (!lpval.isNull()) {
 
         uint256 hashWatchedChain;
@@ -568,8 +566,6 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         UpdateTime(&blockUpdatedLastLP, Params().GetConsensus(), chainActive.Tip());
         blockUpdatedLastLP.nBits = GetNextWorkRequired(chainActive.Tip(), &blockUpdatedLastLP, Params().GetConsensus());
 
-        forceBlockUpdate = false;
-
         LEAVE_CRITICAL_SECTION(cs_main);
         {
             checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
@@ -578,15 +574,11 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning()) {
                 if (!cvBlockChange.timed_wait(lock, checktxtime)) {
 
-                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP) {
-                        forceBlockUpdate = true;
+                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
                         break;
-                    }
                     UpdateTime(&blockUpdatedLastLP, Params().GetConsensus(), chainActive.Tip());
-                    if (GetNextWorkRequired(chainActive.Tip(), &blockUpdatedLastLP, Params().GetConsensus()) != blockUpdatedLastLP.nBits) {
-                        forceBlockUpdate = true;
+                    if (GetNextWorkRequired(chainActive.Tip(), &blockUpdatedLastLP, Params().GetConsensus()) != blockUpdatedLastLP.nBits)
                         break;
-                    }
                     checktxtime += boost::posix_time::seconds(10);
                 }
             }
@@ -595,39 +587,35 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
         if (!IsRPCRunning())
             throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
-
-    } else {
-        if (GetTime() - nStart > 20) {
-            forceBlockUpdate = true;
-        }
     }
 
-    static CBlockIndex* pindexPrev;
-    static CBlockTemplate* pblocktemplate;
-
-    if (forceBlockUpdate || pindexPrev != chainActive.Tip() || (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5)) {
-
-        pindexPrev = NULL;
-
+    // The template kept up to date in the background is shared between
+    // calls, so only its header is changed here. The tip may have moved
+    // while cs_main was released, so a template built on an older tip is
+    // dropped in favour of a fresh one.
+    unsigned int nTransactionsUpdatedKept = 0;
+    LEAVE_CRITICAL_SECTION(cs_main);
+    boost::shared_ptr<const CBlockTemplate> pblocktemplate = GetKeptBlockTemplate(nTransactionsUpdatedKept);
+    ENTER_CRITICAL_SECTION(cs_main);
+    if (pblocktemplate && pblocktemplate->block.hashPrevBlock != chainActive.Tip()->GetBlockHash())
+        pblocktemplate.reset();
+    if (pblocktemplate) {
+        nTransactionsUpdatedLast = nTransactionsUpdatedKept;
+    } else {
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        if (pblocktemplate) {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
+        pblocktemplate.reset(BlockAssembler(Params()).CreateNewBlock(scriptDummy));
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        pindexPrev = pindexPrevNew;
     }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+    const CBlock& block = pblocktemplate->block;
+    CBlockIndex* pindexPrev = mapBlockIndex.find(block.hashPrevBlock)->second;
+    CBlockHeader header = block.GetBlockHeader();
+    CBlockHeader* pblock = &header; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
     UpdateTime(pblock, consensusParams, pindexPrev);
+    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, consensusParams);
     pblock->nNonce = 0;
 
     const bool fPreSegWit = (THRESHOLD_ACTIVE != VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_SEGWIT, versionbitscache));
@@ -638,7 +626,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     UniValue transactions(UniValue::VARR);
     map<uint256, int64_t> setTxIndex;
     int i = 0;
-    BOOST_FOREACH (CTransaction& tx, pblock->vtx) {
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
         uint256 txHash = tx.GetHash();
         setTxIndex[txHash] = i++;
 
@@ -737,7 +725,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
     result.push_back(Pair("transactions", transactions));
     result.push_back(Pair("coinbaseaux", aux));
-    result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
+    result.push_back(Pair("coinbasevalue", (int64_t)block.vtx[0].vout[0].nValue));
     result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
     result.push_back(Pair("target", hashTarget.GetHex()));
     result.push_back(Pair("mintime", (int64_t)std::max(pindexPrev->GetMedianTimePast(pindexPrev->nHeight) + 1, GetTime())));
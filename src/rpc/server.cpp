@@ -394,6 +394,127 @@ std::string JSONRPCExecBatch(const UniValue& vReq)
     return ret.write() + "\n";
 }
 
+/**
+ * Calls that only read state and take their own locks, so they can be run
+ * concurrently with each other.
+ */
+static const char* vRPCReadOnly[] =
+{
+    "getblockchaininfo",
+    "getbestblockhash",
+    "getblockcount",
+    "getblock",
+    "getblockhash",
+    "getblockheader",
+    "getchaintips",
+    "getdifficulty",
+    "getmempoolancestors",
+    "getmempooldescendants",
+    "getmempoolentry",
+    "getmempoolinfo",
+    "getrawmempool",
+    "getsigcacheinfo",
+    "getcoinsprefetchinfo",
+    "gettxout",
+    "getrawtransaction",
+    "createrawtransaction",
+    "decoderawtransaction",
+    "decodescript",
+    "gettxoutproof",
+    "verifytxoutproof",
+    "getconnectioncount",
+    "getpeerinfo",
+    "getaddednodeinfo",
+    "getnettotals",
+    "getnetworkinfo",
+    "listbanned",
+    "validateaddress",
+    "createmultisig",
+    "verifymessage",
+};
+
+bool IsRPCReadOnly(const std::string& strMethod)
+{
+    for (unsigned int i = 0; i < ARRAYLEN(vRPCReadOnly); i++)
+        if (strMethod == vRPCReadOnly[i])
+            return true;
+    return false;
+}
+
+static bool IsReadOnlyRequest(const UniValue& req)
+{
+    if (!req.isObject())
+        return true; // only produces an error reply
+    const UniValue& method = find_value(req.get_obj(), "method");
+    return !method.isStr() || IsRPCReadOnly(method.get_str());
+}
+
+JSONRPCBatch::JSONRPCBatch(const UniValue& vReqIn, const Writer& writerIn)
+    : vReq(vReqIn)
+    , vReply(vReqIn.size())
+    , vDone(vReqIn.size(), false)
+    , nNext(0)
+    , nWritten(0)
+    , nRunning(0)
+    , fExclusive(false)
+    , writer(writerIn)
+{
+}
+
+void JSONRPCBatch::WriteDone()
+{
+    // Called with the lock held, so pieces reach the writer in order.
+    std::string strPiece;
+    while (nWritten < vReply.size() && vDone[nWritten]) {
+        strPiece += nWritten == 0 ? "[" : ",";
+        strPiece += vReply[nWritten];
+        std::string().swap(vReply[nWritten]);
+        nWritten++;
+    }
+    if (!strPiece.empty())
+        writer(strPiece);
+}
+
+void JSONRPCBatch::Work()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (fExclusive && nNext < vReply.size())
+            cond.wait(lock);
+        if (nNext >= vReply.size())
+            break;
+        size_t nReq = nNext++;
+        bool fAlone = !IsReadOnlyRequest(vReq[nReq]);
+        if (fAlone) {
+            fExclusive = true;
+            while (nRunning > 0)
+                cond.wait(lock);
+        }
+        nRunning++;
+
+        lock.unlock();
+        std::string strReply = JSONRPCExecOne(vReq[nReq]).write();
+        lock.lock();
+
+        nRunning--;
+        if (fAlone)
+            fExclusive = false;
+        vReply[nReq].swap(strReply);
+        vDone[nReq] = true;
+        WriteDone();
+        cond.notify_all();
+    }
+}
+
+void JSONRPCBatch::Wait()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (nWritten < vReply.size())
+        cond.wait(lock);
+    writer(vReply.empty() ? "[]\n" : "]\n");
+    writer = Writer();
+}
+
 UniValue CRPCTable::execute(const std::string& strMethod, const UniValue& params) const
 {
 
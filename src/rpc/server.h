@@ -21,8 +21,11 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <univalue.h>
 
@@ -206,4 +209,48 @@ void InterruptRPC();
 void StopRPC();
 std::string JSONRPCExecBatch(const UniValue& vReq);
 
+/** Whether a call only reads state, so that it may run alongside other calls of a batch */
+bool IsRPCReadOnly(const std::string& strMethod);
+
+/**
+ * Executes the requests of a JSON-RPC batch, from as many threads as call
+ * Work(), and hands the reply array to a writer in pieces as the replies
+ * become available, in request order.
+ *
+ * Read-only calls run concurrently. Any other call waits for the calls before
+ * it to finish and runs alone, so a batch that changes state sees the same
+ * results as when its requests are executed one by one.
+ */
+class JSONRPCBatch
+{
+public:
+    typedef boost::function<void(const std::string&)> Writer;
+
+    JSONRPCBatch(const UniValue& vReqIn, const Writer& writerIn);
+
+    //! Execute requests until none are left to start. May be called from any number of threads.
+    void Work();
+
+    //! Wait until every reply is written and close the array. The writer is not used afterwards.
+    void Wait();
+
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    UniValue vReq;
+    std::vector<std::string> vReply;
+    std::vector<bool> vDone;
+    //! Next request to start
+    size_t nNext;
+    //! Number of replies written so far
+    size_t nWritten;
+    //! Number of requests executing
+    int nRunning;
+    //! Set while a call that is not read-only waits for or holds the batch
+    bool fExclusive;
+    Writer writer;
+
+    void WriteDone();
+};
+
 #endif // BITCOIN_RPCSERVER_H
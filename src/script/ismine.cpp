@@ -44,17 +44,8 @@ isminetype IsMine(const CKeyStore& keystore, const CTxDestination& dest)
 
 isminetype RemoveAddressFromKeypoolIfIsMine(CWallet& wallet, const CTxDestination& dest, uint64_t time)
 {
-    LOCK(wallet.cs_wallet);
-
-    isminetype ret = isminetype::ISMINE_NO;
-    for (const auto& accountItem : wallet.mapAccounts) {
-        for (auto keyChain : { KEYCHAIN_EXTERNAL, KEYCHAIN_CHANGE }) {
-            isminetype temp = (keyChain == KEYCHAIN_EXTERNAL ? RemoveAddressFromKeypoolIfIsMine(wallet, accountItem.second->externalKeyStore, dest, time) : RemoveAddressFromKeypoolIfIsMine(wallet, accountItem.second->internalKeyStore, dest, time));
-            if (temp > ret)
-                ret = temp;
-        }
-    }
-    return ret;
+    CScript script = GetScriptForDestination(dest);
+    return RemoveAddressFromKeypoolIfIsMine(wallet, script, time);
 }
 
 isminetype RemoveAddressFromKeypoolIfIsMine(CWallet& wallet, const CKeyStore& keystore, const CTxDestination& dest, uint64_t time)
@@ -75,17 +66,7 @@ isminetype RemoveAddressFromKeypoolIfIsMine(CWallet& wallet, const CKeyStore& ke
 
 isminetype RemoveAddressFromKeypoolIfIsMine(CWallet& wallet, const CTxOut& txout, uint64_t time)
 {
-    LOCK(wallet.cs_wallet);
-
-    isminetype ret = isminetype::ISMINE_NO;
-    for (const auto& accountItem : wallet.mapAccounts) {
-        for (auto keyChain : { KEYCHAIN_EXTERNAL, KEYCHAIN_CHANGE }) {
-            isminetype temp = (keyChain == KEYCHAIN_EXTERNAL ? RemoveAddressFromKeypoolIfIsMine(wallet, accountItem.second->externalKeyStore, txout, time) : RemoveAddressFromKeypoolIfIsMine(wallet, accountItem.second->internalKeyStore, txout, time));
-            if (temp > ret)
-                ret = temp;
-        }
-    }
-    return ret;
+    return RemoveAddressFromKeypoolIfIsMine(wallet, txout.scriptPubKey, time);
 }
 
 isminetype IsMine(const CKeyStore& keystore, const CScript& scriptPubKey)
@@ -158,10 +139,13 @@ isminetype RemoveAddressFromKeypoolIfIsMine(CWallet& wallet, const CScript& scri
 {
     LOCK(wallet.cs_wallet);
 
+    std::set<CAccount*> setOwners;
+    wallet.GetScriptOwners(scriptPubKey, setOwners);
+
     isminetype ret = isminetype::ISMINE_NO;
-    for (const auto& accountItem : wallet.mapAccounts) {
+    for (const auto& account : setOwners) {
         for (auto keyChain : { KEYCHAIN_EXTERNAL, KEYCHAIN_CHANGE }) {
-            isminetype temp = (keyChain == KEYCHAIN_EXTERNAL ? RemoveAddressFromKeypoolIfIsMine(wallet, accountItem.second->externalKeyStore, scriptPubKey, time) : RemoveAddressFromKeypoolIfIsMine(wallet, accountItem.second->internalKeyStore, scriptPubKey, time));
+            isminetype temp = (keyChain == KEYCHAIN_EXTERNAL ? RemoveAddressFromKeypoolIfIsMine(wallet, account->externalKeyStore, scriptPubKey, time) : RemoveAddressFromKeypoolIfIsMine(wallet, account->internalKeyStore, scriptPubKey, time));
             if (temp > ret)
                 ret = temp;
         }
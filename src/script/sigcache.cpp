@@ -5,43 +5,48 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <atomic>
+
 #include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
 
 namespace {
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher {
-public:
-    size_t operator()(const uint256& key) const
-    {
-        return key.GetCheapHash();
-    }
-};
-
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Lookups and erasures only take the lock shared, so the script check threads
+ * do not serialise on each other; erasure just flags the slot, which the next
+ * insert may reuse.
  */
 class CSignatureCache {
 private:
+    //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
     map_type setValid;
     boost::shared_mutex cs_sigcache;
+    uint32_t nEntries;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+    std::atomic<uint64_t> nInserts;
+    std::atomic<uint64_t> nEvictions;
 
 public:
     CSignatureCache()
+        : nEntries(0)
+        , nHits(0)
+        , nMisses(0)
+        , nInserts(0)
+        , nEvictions(0)
     {
         GetRandBytes(nonce.begin(), 32);
     }
@@ -53,57 +58,104 @@ public:
     }
 
     bool
-    Get(const uint256& entry)
+    Get(const uint256& entry, const bool erase)
     {
         boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+        if (nEntries > 0 && setValid.contains(entry, erase)) {
+            nHits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        nMisses.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
 
-    void Erase(const uint256& entry)
+    void Set(const uint256& entry)
     {
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        if (nEntries == 0)
+            return;
+        nInserts.fetch_add(1, std::memory_order_relaxed);
+        if (!setValid.insert(entry))
+            nEvictions.fetch_add(1, std::memory_order_relaxed);
     }
 
-    void Set(const uint256& entry)
+    void Erase(const uint256& entry)
     {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t)1 << 20);
-        if (nMaxCacheSize <= 0)
-            return;
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        if (nEntries > 0)
+            setValid.contains(entry, true);
+    }
 
+    uint32_t setup_bytes(size_t n)
+    {
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize) {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
+        nEntries = n > 0 ? setValid.setup_bytes(n) : 0;
+        return nEntries;
+    }
 
-        setValid.insert(entry);
+    CSignatureCacheStats GetStats()
+    {
+        CSignatureCacheStats stats;
+        stats.nEntries = nEntries;
+        stats.nBytes = (uint64_t)nEntries * sizeof(uint256);
+        stats.nHits = nHits.load(std::memory_order_relaxed);
+        stats.nMisses = nMisses.load(std::memory_order_relaxed);
+        stats.nInserts = nInserts.load(std::memory_order_relaxed);
+        stats.nEvictions = nEvictions.load(std::memory_order_relaxed);
+        return stats;
     }
 };
+
+/* In previous versions of this code, signatureCache was a local static variable
+ * in CachingTransactionSignatureChecker::VerifySignature. We initialize
+ * signatureCache outside of VerifySignature to avoid the atomic operation per
+ * call overhead associated with local static variables even though
+ * signatureCache could be made local to VerifySignature.
+*/
+static CSignatureCache signatureCache;
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+// To be called once in AppInit2/TestingSetup to initialize the signatureCache
+void InitSignatureCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t)1 << 20);
+    uint32_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to store %zu elements\n",
+              (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+}
+
+CSignatureCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
+}
+
+void AddSignatureCacheEntries(const std::vector<uint256>& vEntries)
+{
+    for (const uint256& entry : vEntries)
+        signatureCache.Set(entry);
+}
+
+void EraseSignatureCacheEntries(const std::vector<uint256>& vEntries)
 {
-    static CSignatureCache signatureCache;
+    for (const uint256& entry : vEntries)
+        signatureCache.Erase(entry);
+}
 
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    if (signatureCache.Get(entry, !store && !pvEntries))
         return true;
-    }
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store) {
         signatureCache.Set(entry);
+    } else if (pvEntries) {
+        pvEntries->push_back(entry);
     }
     return true;
 }
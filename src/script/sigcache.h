@@ -8,26 +8,70 @@
 
 #include "script/interpreter.h"
 
+#include <cstring>
 #include <vector>
 
 // DoS prevention: limit cache size to less than 40MB (over 500000
 // entries on 64-bit systems).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Maximum sig cache size allowed
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
 
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ *
+ * This may exhibit platform endian dependent behavior but because these are
+ * nonced hashes (random) and this state is only ever used locally it is safe.
+ * All that matters is local consistency.
+ */
+class SignatureCacheHasher {
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "SignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+/** Counters of the signature cache since startup */
+struct CSignatureCacheStats {
+    uint64_t nEntries;
+    uint64_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker {
 private:
     bool store;
+    //! If set, signatures verified here are collected in it instead of going to the cache (see AddSignatureCacheEntries)
+    std::vector<uint256>* pvEntries;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, PrecomputedTransactionData& txdataIn)
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, PrecomputedTransactionData& txdataIn, std::vector<uint256>* pvEntriesIn = NULL)
         : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn)
         , store(storeIn)
+        , pvEntries(pvEntriesIn)
     {
     }
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Size the signature cache from -maxsigcachesize; must be called before any script is verified. */
+void InitSignatureCache();
+CSignatureCacheStats GetSignatureCacheStats();
+/** Add entries collected by a CachingTransactionSignatureChecker to the signature cache. */
+void AddSignatureCacheEntries(const std::vector<uint256>& vEntries);
+/** Mark entries added with AddSignatureCacheEntries to be evicted first, as is done with entries used by a block. */
+void EraseSignatureCacheEntries(const std::vector<uint256>& vEntries);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
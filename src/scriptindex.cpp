@@ -0,0 +1,315 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "scriptindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "crypto/sha256.h"
+#include "main.h"
+#include "script/script.h"
+#include "undo.h"
+#include "util.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+static const char DB_HISTORY = 'h';
+static const char DB_UNSPENT = 'u';
+static const char DB_BEST_BLOCK = 'B';
+
+CScriptIndex* pscriptindex = NULL;
+
+uint256 ScriptIndexHash(const CScript& script)
+{
+    uint256 hash;
+    CSHA256().Write(script.empty() ? NULL : &script[0], script.size()).Finalize(hash.begin());
+    return hash;
+}
+
+CScriptIndex::CScriptIndex(size_t nCacheSize, bool fMemory, bool fWipe)
+    : db(GetDataDir() / "scriptindex", nCacheSize, fMemory, fWipe)
+    , pindexBest(NULL)
+{
+}
+
+const CBlockIndex* CScriptIndex::GetBestBlock() const
+{
+    AssertLockHeld(cs_main);
+    return pindexBest;
+}
+
+bool CScriptIndex::WriteBlock(CDBBatch& batch, const CBlock& block, int nHeight, const CBlockUndo& blockundo, const std::vector<int>* pvPrevHeights, UnspentHeightMap* pmapAdded)
+{
+    size_t nInput = 0;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        const uint256& txid = tx.GetHash();
+
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const COutPoint& prevout = tx.vin[j].prevout;
+                const CTxOut& txout = txundo.vprevout[j].txout;
+                uint256 hashScript = ScriptIndexHash(txout.scriptPubKey);
+
+                CScriptHistoryValue value;
+                value.nValue = txout.nValue;
+                value.prevout = prevout;
+                if (pvPrevHeights) {
+                    value.nPrevHeight = (*pvPrevHeights)[nInput++];
+                } else {
+                    UnspentHeightMap::const_iterator it = pmapAdded->find(std::make_pair(hashScript, prevout));
+                    CScriptUnspentValue unspent;
+                    if (it != pmapAdded->end())
+                        value.nPrevHeight = it->second;
+                    else if (db.Read(std::make_pair(DB_UNSPENT, std::make_pair(hashScript, prevout)), unspent))
+                        value.nPrevHeight = unspent.nHeight;
+                    else
+                        return error("%s: output %s spent at height %d is not indexed", __func__, prevout.ToString(), nHeight);
+                }
+                batch.Write(std::make_pair(DB_HISTORY, CScriptHistoryKey(hashScript, nHeight, txid, j, true)), value);
+                batch.Erase(std::make_pair(DB_UNSPENT, std::make_pair(hashScript, prevout)));
+            }
+        }
+
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& txout = tx.vout[j];
+            if (txout.scriptPubKey.IsUnspendable())
+                continue;
+            uint256 hashScript = ScriptIndexHash(txout.scriptPubKey);
+
+            CScriptHistoryValue value;
+            value.nValue = txout.nValue;
+            batch.Write(std::make_pair(DB_HISTORY, CScriptHistoryKey(hashScript, nHeight, txid, j, false)), value);
+
+            CScriptUnspentValue unspent;
+            unspent.nValue = txout.nValue;
+            unspent.nHeight = nHeight;
+            batch.Write(std::make_pair(DB_UNSPENT, std::make_pair(hashScript, COutPoint(txid, j))), unspent);
+            if (pmapAdded)
+                (*pmapAdded)[std::make_pair(hashScript, COutPoint(txid, j))] = nHeight;
+        }
+    }
+    return true;
+}
+
+bool CScriptIndex::EraseBlock(CDBBatch& batch, const CBlock& block, int nHeight, const CBlockUndo& blockundo)
+{
+    for (size_t i = block.vtx.size(); i-- > 0;) {
+        const CTransaction& tx = block.vtx[i];
+        const uint256& txid = tx.GetHash();
+
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& txout = tx.vout[j];
+            if (txout.scriptPubKey.IsUnspendable())
+                continue;
+            uint256 hashScript = ScriptIndexHash(txout.scriptPubKey);
+            batch.Erase(std::make_pair(DB_HISTORY, CScriptHistoryKey(hashScript, nHeight, txid, j, false)));
+            batch.Erase(std::make_pair(DB_UNSPENT, std::make_pair(hashScript, COutPoint(txid, j))));
+        }
+
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const CTxOut& txout = txundo.vprevout[j].txout;
+                uint256 hashScript = ScriptIndexHash(txout.scriptPubKey);
+                CScriptHistoryKey key(hashScript, nHeight, txid, j, true);
+
+                // The spend remembers the height of the output, which the undo data may not have.
+                CScriptHistoryValue value;
+                if (!db.Read(std::make_pair(DB_HISTORY, key), value))
+                    return error("%s: spend %s:%u at height %d is not indexed", __func__, txid.ToString(), j, nHeight);
+                batch.Erase(std::make_pair(DB_HISTORY, key));
+
+                CScriptUnspentValue unspent;
+                unspent.nValue = value.nValue;
+                unspent.nHeight = value.nPrevHeight;
+                batch.Write(std::make_pair(DB_UNSPENT, std::make_pair(hashScript, value.prevout)), unspent);
+            }
+        }
+    }
+    return true;
+}
+
+bool CScriptIndex::Init()
+{
+    AssertLockHeld(cs_main);
+    uint256 hashBest;
+    if (!db.Read(DB_BEST_BLOCK, hashBest))
+        return true;
+    BlockMap::iterator it = mapBlockIndex.find(hashBest);
+    if (it == mapBlockIndex.end())
+        return error("%s: best block %s of the script index is not known", __func__, hashBest.ToString());
+    pindexBest = it->second;
+
+    // Written blocks go to the index at once, but the chainstate may lag behind it after a crash.
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    while (pindexBest && !chainActive.Contains(pindexBest)) {
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindexBest, consensusParams))
+            return error("%s: failed to read block %s", __func__, pindexBest->GetBlockHash().ToString());
+        if (pindexBest->pprev && !UndoReadFromDisk(blockundo, pindexBest->GetUndoPos(), pindexBest->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data of block %s", __func__, pindexBest->GetBlockHash().ToString());
+        if (!DisconnectBlock(block, pindexBest, blockundo))
+            return false;
+    }
+    return true;
+}
+
+bool CScriptIndex::ConnectBlock(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo, const std::vector<int>& vPrevHeights)
+{
+    AssertLockHeld(cs_main);
+    if (!pindexBest || pindex->pprev != pindexBest)
+        return true;
+    CDBBatch batch(db);
+    if (!WriteBlock(batch, block, pindex->nHeight, blockundo, &vPrevHeights, NULL))
+        return false;
+    batch.Write(DB_BEST_BLOCK, pindex->GetBlockHash());
+    if (!db.WriteBatch(batch))
+        return false;
+    pindexBest = pindex;
+    return true;
+}
+
+bool CScriptIndex::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo)
+{
+    AssertLockHeld(cs_main);
+    if (pindex != pindexBest)
+        return true;
+    CDBBatch batch(db);
+    if (!EraseBlock(batch, block, pindex->nHeight, blockundo))
+        return false;
+    if (pindex->pprev)
+        batch.Write(DB_BEST_BLOCK, pindex->pprev->GetBlockHash());
+    else
+        batch.Erase(DB_BEST_BLOCK);
+    if (!db.WriteBatch(batch))
+        return false;
+    pindexBest = pindex->pprev;
+    return true;
+}
+
+bool CScriptIndex::Sync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        std::vector<const CBlockIndex*> vBlocks;
+        std::vector<CDiskBlockPos> vUndoPos;
+        const CBlockIndex* pindexStart;
+        {
+            LOCK(cs_main);
+            pindexStart = pindexBest;
+            for (int nHeight = pindexStart ? pindexStart->nHeight + 1 : 0; nHeight <= chainActive.Height() && vBlocks.size() < SCRIPT_INDEX_BATCH_SIZE; nHeight++) {
+                const CBlockIndex* pindex = chainActive[nHeight];
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (pindex->pprev && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                    return error("%s: block %s at height %d is not available", __func__, pindex->GetBlockHash().ToString(), nHeight);
+                vBlocks.push_back(pindex);
+                vUndoPos.push_back(pindex->GetUndoPos());
+            }
+            if (vBlocks.empty())
+                return true;
+        }
+
+        // Nothing else writes while the index is behind, so the batch can be built without cs_main.
+        CDBBatch batch(db);
+        UnspentHeightMap mapAdded;
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            const CBlockIndex* pindex = vBlocks[i];
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, consensusParams))
+                return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+            CBlockUndo blockundo;
+            if (pindex->pprev && !UndoReadFromDisk(blockundo, vUndoPos[i], pindex->pprev->GetBlockHash()))
+                return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+            if (!WriteBlock(batch, block, pindex->nHeight, blockundo, NULL, &mapAdded))
+                return false;
+            boost::this_thread::interruption_point();
+        }
+
+        LOCK(cs_main);
+        // A reorganisation past the start of the batch disconnected blocks the batch builds on; start over from there.
+        if (pindexBest != pindexStart || !chainActive.Contains(vBlocks.back()))
+            continue;
+        batch.Write(DB_BEST_BLOCK, vBlocks.back()->GetBlockHash());
+        if (!db.WriteBatch(batch))
+            return error("%s: failed to write the script index", __func__);
+        pindexBest = vBlocks.back();
+        LogPrint("scriptindex", "Script index built up to height %d\n", pindexBest->nHeight);
+    }
+}
+
+void CScriptIndex::ThreadSync()
+{
+    if (Sync())
+        LogPrintf("Script index is up to date\n");
+    else
+        LogPrintf("%s: stopped building the script index\n", __func__);
+}
+
+/** Best block of the view of the database that pcursor reads */
+static uint256 ReadBestBlock(CDBIterator* pcursor)
+{
+    uint256 hashBest;
+    char chKey;
+    pcursor->Seek(DB_BEST_BLOCK);
+    if (!pcursor->Valid() || pcursor->GetKeySize() != 1 || !pcursor->GetKey(chKey) || chKey != DB_BEST_BLOCK || !pcursor->GetValue(hashBest))
+        return uint256();
+    return hashBest;
+}
+
+void CScriptIndex::GetHistory(const uint256& hashScript, int nFromHeight, int nToHeight, const CScriptHistoryKey* pAfter, size_t nCount, std::vector<CScriptHistoryEntry>& vEntries, uint256& hashBest) const
+{
+    // A LevelDB iterator reads a snapshot, so the entries match the best block even while blocks are written.
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    hashBest = ReadBestBlock(pcursor.get());
+    if (pAfter && pAfter->nHeight >= nFromHeight)
+        pcursor->Seek(std::make_pair(DB_HISTORY, *pAfter));
+    else
+        pcursor->Seek(std::make_pair(DB_HISTORY, CScriptHistoryKey(hashScript, std::max(nFromHeight, 0), uint256(), 0, false)));
+    for (; pcursor->Valid() && vEntries.size() < nCount; pcursor->Next()) {
+        std::pair<char, CScriptHistoryKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_HISTORY || key.second.hashScript != hashScript || key.second.nHeight > nToHeight)
+            break;
+        if (pAfter && key.second == *pAfter)
+            continue;
+        CScriptHistoryValue value;
+        if (!pcursor->GetValue(value))
+            break;
+        CScriptHistoryEntry entry;
+        entry.nHeight = key.second.nHeight;
+        entry.txid = key.second.txid;
+        entry.n = key.second.n;
+        entry.fSpend = key.second.fSpend;
+        entry.nValue = value.nValue;
+        entry.prevout = value.prevout;
+        entry.nPrevHeight = value.nPrevHeight;
+        vEntries.push_back(entry);
+    }
+}
+
+void CScriptIndex::GetUnspent(const uint256& hashScript, const COutPoint* pAfter, size_t nCount, std::vector<CScriptUnspent>& vUnspent, uint256& hashBest) const
+{
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    hashBest = ReadBestBlock(pcursor.get());
+    pcursor->Seek(std::make_pair(DB_UNSPENT, std::make_pair(hashScript, pAfter ? *pAfter : COutPoint(uint256(), 0))));
+    for (; pcursor->Valid() && vUnspent.size() < nCount; pcursor->Next()) {
+        std::pair<char, std::pair<uint256, COutPoint> > key;
+        if (!pcursor->GetKey(key) || key.first != DB_UNSPENT || key.second.first != hashScript)
+            break;
+        if (pAfter && key.second.second == *pAfter)
+            continue;
+        CScriptUnspentValue value;
+        if (!pcursor->GetValue(value))
+            break;
+        CScriptUnspent unspent;
+        unspent.out = key.second.second;
+        unspent.nHeight = value.nHeight;
+        unspent.nValue = value.nValue;
+        vUnspent.push_back(unspent);
+    }
+}
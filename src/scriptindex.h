@@ -0,0 +1,223 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SCRIPTINDEX_H
+#define BITCOIN_SCRIPTINDEX_H
+
+#include "amount.h"
+#include "crypto/common.h"
+#include "dbwrapper.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+class CScript;
+
+static const bool DEFAULT_SCRIPTINDEX = false;
+/** Largest database cache of the script index, in MiB */
+static const int64_t nMaxScriptIndexDBCache = 256;
+/** Blocks indexed per database batch while catching up with the chain */
+static const unsigned int SCRIPT_INDEX_BATCH_SIZE = 1000;
+/** Most entries returned by one query */
+static const unsigned int MAX_SCRIPT_INDEX_RESULTS = 1000;
+
+/** Key of a script in the index: the single SHA-256 of the scriptPubKey, as Electrum servers use */
+uint256 ScriptIndexHash(const CScript& script);
+
+/** One payment to or from a script */
+struct CScriptHistoryEntry {
+    int nHeight;
+    //! The transaction paying to the script, or spending from it
+    uint256 txid;
+    //! Output index for a payment, input index for a spend
+    uint32_t n;
+    bool fSpend;
+    CAmount nValue;
+    //! For a spend, the output spent and the height it was created at
+    COutPoint prevout;
+    int nPrevHeight;
+
+    CScriptHistoryEntry() : nHeight(0), n(0), fSpend(false), nValue(0), nPrevHeight(0) {}
+};
+
+/** An unspent output paying to a script */
+struct CScriptUnspent {
+    COutPoint out;
+    int nHeight;
+    CAmount nValue;
+
+    CScriptUnspent() : nHeight(0), nValue(0) {}
+};
+
+/**
+ * Database key of a history entry. The height is stored big endian so that
+ * the entries of a script are sorted by height and a height range is one
+ * contiguous scan.
+ */
+struct CScriptHistoryKey {
+    uint256 hashScript;
+    int nHeight;
+    uint256 txid;
+    uint32_t n;
+    bool fSpend;
+
+    CScriptHistoryKey() : nHeight(0), n(0), fSpend(false) {}
+    CScriptHistoryKey(const uint256& hashScriptIn, int nHeightIn, const uint256& txidIn, uint32_t nIn, bool fSpendIn)
+        : hashScript(hashScriptIn), nHeight(nHeightIn), txid(txidIn), n(nIn), fSpend(fSpendIn) {}
+    CScriptHistoryKey(const uint256& hashScriptIn, const CScriptHistoryEntry& entry)
+        : hashScript(hashScriptIn), nHeight(entry.nHeight), txid(entry.txid), n(entry.n), fSpend(entry.fSpend) {}
+
+    friend bool operator==(const CScriptHistoryKey& a, const CScriptHistoryKey& b)
+    {
+        return a.hashScript == b.hashScript && a.nHeight == b.nHeight && a.txid == b.txid && a.n == b.n && a.fSpend == b.fSpend;
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 32 + 4 + 32 + 4 + 1;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        unsigned char vchHeight[4];
+        WriteBE32(vchHeight, nHeight);
+        ::Serialize(s, hashScript, nType, nVersion);
+        s.write((const char*)vchHeight, sizeof(vchHeight));
+        ::Serialize(s, txid, nType, nVersion);
+        ::Serialize(s, n, nType, nVersion);
+        ::Serialize(s, fSpend, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned char vchHeight[4];
+        ::Unserialize(s, hashScript, nType, nVersion);
+        s.read((char*)vchHeight, sizeof(vchHeight));
+        nHeight = ReadBE32(vchHeight);
+        ::Unserialize(s, txid, nType, nVersion);
+        ::Unserialize(s, n, nType, nVersion);
+        ::Unserialize(s, fSpend, nType, nVersion);
+    }
+};
+
+/** Database value of a history entry */
+struct CScriptHistoryValue {
+    CAmount nValue;
+    COutPoint prevout;
+    int nPrevHeight;
+
+    CScriptHistoryValue() : nValue(0), nPrevHeight(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nValue);
+        READWRITE(prevout);
+        READWRITE(nPrevHeight);
+    }
+};
+
+/** Database value of an unspent output */
+struct CScriptUnspentValue {
+    CAmount nValue;
+    int nHeight;
+
+    CScriptUnspentValue() : nValue(0), nHeight(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nValue);
+        READWRITE(nHeight);
+    }
+};
+
+/**
+ * Index of every payment to and spend from each output script of the active
+ * chain, and of the outputs of each script that are still unspent, kept in
+ * scriptindex/. Turns "everything about this address" into a range scan.
+ *
+ * Once caught up the index is written by ConnectBlock and DisconnectBlock,
+ * in one batch per block. Until then a background thread builds it from the
+ * block and undo files; the blocks it has not reached yet are skipped by
+ * ConnectBlock. The best block is only changed with cs_main held, so it is
+ * always part of the active chain when cs_main is released.
+ */
+class CScriptIndex
+{
+private:
+    typedef std::map<std::pair<uint256, COutPoint>, int> UnspentHeightMap;
+
+    CDBWrapper db;
+    //! Last block indexed, guarded by cs_main
+    const CBlockIndex* pindexBest;
+
+    /**
+     * Queue the entries of a block. The heights of the outputs it spends are
+     * taken from pvPrevHeights, in input order, or if that is NULL looked up
+     * in the index and in pmapAdded, which collects the outputs added by the
+     * batch.
+     */
+    bool WriteBlock(CDBBatch& batch, const CBlock& block, int nHeight, const CBlockUndo& blockundo, const std::vector<int>* pvPrevHeights, UnspentHeightMap* pmapAdded);
+    //! Queue the removal of the entries of a block, restoring the outputs it spent
+    bool EraseBlock(CDBBatch& batch, const CBlock& block, int nHeight, const CBlockUndo& blockundo);
+
+public:
+    CScriptIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    /**
+     * Pick up where the index was left, removing blocks that are not in the
+     * active chain any more, e.g. when the chainstate was not flushed before
+     * a crash. Needs cs_main and the block index to be loaded.
+     */
+    bool Init();
+
+    //! Last block indexed. Needs cs_main.
+    const CBlockIndex* GetBestBlock() const;
+
+    //! Add a block connected to the tip, if the index is caught up. vPrevHeights are the heights of the outputs it spends. Needs cs_main.
+    bool ConnectBlock(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo, const std::vector<int>& vPrevHeights);
+    //! Remove a block disconnected from the tip, if it was indexed. Needs cs_main.
+    bool DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo);
+
+    /**
+     * Index the blocks of the active chain up to the tip, after which
+     * ConnectBlock takes over. Returns false if a block or its undo data
+     * could not be read or the index is inconsistent.
+     */
+    bool Sync();
+
+    //! Catch up with the active chain, or until interrupted
+    void ThreadSync();
+
+    /**
+     * Payments to and spends from a script between two heights, both
+     * included, in height order, returning at most nCount. A page continues
+     * after pAfter, the key of the last entry of the previous page, if given.
+     * The entries are read from one consistent view of the database, which
+     * is indexed up to hashBest. Needs no lock.
+     */
+    void GetHistory(const uint256& hashScript, int nFromHeight, int nToHeight, const CScriptHistoryKey* pAfter, size_t nCount, std::vector<CScriptHistoryEntry>& vEntries, uint256& hashBest) const;
+    //! Unspent outputs of a script in outpoint order, after pAfter if given and at most nCount, as GetHistory
+    void GetUnspent(const uint256& hashScript, const COutPoint* pAfter, size_t nCount, std::vector<CScriptUnspent>& vUnspent, uint256& hashBest) const;
+};
+
+/** The script index, if -scriptindex is set */
+extern CScriptIndex* pscriptindex;
+
+#endif // BITCOIN_SCRIPTINDEX_H
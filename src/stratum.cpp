@@ -0,0 +1,598 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "base58.h"
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "miner.h"
+#include "netbase.h"
+#include "rpc/protocol.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "timedata.h"
+#include "txmempool.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <memory>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+#include <Gulden/Common/diff.h>
+
+/** Stratum errors are [code, message, traceback] */
+static UniValue StratumError(int code, const std::string& message)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(code);
+    error.push_back(message);
+    error.push_back(NullUniValue);
+    return error;
+}
+
+static std::string StratumNotification(const std::string& strMethod, const UniValue& params)
+{
+    UniValue notification(UniValue::VOBJ);
+    notification.push_back(Pair("id", NullUniValue));
+    notification.push_back(Pair("method", strMethod));
+    notification.push_back(Pair("params", params));
+    return notification.write();
+}
+
+/** Stratum sends the previous block hash with the bytes of every 32 bit word reversed. */
+static std::string StratumPrevHashHex(const uint256& hash)
+{
+    std::vector<unsigned char> vch(hash.begin(), hash.end());
+    for (size_t i = 0; i < vch.size(); i += 4) {
+        std::swap(vch[i], vch[i + 3]);
+        std::swap(vch[i + 1], vch[i + 2]);
+    }
+    return HexStr(vch);
+}
+
+/** Times and nonces are sent as 8 hex digits, most significant first. */
+static bool ParseStratumUint32(const UniValue& value, uint32_t& n)
+{
+    if (!value.isStr() || value.get_str().size() != 8 || !IsHex(value.get_str()))
+        return false;
+    std::vector<unsigned char> vch = ParseHex(value.get_str());
+    n = ReadBE32(&vch[0]);
+    return true;
+}
+
+arith_uint256 StratumShareTarget(double dDifficulty)
+{
+    // Difficulty 1 is 0x0000ffff << 224, so difficulty d is (0xffff << 240) / (d * 2^16), which stays in range down to d = 2^-16.
+    uint64_t nDivisor = std::max((uint64_t)1, (uint64_t)(dDifficulty * 65536));
+    return (arith_uint256(0xffff) << 240) / arith_uint256(nDivisor);
+}
+
+CStratumJob::CStratumJob(const std::string& strIdIn, const CBlock& blockIn, int nHeightIn, CAmount nFeesIn, int64_t nMinTimeIn)
+    : strId(strIdIn)
+    , block(blockIn)
+    , nHeight(nHeightIn)
+    , nFees(nFeesIn)
+    , nMinTime(nMinTimeIn)
+{
+    // Same coinbase as IncrementExtraNonce builds, with the extranonce reserved for the miner.
+    std::string coinbaseSignature = GetArg("-coinbasesignature", "");
+    CScript scriptSig = CScript() << nHeight;
+    size_t nPrefixSize = scriptSig.size();
+    scriptSig << std::vector<unsigned char>(STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, 0) << std::vector<unsigned char>(coinbaseSignature.begin(), coinbaseSignature.end());
+    scriptSig += COINBASE_FLAGS;
+    assert(scriptSig.size() <= 100);
+
+    CMutableTransaction coinbase(block.vtx[0]);
+    coinbase.vin[0].scriptSig = scriptSig;
+    block.vtx[0] = coinbase;
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    vMerkleBranch = BlockMerkleBranch(block, 0);
+
+    // Miners hash the coinbase without witness: version, one input, its prevout, the script length, then the
+    // height and the push opcode of the extranonce.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ss << block.vtx[0];
+    size_t nOffset = 4 + 1 + 36 + GetSizeOfCompactSize(scriptSig.size()) + nPrefixSize + 1;
+    vCoinbase1.assign(ss.begin(), ss.begin() + nOffset);
+    vCoinbase2.assign(ss.begin() + nOffset + STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, ss.end());
+}
+
+UniValue CStratumJob::GetNotifyParams(bool fClean) const
+{
+    UniValue branch(UniValue::VARR);
+    BOOST_FOREACH (const uint256& hash, vMerkleBranch)
+        branch.push_back(HexStr(hash.begin(), hash.end()));
+
+    UniValue params(UniValue::VARR);
+    params.push_back(strId);
+    params.push_back(StratumPrevHashHex(block.hashPrevBlock));
+    params.push_back(HexStr(vCoinbase1));
+    params.push_back(HexStr(vCoinbase2));
+    params.push_back(branch);
+    params.push_back(strprintf("%08x", (uint32_t)block.nVersion));
+    params.push_back(strprintf("%08x", block.nBits));
+    params.push_back(strprintf("%08x", block.nTime));
+    params.push_back(fClean);
+    return params;
+}
+
+CMutableTransaction CStratumJob::GetCoinbase(const std::vector<unsigned char>& vExtraNonce) const
+{
+    assert(vExtraNonce.size() == STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE);
+    std::vector<unsigned char> vCoinbase(vCoinbase1);
+    vCoinbase.insert(vCoinbase.end(), vExtraNonce.begin(), vExtraNonce.end());
+    vCoinbase.insert(vCoinbase.end(), vCoinbase2.begin(), vCoinbase2.end());
+
+    CMutableTransaction coinbase;
+    CDataStream ss(vCoinbase, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ss >> coinbase;
+    coinbase.wit = block.vtx[0].wit;
+    return coinbase;
+}
+
+CBlockHeader CStratumJob::GetHeader(const CTransaction& coinbase, uint32_t nTime, uint32_t nNonce) const
+{
+    CBlockHeader header = block.GetBlockHeader();
+    header.hashMerkleRoot = ComputeMerkleRootFromBranch(coinbase.GetHash(), vMerkleBranch, 0);
+    header.nTime = nTime;
+    header.nNonce = nNonce;
+    return header;
+}
+
+CStratumClient::CStratumClient(uint32_t nExtraNonce1, double dDifficultyIn)
+    : vExtraNonce1(STRATUM_EXTRANONCE1_SIZE)
+    , fSubscribed(false)
+    , fAuthorized(false)
+    , dDifficulty(dDifficultyIn)
+    , nAccepted(0)
+    , nRejected(0)
+{
+    WriteBE32(&vExtraNonce1[0], nExtraNonce1);
+}
+
+CStratumServer::CStratumServer(const CChainParams& chainparamsIn, const boost::shared_ptr<CReserveScript>& coinbaseScriptIn, double dDifficultyIn)
+    : chainparams(chainparamsIn)
+    , coinbaseScript(coinbaseScriptIn)
+    , dDifficulty(dDifficultyIn)
+    , nJobCounter(0)
+    , nExtraNonceCounter(0)
+    , nTransactionsUpdatedLast(0)
+    , nLastFeeCheck(0)
+    , fTipChanged(false)
+{
+}
+
+uint32_t CStratumServer::NextExtraNonce1()
+{
+    LOCK(cs);
+    return ++nExtraNonceCounter;
+}
+
+void CStratumServer::AddClient(CStratumClient* client)
+{
+    LOCK(cs);
+    setClients.insert(client);
+}
+
+void CStratumServer::RemoveClient(CStratumClient* client)
+{
+    LOCK(cs);
+    setClients.erase(client);
+    LogPrint("stratum", "stratum: Worker %s left after %u accepted and %u rejected shares\n", client->strWorker, client->nAccepted, client->nRejected);
+}
+
+void CStratumServer::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    boost::unique_lock<boost::mutex> lock(mutexTip);
+    fTipChanged = true;
+    condTip.notify_one();
+}
+
+void CStratumServer::SendJob(CStratumClient& client, const CStratumJob& job, bool fClean)
+{
+    client.Send(StratumNotification("mining.notify", job.GetNotifyParams(fClean)));
+}
+
+bool CStratumServer::Submit(CStratumClient& client, const UniValue& params, UniValue& error, CBlock& block, bool& fSolved)
+{
+    AssertLockHeld(cs);
+    if (!client.fAuthorized) {
+        error = StratumError(24, "Unauthorized worker");
+        return false;
+    }
+    if (params.size() < 5 || !params[1].isStr() || !params[2].isStr()) {
+        error = StratumError(20, "Invalid parameters");
+        return false;
+    }
+    std::map<std::string, boost::shared_ptr<CStratumJob> >::iterator it = mapJobs.find(params[1].get_str());
+    if (it == mapJobs.end()) {
+        error = StratumError(21, "Job not found");
+        return false;
+    }
+    CStratumJob& job = *it->second;
+
+    std::vector<unsigned char> vExtraNonce2 = ParseHex(params[2].get_str());
+    uint32_t nTime, nNonce;
+    if (vExtraNonce2.size() != STRATUM_EXTRANONCE2_SIZE || !ParseStratumUint32(params[3], nTime) || !ParseStratumUint32(params[4], nNonce)) {
+        error = StratumError(20, "Invalid parameters");
+        return false;
+    }
+    if (nTime < job.nMinTime || nTime > GetAdjustedTime() + STRATUM_MAX_FUTURE_TIME) {
+        error = StratumError(20, "Time out of range");
+        return false;
+    }
+
+    std::vector<unsigned char> vExtraNonce(client.vExtraNonce1);
+    vExtraNonce.insert(vExtraNonce.end(), vExtraNonce2.begin(), vExtraNonce2.end());
+    CTransaction coinbase(job.GetCoinbase(vExtraNonce));
+    CBlockHeader header = job.GetHeader(coinbase, nTime, nNonce);
+
+    if (!job.setShares.insert(header.GetHash()).second) {
+        error = StratumError(22, "Duplicate share");
+        return false;
+    }
+    uint256 hashPoW;
+    GetPoWHashes(&header, 1, &hashPoW);
+    arith_uint256 hash = UintToArith256(hashPoW);
+    if (hash > StratumShareTarget(client.dDifficulty)) {
+        error = StratumError(23, "Low difficulty share");
+        return false;
+    }
+
+    arith_uint256 hashTarget;
+    hashTarget.SetCompact(header.nBits);
+    if (hash <= hashTarget) {
+        block = job.block;
+        block.vtx[0] = coinbase;
+        block.hashMerkleRoot = header.hashMerkleRoot;
+        block.nTime = header.nTime;
+        block.nNonce = header.nNonce;
+        fSolved = true;
+    }
+    return true;
+}
+
+void CStratumServer::SubmitBlock(CBlock& block)
+{
+    LogPrintf("stratum: Block %s found\n", block.GetHash().ToString());
+    GetMainSignals().BlockFound(block.GetHash());
+
+    CValidationState state;
+    if (!ProcessNewBlock(state, chainparams, NULL, &block, true, NULL)) {
+        LogPrintf("stratum: Block %s not accepted: %s\n", block.GetHash().ToString(), FormatStateMessage(state));
+        return;
+    }
+    coinbaseScript->KeepScript();
+}
+
+void CStratumServer::ProcessLine(CStratumClient& client, const std::string& strLine)
+{
+    UniValue request;
+    if (!request.read(strLine) || !request.isObject()) {
+        client.Send(JSONRPCReplyObj(NullUniValue, StratumError(20, "Parse error"), NullUniValue).write());
+        return;
+    }
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    if (!method.isStr() || !params.isArray()) {
+        client.Send(JSONRPCReplyObj(NullUniValue, StratumError(20, "Invalid request"), id).write());
+        return;
+    }
+    const std::string& strMethod = method.get_str();
+
+    UniValue result(UniValue::VNULL);
+    UniValue error(UniValue::VNULL);
+    CBlock block;
+    bool fSolved = false;
+    {
+        LOCK(cs);
+        if (strMethod == "mining.subscribe") {
+            std::string strSubscription = HexStr(client.vExtraNonce1);
+            UniValue subscriptions(UniValue::VARR);
+            UniValue subscription(UniValue::VARR);
+            subscription.push_back("mining.set_difficulty");
+            subscription.push_back(strSubscription);
+            subscriptions.push_back(subscription);
+            subscription.clear();
+            subscription.setArray();
+            subscription.push_back("mining.notify");
+            subscription.push_back(strSubscription);
+            subscriptions.push_back(subscription);
+            result.setArray();
+            result.push_back(subscriptions);
+            result.push_back(HexStr(client.vExtraNonce1));
+            result.push_back((int)STRATUM_EXTRANONCE2_SIZE);
+            client.Send(JSONRPCReplyObj(result, error, id).write());
+
+            // Work is pushed right away rather than after authorization, so that miners can start hashing.
+            client.fSubscribed = true;
+            UniValue difficulty(UniValue::VARR);
+            difficulty.push_back(client.dDifficulty);
+            client.Send(StratumNotification("mining.set_difficulty", difficulty));
+            if (pjob)
+                SendJob(client, *pjob, true);
+            return;
+        } else if (strMethod == "mining.authorize") {
+            if (params.size() < 1 || !params[0].isStr()) {
+                error = StratumError(20, "Invalid parameters");
+            } else {
+                client.strWorker = params[0].get_str();
+                client.fAuthorized = true;
+                result = true;
+                LogPrint("stratum", "stratum: Worker %s authorized\n", client.strWorker);
+            }
+        } else if (strMethod == "mining.submit") {
+            if (Submit(client, params, error, block, fSolved)) {
+                client.nAccepted++;
+                result = true;
+            } else {
+                client.nRejected++;
+            }
+        } else if (strMethod == "mining.extranonce.subscribe") {
+            // The extranonce of a connection never changes.
+            result = false;
+        } else {
+            error = StratumError(20, "Method not found");
+        }
+        client.Send(JSONRPCReplyObj(result, error, id).write());
+    }
+
+    if (fSolved)
+        SubmitBlock(block);
+}
+
+bool CStratumServer::UpdateJob(bool fForce)
+{
+    if (chainparams.MiningRequiresPeers() && IsInitialBlockDownload())
+        return false;
+    boost::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip || !tip->pindexTip)
+        return false;
+
+    boost::shared_ptr<CStratumJob> pjobCurrent;
+    {
+        LOCK(cs);
+        pjobCurrent = pjob;
+    }
+    bool fClean = fForce || !pjobCurrent || pjobCurrent->block.hashPrevBlock != tip->hashBlock;
+    if (!fClean) {
+        // The delta retargeting asks for another target as time passes, and work on the old one would be rejected.
+        CBlockHeader header = pjobCurrent->block.GetBlockHeader();
+        header.nTime = std::max((int64_t)header.nTime, GetAdjustedTime());
+        if (GetNextWorkRequired(tip->pindexTip, &header, chainparams.GetConsensus()) != header.nBits)
+            fClean = true;
+    }
+    if (!fClean && (GetTime() - nLastFeeCheck < STRATUM_FEE_CHECK_INTERVAL || mempool.GetTransactionsUpdated() == nTransactionsUpdatedLast))
+        return false;
+    nLastFeeCheck = GetTime();
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate(CreateBlockTemplate(chainparams, coinbaseScript->reserveScript));
+    if (!pblocktemplate.get() || pblocktemplate->block.hashPrevBlock != tip->hashBlock)
+        return false; // the tip moved on, and the next round will catch up
+    CAmount nFees = -pblocktemplate->vTxFees[0];
+    if (!fClean && (nFees <= pjobCurrent->nFees || nFees * 100 < pjobCurrent->nFees * (100 + STRATUM_FEE_PUSH_PERCENT)))
+        return false;
+
+    int64_t nMinTime = tip->pindexTip->GetMedianTimePast(tip->nHeight) + 1;
+    LOCK(cs);
+    std::string strId = strprintf("%08x", ++nJobCounter);
+    boost::shared_ptr<CStratumJob> pjobNew(new CStratumJob(strId, pblocktemplate->block, tip->nHeight + 1, nFees, nMinTime));
+    if (fClean)
+        mapJobs.clear();
+    while (mapJobs.size() >= STRATUM_MAX_JOBS)
+        mapJobs.erase(mapJobs.begin());
+    mapJobs[strId] = pjobNew;
+    pjob = pjobNew;
+
+    LogPrint("stratum", "stratum: New job %s at height %d with %u transactions and %s fees%s\n", strId, pjobNew->nHeight,
+        pjobNew->block.vtx.size(), FormatMoney(nFees), fClean ? ", replacing all work" : "");
+    BOOST_FOREACH (CStratumClient* client, setClients) {
+        if (client->fSubscribed)
+            SendJob(*client, *pjobNew, fClean);
+    }
+    return true;
+}
+
+void CStratumServer::ThreadJobs()
+{
+    while (true) {
+        bool fForce;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexTip);
+            if (!fTipChanged)
+                condTip.timed_wait(lock, boost::posix_time::seconds(1));
+            fForce = fTipChanged;
+            fTipChanged = false;
+        }
+        boost::this_thread::interruption_point();
+        UpdateJob(fForce);
+    }
+}
+
+/****** Network ********/
+
+/** A client connected over TCP */
+class CStratumConnection : public CStratumClient
+{
+public:
+    struct bufferevent* bev;
+    std::string strAddress;
+
+    CStratumConnection(struct bufferevent* bevIn, const std::string& strAddressIn, uint32_t nExtraNonce1, double dDifficultyIn)
+        : CStratumClient(nExtraNonce1, dDifficultyIn)
+        , bev(bevIn)
+        , strAddress(strAddressIn)
+    {
+    }
+
+    void Send(const std::string& strLine)
+    {
+        struct evbuffer* output = bufferevent_get_output(bev);
+        evbuffer_add(output, strLine.data(), strLine.size());
+        evbuffer_add(output, "\n", 1);
+    }
+};
+
+static struct event_base* stratumBase = NULL;
+static struct evconnlistener* stratumListener = NULL;
+static CStratumServer* pstratumserver = NULL;
+static std::set<CStratumConnection*> setStratumConnections;
+static boost::thread stratumThread;
+
+static void CloseStratumConnection(CStratumConnection* conn)
+{
+    LogPrint("stratum", "stratum: Closing connection from %s\n", conn->strAddress);
+    pstratumserver->RemoveClient(conn);
+    setStratumConnections.erase(conn);
+    bufferevent_free(conn->bev);
+    delete conn;
+}
+
+static void stratum_read_cb(struct bufferevent* bev, void* ctx)
+{
+    CStratumConnection* conn = (CStratumConnection*)ctx;
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t n_read_out = 0;
+    char* line;
+
+    while ((line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_CRLF)) != NULL) {
+        std::string s(line, n_read_out);
+        free(line);
+        if (!s.empty())
+            pstratumserver->ProcessLine(*conn, s);
+    }
+
+    if (evbuffer_get_length(input) > STRATUM_MAX_LINE_LENGTH) {
+        LogPrint("stratum", "stratum: Disconnecting %s because STRATUM_MAX_LINE_LENGTH exceeded\n", conn->strAddress);
+        CloseStratumConnection(conn);
+    }
+}
+
+static void stratum_event_cb(struct bufferevent* bev, short what, void* ctx)
+{
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+        CloseStratumConnection((CStratumConnection*)ctx);
+}
+
+static void stratum_accept_cb(struct evconnlistener* listener, evutil_socket_t fd, struct sockaddr* addr, int socklen, void* ctx)
+{
+    // Thread safe, because the job thread writes to every connection when it pushes a new job.
+    struct bufferevent* bev = bufferevent_socket_new(stratumBase, fd, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+    CService peer;
+    peer.SetSockAddr(addr);
+    CStratumConnection* conn = new CStratumConnection(bev, peer.ToString(), pstratumserver->NextExtraNonce1(), pstratumserver->GetDifficulty());
+    setStratumConnections.insert(conn);
+    pstratumserver->AddClient(conn);
+    bufferevent_setcb(bev, stratum_read_cb, NULL, stratum_event_cb, conn);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+    LogPrint("stratum", "stratum: Accepted connection from %s\n", conn->strAddress);
+}
+
+static void StratumThread()
+{
+    event_base_dispatch(stratumBase);
+}
+
+bool StartStratumServer(boost::thread_group& threadGroup, const CChainParams& chainparams)
+{
+    if (!GetBoolArg("-stratum", DEFAULT_STRATUM))
+        return true;
+    assert(!stratumBase);
+
+    boost::shared_ptr<CReserveScript> coinbaseScript;
+    std::string strAddress = GetArg("-stratumaddress", "");
+    if (!strAddress.empty()) {
+        CBitcoinAddress address(strAddress);
+        if (!address.IsValid())
+            return InitError(strprintf(_("Invalid -stratumaddress: '%s'"), strAddress));
+        coinbaseScript.reset(new CReserveScript());
+        coinbaseScript->reserveScript = GetScriptForDestination(address.Get());
+    } else {
+        GetMainSignals().ScriptForMining(coinbaseScript);
+        if (!coinbaseScript || coinbaseScript->reserveScript.empty())
+            return InitError(_("The Stratum server needs -stratumaddress or a wallet to pay mined blocks to"));
+    }
+
+    double dDifficulty = DEFAULT_STRATUM_DIFFICULTY;
+    if (mapArgs.count("-stratumdifficulty") && (!ParseDouble(mapArgs["-stratumdifficulty"], &dDifficulty) || dDifficulty <= 0))
+        return InitError(strprintf(_("Invalid -stratumdifficulty: '%s'"), mapArgs["-stratumdifficulty"]));
+
+    CService bindAddress;
+    std::string strBind = GetArg("-stratumbind", "127.0.0.1");
+    if (!Lookup(strBind.c_str(), bindAddress, GetArg("-stratumport", DEFAULT_STRATUM_PORT), false))
+        return InitError(strprintf(_("Invalid -stratumbind: '%s'"), strBind));
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    if (!bindAddress.GetSockAddr((struct sockaddr*)&sockaddr, &len))
+        return InitError(strprintf(_("Invalid -stratumbind: '%s'"), strBind));
+
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+    stratumBase = event_base_new();
+    if (!stratumBase)
+        return InitError(_("Unable to create the event base of the Stratum server"));
+    stratumListener = evconnlistener_new_bind(stratumBase, stratum_accept_cb, NULL, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1, (struct sockaddr*)&sockaddr, len);
+    if (!stratumListener) {
+        event_base_free(stratumBase);
+        stratumBase = NULL;
+        return InitError(strprintf(_("Unable to bind the Stratum server to %s"), bindAddress.ToString()));
+    }
+
+    pstratumserver = new CStratumServer(chainparams, coinbaseScript, dDifficulty);
+    RegisterValidationInterface(pstratumserver);
+    stratumThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "stratum", &StratumThread));
+    boost::function<void()> jobs = boost::bind(&CStratumServer::ThreadJobs, pstratumserver);
+    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "stratumjobs", jobs));
+    LogPrintf("Stratum server listening on %s\n", bindAddress.ToString());
+    return true;
+}
+
+void InterruptStratumServer()
+{
+    if (stratumBase)
+        event_base_loopbreak(stratumBase);
+}
+
+void StopStratumServer()
+{
+    if (!stratumBase)
+        return;
+    stratumThread.join();
+    UnregisterValidationInterface(pstratumserver);
+    while (!setStratumConnections.empty())
+        CloseStratumConnection(*setStratumConnections.begin());
+    evconnlistener_free(stratumListener);
+    stratumListener = NULL;
+    delete pstratumserver;
+    pstratumserver = NULL;
+    event_base_free(stratumBase);
+    stratumBase = NULL;
+}
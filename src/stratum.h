@@ -0,0 +1,177 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/**
+ * Stratum v1 mining server.
+ */
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include "amount.h"
+#include "arith_uint256.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <univalue.h>
+
+class CChainParams;
+class CReserveScript;
+
+namespace boost {
+class thread_group;
+} // namespace boost
+
+static const bool DEFAULT_STRATUM = false;
+static const int DEFAULT_STRATUM_PORT = 3333;
+/** Share difficulty, where 1 is a target of 0x0000ffff << 224 as scrypt pools count it */
+static const double DEFAULT_STRATUM_DIFFICULTY = 256.0;
+/** Bytes of the coinbase extranonce set by the server per connection and by the miner per share */
+static const unsigned int STRATUM_EXTRANONCE1_SIZE = 4;
+static const unsigned int STRATUM_EXTRANONCE2_SIZE = 4;
+/** Seconds between checks of the mempool for a template with better fees */
+static const int64_t STRATUM_FEE_CHECK_INTERVAL = 5;
+/** A template replaces the current job without a tip change if its fees are this many percent higher */
+static const int STRATUM_FEE_PUSH_PERCENT = 5;
+/** Number of jobs shares are still accepted for */
+static const unsigned int STRATUM_MAX_JOBS = 8;
+/** Shares may carry a time at most this many seconds ahead, as blocks may */
+static const int64_t STRATUM_MAX_FUTURE_TIME = 60;
+/** Longest request line accepted from a miner */
+static const size_t STRATUM_MAX_LINE_LENGTH = 16384;
+
+/**
+ * One piece of work handed out to miners: a block template whose coinbase is
+ * split around the extranonce, and the merkle branch of the coinbase.
+ */
+class CStratumJob
+{
+public:
+    std::string strId;
+    //! The template, with a zero extranonce in the coinbase
+    CBlock block;
+    int nHeight;
+    CAmount nFees;
+    //! Earliest time a share may carry
+    int64_t nMinTime;
+    //! Coinbase serialized without witness, before and after the extranonce
+    std::vector<unsigned char> vCoinbase1;
+    std::vector<unsigned char> vCoinbase2;
+    std::vector<uint256> vMerkleBranch;
+    //! Headers already submitted, to reject duplicate shares
+    std::set<uint256> setShares;
+
+    CStratumJob(const std::string& strIdIn, const CBlock& blockIn, int nHeightIn, CAmount nFeesIn, int64_t nMinTimeIn);
+
+    //! Parameters of the mining.notify message for this job
+    UniValue GetNotifyParams(bool fClean) const;
+
+    //! The coinbase with the given extranonce1 and extranonce2 filled in
+    CMutableTransaction GetCoinbase(const std::vector<unsigned char>& vExtraNonce) const;
+
+    //! The header a miner hashed, from its coinbase and the time and nonce it found
+    CBlockHeader GetHeader(const CTransaction& coinbase, uint32_t nTime, uint32_t nNonce) const;
+};
+
+/** A connected miner. Replies are written through Send(). */
+class CStratumClient
+{
+public:
+    std::vector<unsigned char> vExtraNonce1;
+    bool fSubscribed;
+    bool fAuthorized;
+    std::string strWorker;
+    double dDifficulty;
+    uint64_t nAccepted;
+    uint64_t nRejected;
+
+    CStratumClient(uint32_t nExtraNonce1, double dDifficultyIn);
+    virtual ~CStratumClient() {}
+
+    //! Queue one line, without its terminating newline, for the miner
+    virtual void Send(const std::string& strLine) = 0;
+};
+
+/**
+ * Builds jobs from the block template kept by the miner and serves them to
+ * Stratum clients. A new job is pushed to every client as soon as the tip
+ * changes, the required difficulty changes or a template with noticeably
+ * higher fees is available. Shares are checked against the scrypt proof of
+ * work, and solved blocks go straight to ProcessNewBlock.
+ *
+ * The server does not do any networking itself; see StartStratumServer.
+ */
+class CStratumServer : public CValidationInterface
+{
+private:
+    const CChainParams& chainparams;
+    boost::shared_ptr<CReserveScript> coinbaseScript;
+    double dDifficulty;
+
+    CCriticalSection cs;
+    std::set<CStratumClient*> setClients;
+    std::map<std::string, boost::shared_ptr<CStratumJob> > mapJobs;
+    boost::shared_ptr<CStratumJob> pjob;
+    uint32_t nJobCounter;
+    uint32_t nExtraNonceCounter;
+    unsigned int nTransactionsUpdatedLast;
+    int64_t nLastFeeCheck;
+
+    boost::mutex mutexTip;
+    boost::condition_variable condTip;
+    bool fTipChanged;
+
+    void SendJob(CStratumClient& client, const CStratumJob& job, bool fClean);
+    //! Check a share; a block it solves is returned in block, to be processed once cs is released
+    bool Submit(CStratumClient& client, const UniValue& params, UniValue& error, CBlock& block, bool& fSolved);
+    void SubmitBlock(CBlock& block);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+
+public:
+    CStratumServer(const CChainParams& chainparamsIn, const boost::shared_ptr<CReserveScript>& coinbaseScriptIn, double dDifficultyIn);
+
+    //! Extranonce1 for the next client
+    uint32_t NextExtraNonce1();
+    double GetDifficulty() const { return dDifficulty; }
+
+    void AddClient(CStratumClient* client);
+    void RemoveClient(CStratumClient* client);
+
+    //! Handle one request line from a client
+    void ProcessLine(CStratumClient& client, const std::string& strLine);
+
+    /**
+     * Replace the current job if the tip or the required difficulty changed,
+     * or, at most every STRATUM_FEE_CHECK_INTERVAL, if the mempool yields
+     * enough extra fees. Returns whether a new job was pushed.
+     */
+    bool UpdateJob(bool fForce);
+
+    //! Keep the job up to date until interrupted
+    void ThreadJobs();
+};
+
+/** Share target of a Stratum difficulty */
+arith_uint256 StratumShareTarget(double dDifficulty);
+
+/** Start listening for Stratum connections if -stratum is set. Returns false on a configuration error. */
+bool StartStratumServer(boost::thread_group& threadGroup, const CChainParams& chainparams);
+void InterruptStratumServer();
+void StopStratumServer();
+
+#endif // BITCOIN_STRATUM_H
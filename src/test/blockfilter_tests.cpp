@@ -0,0 +1,205 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "blockfilterindex.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "streams.h"
+#include "undo.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included.insert(element1);
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded.insert(element2);
+    }
+
+    GCSFilter filter(0, 0, 10, 1 << 10, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100);
+    for (GCSFilter::ElementSet::const_iterator it = included.begin(); it != included.end(); ++it)
+        BOOST_CHECK(filter.Match(*it));
+    BOOST_CHECK(filter.MatchAny(included));
+
+    // Decoding gives the same filter.
+    GCSFilter decoded(0, 0, 10, 1 << 10, filter.GetEncoded());
+    BOOST_CHECK(decoded.GetEncoded() == filter.GetEncoded());
+    for (GCSFilter::ElementSet::const_iterator it = included.begin(); it != included.end(); ++it)
+        BOOST_CHECK(decoded.Match(*it));
+
+    // With P = 10 a handful of false positives is expected, but not many.
+    int nFalsePositives = 0;
+    for (GCSFilter::ElementSet::const_iterator it = excluded.begin(); it != excluded.end(); ++it)
+        nFalsePositives += decoded.Match(*it);
+    BOOST_CHECK(nFalsePositives < 10);
+
+    // A truncated filter is rejected.
+    std::vector<unsigned char> vTruncated(filter.GetEncoded().begin(), filter.GetEncoded().end() - 8);
+    BOOST_CHECK_THROW(GCSFilter(0, 0, 10, 1 << 10, vTruncated), std::ios_base::failure);
+
+    GCSFilter empty(0, 0, 10, 1 << 10, GCSFilter::ElementSet());
+    BOOST_CHECK_EQUAL(HexStr(empty.GetEncoded()), "00");
+    BOOST_CHECK(!empty.Match(*included.begin()));
+    BOOST_CHECK(!empty.MatchAny(included));
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_bip158_vector)
+{
+    // The basic filter of the testnet3 genesis block from the BIP158 test vectors, holding its one output script.
+    uint256 hashBlock = uint256S("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943");
+    GCSFilter::ElementSet elements;
+    elements.insert(ParseHex("4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac"));
+    GCSFilter filter(ReadLE64(hashBlock.begin()), ReadLE64(hashBlock.begin() + 8), BASIC_FILTER_P, BASIC_FILTER_M, elements);
+    BOOST_CHECK_EQUAL(HexStr(filter.GetEncoded()), "019dfca8");
+
+    BlockFilter blockFilter(BLOCK_FILTER_BASIC, hashBlock, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(blockFilter.ComputeHeader(uint256()).GetHex(), "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750");
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript includedScripts[5], excludedScripts[3];
+
+    // Outputs of the block
+    includedScripts[0] << std::vector<unsigned char>(65, 0) << OP_CHECKSIG;
+    includedScripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    includedScripts[2] << OP_0 << std::vector<unsigned char>(20, 2);
+
+    // Outputs it spends
+    includedScripts[3] << std::vector<unsigned char>(33, 3) << OP_CHECKSIG;
+    includedScripts[4] << OP_HASH160 << std::vector<unsigned char>(20, 4) << OP_EQUAL;
+
+    // Neither null data outputs nor input scripts go in
+    excludedScripts[0] << OP_RETURN << std::vector<unsigned char>(40, 5);
+    excludedScripts[1] << std::vector<unsigned char>(72, 6);
+    excludedScripts[2] << OP_2 << std::vector<unsigned char>(33, 7) << OP_CHECKSIG;
+
+    CMutableTransaction tx1;
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = includedScripts[0];
+    tx1.vout[1].scriptPubKey = includedScripts[1];
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx2.vin[0].scriptSig = excludedScripts[1];
+    tx2.vout.resize(3);
+    tx2.vout[0].scriptPubKey = includedScripts[2];
+    tx2.vout[1].scriptPubKey = excludedScripts[0];
+    tx2.vout[2].scriptPubKey = CScript();
+
+    CBlock block;
+    block.vtx.push_back(tx1);
+    block.vtx.push_back(tx2);
+
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(100, includedScripts[3])));
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(100, includedScripts[4])));
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(100, CScript())));
+
+    BlockFilter filter(BLOCK_FILTER_BASIC, block, blockundo);
+    BOOST_CHECK(filter.GetBlockHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(filter.GetFilter().GetN(), 5);
+    for (int i = 0; i < 5; i++)
+        BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(includedScripts[i].begin(), includedScripts[i].end())));
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK(!filter.GetFilter().Match(GCSFilter::Element(excludedScripts[i].begin(), excludedScripts[i].end())));
+
+    // Serialization, as in the cfilter message, round trips.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << filter;
+    BlockFilter filter2;
+    ss >> filter2;
+    BOOST_CHECK_EQUAL(filter2.GetFilterType(), filter.GetFilterType());
+    BOOST_CHECK(filter2.GetBlockHash() == filter.GetBlockHash());
+    BOOST_CHECK(filter2.GetEncodedFilter() == filter.GetEncodedFilter());
+    BOOST_CHECK(filter2.GetHash() == filter.GetHash());
+    BOOST_CHECK(filter2.GetFilter().Match(GCSFilter::Element(includedScripts[3].begin(), includedScripts[3].end())));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(blockfilterindex_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(blockfilterindex_sync)
+{
+    CBlockFilterIndex index(BLOCK_FILTER_BASIC, 1 << 20, true);
+    index.Init();
+    BOOST_CHECK(index.GetBestBlock() == NULL);
+    BOOST_CHECK(index.Sync());
+    BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+
+    // Every header commits to the filter and to the previous header.
+    uint256 hashPrevHeader;
+    for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight++) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        BlockFilter filter;
+        uint256 header;
+        BOOST_REQUIRE(index.LookupFilter(pindex, filter));
+        BOOST_REQUIRE(index.LookupFilterHeader(pindex, header));
+        BOOST_CHECK(header == filter.ComputeHeader(hashPrevHeader));
+        hashPrevHeader = header;
+    }
+
+    // The coinbase of every test block pays the coinbase key.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    GCSFilter::Element element(scriptPubKey.begin(), scriptPubKey.end());
+    std::vector<BlockFilter> vFilters;
+    BOOST_CHECK(index.LookupFilterRange(1, chainActive.Tip(), vFilters));
+    BOOST_CHECK_EQUAL(vFilters.size(), (size_t)chainActive.Height());
+    for (size_t i = 0; i < vFilters.size(); i++) {
+        BOOST_CHECK(vFilters[i].GetBlockHash() == chainActive[i + 1]->GetBlockHash());
+        BOOST_CHECK(vFilters[i].GetFilter().Match(element));
+    }
+
+    std::vector<uint256> vHashes;
+    BOOST_CHECK(index.LookupFilterHashRange(10, chainActive[20], vHashes));
+    BOOST_CHECK_EQUAL(vHashes.size(), 11);
+    BOOST_CHECK(vHashes[0] == vFilters[9].GetHash());
+    BOOST_CHECK(!index.LookupFilterHashRange(21, chainActive[20], vHashes));
+
+    // A spend shows up in the filter of the block it is in through the script of the output it spends.
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = coinbaseTxns[0].vout[0].nValue - 10000;
+    CScript scriptNew = CScript() << OP_TRUE;
+    spend.vout[0].scriptPubKey = scriptNew;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    std::vector<CMutableTransaction> vSpends(1, spend);
+    CreateAndProcessBlock(vSpends, CScript() << OP_FALSE);
+
+    BOOST_CHECK(index.Sync());
+    BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+    BlockFilter filter;
+    uint256 header;
+    BOOST_CHECK(index.LookupFilter(chainActive.Tip(), filter));
+    BOOST_CHECK(index.LookupFilterHeader(chainActive.Tip(), header));
+    BOOST_CHECK(header == filter.ComputeHeader(hashPrevHeader));
+    BOOST_CHECK(filter.GetFilter().Match(element));
+    BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(scriptNew.begin(), scriptNew.end())));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,141 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "main.h"
+#include "tinyformat.h"
+
+#include "test/test_bitcoin.h"
+
+#include <map>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockindexsnapshot_tests, TestChain100Setup)
+
+/** Everything the snapshot stores about each block, keyed by block hash. */
+static std::map<uint256, std::string> DescribeBlockIndex()
+{
+    LOCK(cs_main);
+    std::map<uint256, std::string> mapDescription;
+    for (const auto& item : mapBlockIndex) {
+        const CBlockIndex* pindex = item.second;
+        mapDescription[item.first] = strprintf("%d %s %s %d %u %u %s %u %u %d %s %u %u %u", pindex->nHeight,
+            pindex->pprev ? pindex->pprev->GetBlockHash().ToString() : "", pindex->pskip ? pindex->pskip->GetBlockHash().ToString() : "",
+            pindex->nFile, pindex->nDataPos, pindex->nUndoPos, pindex->nChainWork.ToString(), pindex->nTx, pindex->nStatus,
+            pindex->nVersion, pindex->hashMerkleRoot.ToString(), pindex->nTime, pindex->nBits, pindex->nNonce);
+    }
+    return mapDescription;
+}
+
+/** Unload the block index and try to read it back from the snapshot alone. */
+static bool UnloadAndReadSnapshot()
+{
+    UnloadBlockIndex();
+    LOCK(cs_main);
+    std::vector<CBlockIndex*> vSortedByHeight;
+    bool fRead = ReadBlockIndexSnapshot(vSortedByHeight);
+    if (fRead) {
+        BOOST_CHECK_EQUAL(vSortedByHeight.size(), mapBlockIndex.size());
+        for (size_t i = 1; i < vSortedByHeight.size(); i++)
+            BOOST_CHECK(vSortedByHeight[i - 1]->nHeight <= vSortedByHeight[i]->nHeight);
+    } else {
+        BOOST_CHECK(vSortedByHeight.empty());
+        BOOST_CHECK(mapBlockIndex.empty());
+    }
+    return fRead;
+}
+
+/** Load the block index the way startup does, and check it matches what was there before. */
+static void ReloadBlockIndex(const std::map<uint256, std::string>& mapExpected, const uint256& hashTip)
+{
+    UnloadBlockIndex();
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(LoadBlockIndex());
+        BOOST_CHECK(chainActive.Tip() != NULL && chainActive.Tip()->GetBlockHash() == hashTip);
+    }
+    BOOST_CHECK(DescribeBlockIndex() == mapExpected);
+    BOOST_CHECK(!boost::filesystem::exists(GetBlockIndexSnapshotPath()));
+}
+
+static uint256 TipHash()
+{
+    LOCK(cs_main);
+    return chainActive.Tip()->GetBlockHash();
+}
+
+BOOST_AUTO_TEST_CASE(blockindexsnapshot_roundtrip)
+{
+    FlushStateToDisk();
+    std::map<uint256, std::string> mapExpected = DescribeBlockIndex();
+    uint256 hashTip = TipHash();
+
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    BOOST_CHECK(boost::filesystem::exists(GetBlockIndexSnapshotPath()));
+    BOOST_CHECK(UnloadAndReadSnapshot());
+    BOOST_CHECK(DescribeBlockIndex() == mapExpected);
+
+    // Only an index that LoadBlockIndex loaded in full is ever written out.
+    BOOST_CHECK(!WriteBlockIndexSnapshot());
+
+    // Startup consumes the snapshot, so it is only ever used once.
+    ReloadBlockIndex(mapExpected, hashTip);
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetAncestor(50) == chainActive[50]);
+}
+
+BOOST_AUTO_TEST_CASE(blockindexsnapshot_fallback)
+{
+    FlushStateToDisk();
+    std::map<uint256, std::string> mapExpected = DescribeBlockIndex();
+    uint256 hashTip = TipHash();
+
+    // Missing: the block tree database is read instead.
+    BOOST_CHECK(!boost::filesystem::exists(GetBlockIndexSnapshotPath()));
+    BOOST_CHECK(!UnloadAndReadSnapshot());
+    ReloadBlockIndex(mapExpected, hashTip);
+
+    // Corrupt: a flipped byte in one of the entries fails the checksum.
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    long nPos = boost::filesystem::file_size(path) / 2;
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_CHECK_EQUAL(fseek(file, nPos, SEEK_SET), 0);
+    int ch = fgetc(file);
+    BOOST_CHECK(ch != EOF);
+    BOOST_CHECK_EQUAL(fseek(file, nPos, SEEK_SET), 0);
+    fputc(ch ^ 0x01, file);
+    fclose(file);
+    BOOST_CHECK(!UnloadAndReadSnapshot());
+    ReloadBlockIndex(mapExpected, hashTip);
+}
+
+BOOST_AUTO_TEST_CASE(blockindexsnapshot_reject)
+{
+    // A snapshot written before the chain moved on no longer matches the coin database.
+    FlushStateToDisk();
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    std::vector<CMutableTransaction> noTxns;
+    CreateAndProcessBlock(noTxns, CScript() << OP_TRUE);
+    FlushStateToDisk();
+    std::map<uint256, std::string> mapExpected = DescribeBlockIndex();
+    uint256 hashTip = TipHash();
+    BOOST_CHECK(!UnloadAndReadSnapshot());
+    ReloadBlockIndex(mapExpected, hashTip);
+
+    // Truncated: the last entry or the checksum is missing.
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+    BOOST_CHECK(!UnloadAndReadSnapshot());
+    ReloadBlockIndex(mapExpected, hashTip);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
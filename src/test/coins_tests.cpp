@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "coinsprefetch.h"
 #include "random.h"
 #include "script/standard.h"
 #include "uint256.h"
@@ -14,7 +15,9 @@
 #include <vector>
 #include <map>
 
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 namespace {
 class CCoinsViewTest : public CCoinsView {
@@ -375,4 +378,56 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewTest base;
+    std::vector<uint256> txids;
+    {
+        CCoinsViewCacheTest stage(&base);
+        for (int i = 0; i < 20; i++) {
+            txids.push_back(GetRandHash());
+            CCoinsModifier coins = stage.ModifyCoins(txids.back());
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i + 1;
+            coins->nHeight = 1;
+        }
+        BOOST_CHECK(stage.Flush());
+    }
+    // One txid the database does not know.
+    txids.push_back(GetRandHash());
+
+    CCoinsPrefetcher prefetcher(1 << 20);
+    boost::thread worker(boost::bind(&CCoinsPrefetcher::Thread, &prefetcher, &base));
+    uint256 hashBlock = GetRandHash();
+    while (prefetcher.GetStats().nRequested == 0) {
+        prefetcher.Enqueue(hashBlock, txids, true);
+        MilliSleep(1);
+    }
+    prefetcher.Wait(hashBlock);
+
+    CCoinsViewCacheTest cache(&base);
+    BOOST_CHECK(cache.AccessCoins(txids[0]));
+    BOOST_CHECK_EQUAL(prefetcher.Apply(cache), 19U);
+    for (int i = 0; i < 20; i++) {
+        BOOST_CHECK(cache.HaveCoinsInCache(txids[i]));
+        BOOST_CHECK_EQUAL(cache.AccessCoins(txids[i])->vout[0].nValue, i + 1);
+    }
+    BOOST_CHECK(!cache.HaveCoinsInCache(txids[20]));
+    cache.SelfTest();
+
+    // Nothing read before a write to the database may end up in a cache.
+    CCoinsViewCacheTest cache2(&base);
+    prefetcher.Enqueue(hashBlock, txids, true);
+    prefetcher.Wait(hashBlock);
+    prefetcher.Invalidate();
+    BOOST_CHECK_EQUAL(prefetcher.Apply(cache2), 0U);
+
+    CCoinsPrefetchStats stats = prefetcher.GetStats();
+    BOOST_CHECK_EQUAL(stats.nAdded, 19U);
+    BOOST_CHECK_EQUAL(stats.nFetched, stats.nAdded + stats.nDiscarded);
+
+    worker.interrupt();
+    worker.join();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
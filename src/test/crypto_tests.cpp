@@ -16,9 +16,11 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include <Gulden/Common/scrypt.h>
 
 #include <vector>
 
@@ -236,6 +238,20 @@ BOOST_AUTO_TEST_CASE(sha1_testvectors)
     TestSHA1(test1, "b7755760681cbfd971451668f32af5774f4656b5");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j)
+            in[j] = insecure_rand();
+        for (int j = 0; j < i; ++j)
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha256_testvectors)
 {
     TestSHA256("", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
@@ -443,4 +459,58 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors)
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_batch)
+{
+    // Odd count so that every kernel width and the scalar tail are all exercised.
+    const unsigned int nCount = 29;
+    std::vector<unsigned char> input(80 * nCount);
+    for (unsigned int i = 0; i < input.size(); ++i)
+        input[i] = insecure_rand() & 0xff;
+
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    std::vector<unsigned char> expected(32 * nCount);
+    for (unsigned int i = 0; i < nCount; ++i)
+        scrypt_1024_1_1_256_sp_generic((const char*)&input[80 * i], (char*)&expected[32 * i], &scratchpad[0]);
+
+    scrypt_detect_multilane();
+    std::vector<unsigned char> output(32 * nCount);
+    scrypt_1024_1_1_256_batch((const char*)&input[0], (char*)&output[0], nCount);
+    BOOST_CHECK(output == expected);
+
+#if defined(USE_SCRYPT_MULTILANE)
+    std::vector<char> scratchpadMulti(SCRYPT_MULTILANE_SCRATCHPAD_SIZE(4));
+    std::vector<unsigned char> outputMulti(32 * 4);
+    scrypt_1024_1_1_256_sp_4way((const char*)&input[0], (char*)&outputMulti[0], &scratchpadMulti[0]);
+    BOOST_CHECK(std::equal(outputMulti.begin(), outputMulti.end(), expected.begin()));
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_prepared_midstate)
+{
+    // Headers that only differ in their last 16 bytes, as the nonces a miner walks through do.
+    const unsigned int nCount = 29;
+    std::vector<unsigned char> input(80 * nCount);
+    for (unsigned int i = 0; i < input.size(); ++i)
+        input[i] = (i % 80 < 64 && i >= 80) ? input[i % 80] : insecure_rand() & 0xff;
+
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    std::vector<unsigned char> expected(32 * nCount);
+    for (unsigned int i = 0; i < nCount; ++i)
+        scrypt_1024_1_1_256_sp_generic((const char*)&input[80 * i], (char*)&expected[32 * i], &scratchpad[0]);
+
+    scrypt_midstate midstate;
+    scrypt_1024_1_1_256_prepare((const char*)&input[0], &midstate);
+
+    std::vector<unsigned char> output(32 * nCount);
+    for (unsigned int i = 0; i < nCount; ++i)
+        scrypt_1024_1_1_256_sp_midstate(&midstate, (const char*)&input[80 * i], (char*)&output[32 * i], &scratchpad[0]);
+    BOOST_CHECK(output == expected);
+
+    scrypt_detect_multilane();
+    std::vector<char> scratchpadMulti(SCRYPT_MULTILANE_SCRATCHPAD_SIZE(scrypt_multilane_width()));
+    std::vector<unsigned char> outputBatch(32 * nCount);
+    scrypt_1024_1_1_256_batch_midstate(&midstate, (const char*)&input[0], (char*)&outputBatch[0], nCount, &scratchpadMulti[0]);
+    BOOST_CHECK(outputBatch == expected);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,106 @@
+// Copyright (c) 2012-2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "script/sigcache.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+typedef CuckooCache::cache<uint256, SignatureCacheHasher> sigcache_type;
+
+static void insecure_GetRandHash(uint256& t)
+{
+    uint32_t* ptr = (uint32_t*)t.begin();
+    for (uint8_t j = 0; j < 8; ++j)
+        *(ptr++) = insecure_rand();
+}
+
+/* Fraction of the first n_insert * fill entries that are still found after
+ * inserting n_insert * fill entries into a cache sized for n_insert. */
+static double hit_rate(size_t n_insert, double fill)
+{
+    sigcache_type cache;
+    cache.setup(n_insert);
+    std::vector<uint256> hashes(n_insert * fill);
+    for (uint256& h : hashes)
+        insecure_GetRandHash(h);
+    for (const uint256& h : hashes)
+        cache.insert(h);
+    size_t count = 0;
+    for (const uint256& h : hashes)
+        count += cache.contains(h, false);
+    return (double)count / hashes.size();
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    seed_insecure_rand(true);
+    sigcache_type cache;
+    cache.setup_bytes(4 << 20);
+    uint256 v;
+    for (int x = 0; x < 100000; ++x) {
+        insecure_GetRandHash(v);
+        cache.insert(v);
+    }
+    for (int x = 0; x < 100000; ++x) {
+        insecure_GetRandHash(v);
+        BOOST_CHECK(!cache.contains(v, false));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    seed_insecure_rand(true);
+    // Below capacity nearly everything is kept, at twice capacity about half is.
+    BOOST_CHECK(hit_rate(1 << 15, 0.9) > 0.99);
+    BOOST_CHECK(hit_rate(1 << 15, 2.0) > 0.45);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    seed_insecure_rand(true);
+    const size_t n_insert = 1 << 15;
+    sigcache_type cache;
+    cache.setup(n_insert);
+
+    std::vector<uint256> hashes(n_insert);
+    for (uint256& h : hashes)
+        insecure_GetRandHash(h);
+
+    // Erasing only flags an entry, it stays readable until its slot is reused.
+    for (size_t i = 0; i < n_insert / 2; ++i)
+        cache.insert(hashes[i]);
+    for (size_t i = 0; i < n_insert / 4; ++i)
+        BOOST_CHECK(cache.contains(hashes[i], true));
+    for (size_t i = 0; i < n_insert / 4; ++i)
+        BOOST_CHECK(cache.contains(hashes[i], false));
+
+    // Filling up the cache reuses the erased slots before anything still wanted.
+    for (size_t i = n_insert / 2; i < n_insert; ++i)
+        cache.insert(hashes[i]);
+    size_t count_kept = 0;
+    for (size_t i = n_insert / 4; i < n_insert / 2; ++i)
+        count_kept += cache.contains(hashes[i], false);
+    size_t count_erased = 0;
+    for (size_t i = 0; i < n_insert / 4; ++i)
+        count_erased += cache.contains(hashes[i], false);
+    BOOST_CHECK(count_kept > count_erased);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_stats)
+{
+    CSignatureCacheStats stats = GetSignatureCacheStats();
+    BOOST_CHECK(stats.nEntries > 0);
+    BOOST_CHECK_EQUAL(stats.nBytes, stats.nEntries * sizeof(uint256));
+    BOOST_CHECK(stats.nEvictions <= stats.nInserts);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
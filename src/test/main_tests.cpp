@@ -56,6 +56,59 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK_EQUAL(nSum, 2099999997690000ULL);
 }
 
+BOOST_FIXTURE_TEST_CASE(read_raw_block, TestChain100Setup)
+{
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+    }
+
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+
+    // The raw read returns exactly the network serialisation.
+    std::vector<unsigned char> vRawBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vRawBlock, pindex, Params().MessageStart()));
+    BOOST_CHECK(std::vector<unsigned char>(ssBlock.begin(), ssBlock.end()) == vRawBlock);
+
+    // Asking for a different block at the same position fails.
+    BOOST_CHECK(!ReadRawBlockFromDisk(vRawBlock, pindex->GetBlockPos(), pindex->pprev->GetBlockHash(), Params().MessageStart()));
+}
+
+BOOST_FIXTURE_TEST_CASE(chaintip_snapshot, TestChain100Setup)
+{
+    boost::shared_ptr<const CChainTipSnapshot> chain = GetChainTipSnapshot();
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chain->pindexTip == chainActive.Tip());
+        BOOST_CHECK_EQUAL(chain->nHeight, chainActive.Height());
+        BOOST_CHECK(chain->hashBlock == chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK(chain->nChainWork == chainActive.Tip()->nChainWork);
+        for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight++)
+            BOOST_CHECK((*chain)[nHeight] == chainActive[nHeight]);
+        BOOST_CHECK((*chain)[-1] == NULL);
+        BOOST_CHECK((*chain)[chain->nHeight + 1] == NULL);
+        BOOST_CHECK(chain->Contains(chainActive[50]));
+        BOOST_CHECK(chain->Next(chainActive[50]) == chainActive[51]);
+        BOOST_CHECK(chain->Next(chainActive.Tip()) == NULL);
+        BOOST_CHECK(LookupBlockIndex(chainActive[10]->GetBlockHash()) == chainActive[10]);
+    }
+    BOOST_CHECK(LookupBlockIndex(uint256()) == NULL);
+
+    // A new tip publishes a new snapshot and leaves the old one as it was.
+    int nHeightOld = chain->nHeight;
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    boost::shared_ptr<const CChainTipSnapshot> chainNew = GetChainTipSnapshot();
+    BOOST_CHECK_EQUAL(chainNew->nHeight, nHeightOld + 1);
+    BOOST_CHECK_EQUAL(chain->nHeight, nHeightOld);
+    BOOST_CHECK(chainNew->Contains(chain->pindexTip));
+    BOOST_CHECK(chainNew->Next(chain->pindexTip) == chainNew->pindexTip);
+}
+
 bool ReturnFalse() { return false; }
 bool ReturnTrue() { return true; }
 
@@ -136,6 +136,51 @@ void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey,
     BOOST_CHECK(pblocktemplate->block.vtx[8].GetHash() == hashLowFeeTx2);
 }
 
+// Transactions entering the mempool after a template was assembled can be
+// appended to it, as long as their parents are already in it.
+void TestAppendTransaction(const CChainParams& chainparams, CScript scriptPubKey, std::vector<CTransaction*>& txFirst)
+{
+    mempool.clear();
+    TestMemPoolEntryHelper entry;
+
+    BlockAssembler assembler(chainparams);
+    BOOST_CHECK(assembler.AssembleBlock(scriptPubKey));
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    uint256 hashParentTx = tx.GetHash();
+    mempool.addUnchecked(hashParentTx, entry.Fee(10000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+    tx.vin[0].prevout.hash = hashParentTx;
+    tx.vout[0].nValue = 5000000000LL - 10000 - 20000;
+    uint256 hashChildTx = tx.GetHash();
+    mempool.addUnchecked(hashChildTx, entry.Fee(20000).Time(GetTime()).SpendsCoinbase(false).FromTx(tx));
+
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK(!assembler.AppendTransaction(mempool.mapTx.find(hashChildTx)));
+        BOOST_CHECK(assembler.AppendTransaction(mempool.mapTx.find(hashParentTx)));
+        BOOST_CHECK(assembler.AppendTransaction(mempool.mapTx.find(hashChildTx)));
+        // Appending twice is harmless.
+        BOOST_CHECK(assembler.AppendTransaction(mempool.mapTx.find(hashParentTx)));
+    }
+
+    CBlockTemplate* pblocktemplate = assembler.CopyBlock();
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == hashParentTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == hashChildTx);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -30000);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].vout[0].nValue, 30000 + GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus()));
+    delete pblocktemplate;
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 {
 
@@ -425,6 +470,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     mempool.clear();
 
     TestPackageSelection(chainparams, scriptPubKey, txFirst);
+    TestAppendTransaction(chainparams, scriptPubKey, txFirst);
 
     BOOST_FOREACH (CTransaction* _tx, txFirst)
         delete _tx;
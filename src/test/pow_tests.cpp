@@ -95,4 +95,23 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+/* Batched header hashing must agree with hashing every header on its own */
+BOOST_AUTO_TEST_CASE(GetPoWHashes_test)
+{
+    std::vector<CBlockHeader> headers(11);
+    for (unsigned int i = 0; i < headers.size(); i++) {
+        headers[i].nVersion = 1;
+        headers[i].hashPrevBlock = GetRandHash();
+        headers[i].hashMerkleRoot = GetRandHash();
+        headers[i].nTime = 1269211443 + i * 150;
+        headers[i].nBits = 0x1e0fffff;
+        headers[i].nNonce = GetRand(0xFFFFFFFF);
+    }
+
+    std::vector<uint256> hashes(headers.size());
+    GetPoWHashes(&headers[0], headers.size(), &hashes[0]);
+    for (unsigned int i = 0; i < headers.size(); i++)
+        BOOST_CHECK(hashes[i] == CBlock(headers[i]).GetPoWHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -12,6 +12,9 @@
 
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <univalue.h>
@@ -323,4 +326,42 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+static void AppendReply(std::string* pstrOut, const std::string& strPiece)
+{
+    pstrOut->append(strPiece);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    UniValue vReq;
+    BOOST_CHECK(vReq.read("[{\"method\":\"decodescript\",\"params\":[\"51\"],\"id\":1},"
+                          "{\"method\":\"nosuchmethod\",\"params\":[],\"id\":2},"
+                          "7,"
+                          "{\"method\":\"setban\",\"params\":[\"127.0.0.0\",\"add\"],\"id\":3},"
+                          "{\"method\":\"listbanned\",\"params\":[],\"id\":4},"
+                          "{\"method\":\"decodescript\",\"params\":[\"52\"],\"id\":5}]"));
+    BOOST_CHECK(IsRPCReadOnly("listbanned"));
+    BOOST_CHECK(!IsRPCReadOnly("setban"));
+
+    std::string strExpected = JSONRPCExecBatch(vReq);
+    CallRPC("clearbanned");
+
+    std::string strOut;
+    boost::shared_ptr<JSONRPCBatch> batch(new JSONRPCBatch(vReq, boost::bind(AppendReply, &strOut, _1)));
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&JSONRPCBatch::Work, batch));
+    batch->Work();
+    batch->Wait();
+    threads.join_all();
+    BOOST_CHECK_EQUAL(strOut, strExpected);
+    CallRPC("clearbanned");
+
+    strOut.clear();
+    JSONRPCBatch empty(UniValue(UniValue::VARR), boost::bind(AppendReply, &strOut, _1));
+    empty.Work();
+    empty.Wait();
+    BOOST_CHECK_EQUAL(strOut, "[]\n");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
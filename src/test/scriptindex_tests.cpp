@@ -0,0 +1,183 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "script/interpreter.h"
+#include "scriptindex.h"
+#include "streams.h"
+
+#include "test/test_bitcoin.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(scriptindex_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(scriptindex_key_order)
+{
+    // Keys of one script sort by height, whatever the transaction.
+    uint256 hashScript = ScriptIndexHash(CScript() << OP_TRUE);
+    CDataStream ss1(SER_DISK, CLIENT_VERSION), ss2(SER_DISK, CLIENT_VERSION);
+    ss1 << CScriptHistoryKey(hashScript, 255, uint256S("ff"), 7, true);
+    ss2 << CScriptHistoryKey(hashScript, 256, uint256S("01"), 0, false);
+    BOOST_CHECK_EQUAL(ss1.size(), 73);
+    BOOST_CHECK(ss1.str() < ss2.str());
+
+    CScriptHistoryKey key;
+    ss2 >> key;
+    BOOST_CHECK(key.hashScript == hashScript);
+    BOOST_CHECK_EQUAL(key.nHeight, 256);
+    BOOST_CHECK(key.txid == uint256S("01"));
+    BOOST_CHECK(!key.fSpend);
+}
+
+BOOST_AUTO_TEST_CASE(scriptindex_sync)
+{
+    const int nMaxHeight = std::numeric_limits<int>::max();
+    CScriptIndex index(1 << 20, true);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.Init());
+        BOOST_CHECK(index.GetBestBlock() == NULL);
+    }
+    BOOST_CHECK(index.Sync());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+    }
+
+    // The coinbase of every test block pays the coinbase key.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    uint256 hashScript = ScriptIndexHash(scriptPubKey);
+    std::vector<CScriptHistoryEntry> vEntries;
+    uint256 hashBest;
+    index.GetHistory(hashScript, 0, nMaxHeight, NULL, MAX_SCRIPT_INDEX_RESULTS, vEntries, hashBest);
+    BOOST_CHECK_EQUAL(vEntries.size(), coinbaseTxns.size());
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        BOOST_CHECK_EQUAL(vEntries[i].nHeight, (int)i + 1);
+        BOOST_CHECK(vEntries[i].txid == coinbaseTxns[i].GetHash());
+        BOOST_CHECK(!vEntries[i].fSpend);
+        BOOST_CHECK_EQUAL(vEntries[i].nValue, coinbaseTxns[i].vout[0].nValue);
+    }
+    BOOST_CHECK(hashBest == chainActive.Tip()->GetBlockHash());
+
+    std::vector<CScriptUnspent> vUnspent;
+    index.GetUnspent(hashScript, NULL, MAX_SCRIPT_INDEX_RESULTS, vUnspent, hashBest);
+    BOOST_CHECK_EQUAL(vUnspent.size(), coinbaseTxns.size());
+
+    // Pages continue after the last entry of the previous one, and height ranges
+    vEntries.clear();
+    index.GetHistory(hashScript, 0, nMaxHeight, NULL, 5, vEntries, hashBest);
+    BOOST_CHECK_EQUAL(vEntries.size(), 5);
+    CScriptHistoryKey keyAfter(hashScript, vEntries.back());
+    vEntries.clear();
+    index.GetHistory(hashScript, 0, nMaxHeight, &keyAfter, 5, vEntries, hashBest);
+    BOOST_CHECK_EQUAL(vEntries.size(), 5);
+    BOOST_CHECK_EQUAL(vEntries.front().nHeight, 6);
+    BOOST_CHECK_EQUAL(vEntries.back().nHeight, 10);
+    vEntries.clear();
+    index.GetHistory(hashScript, 20, 29, NULL, MAX_SCRIPT_INDEX_RESULTS, vEntries, hashBest);
+    BOOST_CHECK_EQUAL(vEntries.size(), 10);
+    BOOST_CHECK_EQUAL(vEntries.front().nHeight, 20);
+    keyAfter = CScriptHistoryKey(hashScript, vEntries[7]);
+    vEntries.clear();
+    index.GetHistory(hashScript, 20, 29, &keyAfter, MAX_SCRIPT_INDEX_RESULTS, vEntries, hashBest);
+    BOOST_CHECK_EQUAL(vEntries.size(), 2);
+    BOOST_CHECK_EQUAL(vEntries.front().nHeight, 28);
+    vUnspent.clear();
+    index.GetUnspent(hashScript, NULL, 95, vUnspent, hashBest);
+    BOOST_CHECK_EQUAL(vUnspent.size(), 95);
+    COutPoint outAfter = vUnspent.back().out;
+    vUnspent.clear();
+    index.GetUnspent(hashScript, &outAfter, MAX_SCRIPT_INDEX_RESULTS, vUnspent, hashBest);
+    BOOST_CHECK_EQUAL(vUnspent.size(), coinbaseTxns.size() - 95);
+    BOOST_CHECK(outAfter < vUnspent.front().out);
+
+    // Once caught up, blocks are indexed as they are connected.
+    pscriptindex = &index;
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = coinbaseTxns[0].vout[0].nValue - 10000;
+    CScript scriptNew = CScript() << OP_TRUE;
+    spend.vout[0].scriptPubKey = scriptNew;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    std::vector<CMutableTransaction> vSpends(1, spend);
+    CreateAndProcessBlock(vSpends, CScript() << OP_FALSE);
+
+    int nTipHeight;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+        nTipHeight = chainActive.Height();
+    }
+    vEntries.clear();
+    index.GetHistory(hashScript, nTipHeight, nMaxHeight, NULL, MAX_SCRIPT_INDEX_RESULTS, vEntries, hashBest);
+    BOOST_CHECK_EQUAL(vEntries.size(), 1);
+    BOOST_CHECK(vEntries[0].fSpend);
+    BOOST_CHECK(vEntries[0].txid == CTransaction(spend).GetHash());
+    BOOST_CHECK_EQUAL(vEntries[0].n, 0);
+    BOOST_CHECK(vEntries[0].prevout == spend.vin[0].prevout);
+    BOOST_CHECK_EQUAL(vEntries[0].nPrevHeight, 1);
+    BOOST_CHECK_EQUAL(vEntries[0].nValue, coinbaseTxns[0].vout[0].nValue);
+    vUnspent.clear();
+    index.GetUnspent(hashScript, NULL, MAX_SCRIPT_INDEX_RESULTS, vUnspent, hashBest);
+    BOOST_CHECK_EQUAL(vUnspent.size(), coinbaseTxns.size() - 1);
+    vUnspent.clear();
+    index.GetUnspent(ScriptIndexHash(scriptNew), NULL, MAX_SCRIPT_INDEX_RESULTS, vUnspent, hashBest);
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1);
+    BOOST_CHECK_EQUAL(vUnspent[0].nHeight, nTipHeight);
+
+    // Verifying the chain disconnects and reconnects blocks on a scratch view, which leaves the index alone.
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(CVerifyDB().VerifyDB(Params(), pcoinsTip, 4, 10));
+        BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+    }
+    vEntries.clear();
+    index.GetHistory(hashScript, nTipHeight, nMaxHeight, NULL, MAX_SCRIPT_INDEX_RESULTS, vEntries, hashBest);
+    BOOST_CHECK_EQUAL(vEntries.size(), 1);
+    std::vector<CMutableTransaction> noTxns;
+    CreateAndProcessBlock(noTxns, CScript() << OP_FALSE);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), nTipHeight + 1);
+        BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+    }
+
+    // Disconnecting the blocks takes them out again.
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive[nTipHeight]));
+        BOOST_CHECK_EQUAL(chainActive.Height(), nTipHeight - 1);
+        BOOST_CHECK(index.GetBestBlock() == chainActive.Tip());
+    }
+    vEntries.clear();
+    index.GetHistory(hashScript, 0, nMaxHeight, NULL, MAX_SCRIPT_INDEX_RESULTS, vEntries, hashBest);
+    BOOST_CHECK_EQUAL(vEntries.size(), coinbaseTxns.size());
+    vUnspent.clear();
+    index.GetUnspent(hashScript, NULL, MAX_SCRIPT_INDEX_RESULTS, vUnspent, hashBest);
+    BOOST_CHECK_EQUAL(vUnspent.size(), coinbaseTxns.size());
+    bool fRestored = false;
+    for (size_t i = 0; i < vUnspent.size(); i++)
+        fRestored |= vUnspent[i].out == spend.vin[0].prevout && vUnspent[i].nHeight == 1;
+    BOOST_CHECK(fRestored);
+    vUnspent.clear();
+    index.GetUnspent(ScriptIndexHash(scriptNew), NULL, MAX_SCRIPT_INDEX_RESULTS, vUnspent, hashBest);
+    BOOST_CHECK(vUnspent.empty());
+
+    pscriptindex = NULL;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
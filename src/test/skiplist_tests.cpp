@@ -94,4 +94,34 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blockindex_arena)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vIndex;
+
+    // Entries stay where they are while the arena grows, and start out null.
+    for (int i = 0; i < 10000; i++) {
+        CBlockIndex* pindex = arena.Allocate();
+        BOOST_CHECK(pindex->pprev == NULL && pindex->nHeight == 0);
+        pindex->nHeight = i;
+        if (!vIndex.empty())
+            pindex->pprev = vIndex.back();
+        vIndex.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(arena.size(), 10000U);
+    for (int i = 0; i < 10000; i++) {
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, i);
+        BOOST_CHECK(vIndex[i]->pprev == (i ? vIndex[i - 1] : NULL));
+    }
+
+    // After a reservation the entries are contiguous.
+    arena.Reserve(20000);
+    CBlockIndex* pfirst = arena.Allocate();
+    for (int i = 1; i < 20000; i++)
+        BOOST_CHECK(arena.Allocate() == pfirst + i);
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,192 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "main.h"
+#include "script/script.h"
+#include "stratum.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+/** A miner that keeps everything the server sends it. */
+class CTestStratumClient : public CStratumClient
+{
+public:
+    std::vector<UniValue> vMessages;
+
+    CTestStratumClient(uint32_t nExtraNonce1, double dDifficultyIn) : CStratumClient(nExtraNonce1, dDifficultyIn) {}
+
+    void Send(const std::string& strLine)
+    {
+        UniValue message;
+        BOOST_REQUIRE(message.read(strLine));
+        vMessages.push_back(message);
+    }
+
+    //! The last message with the given method, or the last reply if strMethod is empty
+    UniValue Last(const std::string& strMethod) const
+    {
+        for (std::vector<UniValue>::const_reverse_iterator it = vMessages.rbegin(); it != vMessages.rend(); ++it) {
+            const UniValue& method = find_value(*it, "method");
+            if (strMethod.empty() ? method.isNull() : (method.isStr() && method.get_str() == strMethod))
+                return *it;
+        }
+        return NullUniValue;
+    }
+};
+
+static uint32_t ParseHexUint32(const std::string& str)
+{
+    std::vector<unsigned char> vch = ParseHex(str);
+    BOOST_REQUIRE_EQUAL(vch.size(), 4);
+    return ReadBE32(&vch[0]);
+}
+
+static std::string Request(int nId, const std::string& strMethod, const UniValue& params)
+{
+    UniValue request(UniValue::VOBJ);
+    request.push_back(Pair("id", nId));
+    request.push_back(Pair("method", strMethod));
+    request.push_back(Pair("params", params));
+    return request.write();
+}
+
+static std::string SubmitRequest(int nId, const std::string& strJob, const std::string& strExtraNonce2, uint32_t nTime, uint32_t nNonce)
+{
+    UniValue params(UniValue::VARR);
+    params.push_back("worker");
+    params.push_back(strJob);
+    params.push_back(strExtraNonce2);
+    params.push_back(strprintf("%08x", nTime));
+    params.push_back(strprintf("%08x", nNonce));
+    return Request(nId, "mining.submit", params);
+}
+
+static int ErrorCode(const UniValue& reply)
+{
+    const UniValue& error = find_value(reply, "error");
+    if (!error.isArray() || error.size() < 1)
+        return 0;
+    return error[0].get_int();
+}
+
+BOOST_FIXTURE_TEST_SUITE(stratum_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(stratum_share_target)
+{
+    BOOST_CHECK(StratumShareTarget(1.0) == arith_uint256(0xffff) << 224);
+    BOOST_CHECK(StratumShareTarget(256.0) == (arith_uint256(0xffff) << 224) / 256);
+    BOOST_CHECK(StratumShareTarget(0.0) == arith_uint256(0xffff) << 240);
+}
+
+BOOST_AUTO_TEST_CASE(stratum_mine_block)
+{
+    boost::shared_ptr<CReserveScript> coinbaseScript(new CReserveScript());
+    coinbaseScript->reserveScript = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    // The lowest share difficulty, so that any block found also counts as a share.
+    CStratumServer server(Params(), coinbaseScript, 1.0 / 65536);
+    BOOST_CHECK(server.UpdateJob(true));
+    // Nothing changed, so there is nothing to push.
+    BOOST_CHECK(!server.UpdateJob(false));
+
+    CTestStratumClient client(server.NextExtraNonce1(), server.GetDifficulty());
+    server.AddClient(&client);
+
+    // Shares are refused until the worker is authorized.
+    server.ProcessLine(client, SubmitRequest(1, "00000001", "00000000", 0, 0));
+    BOOST_CHECK_EQUAL(ErrorCode(client.Last("")), 24);
+
+    server.ProcessLine(client, Request(2, "mining.subscribe", UniValue(UniValue::VARR)));
+    UniValue subscribe = find_value(client.Last(""), "result");
+    BOOST_REQUIRE(subscribe.isArray() && subscribe.size() == 3);
+    std::vector<unsigned char> vExtraNonce1 = ParseHex(subscribe[1].get_str());
+    BOOST_CHECK(vExtraNonce1 == client.vExtraNonce1);
+    BOOST_CHECK_EQUAL(subscribe[2].get_int(), STRATUM_EXTRANONCE2_SIZE);
+    BOOST_CHECK(!client.Last("mining.set_difficulty").isNull());
+
+    UniValue authorize(UniValue::VARR);
+    authorize.push_back("worker");
+    authorize.push_back("x");
+    server.ProcessLine(client, Request(3, "mining.authorize", authorize));
+    BOOST_CHECK(find_value(client.Last(""), "result").get_bool());
+
+    server.ProcessLine(client, Request(4, "mining.unknown", UniValue(UniValue::VARR)));
+    BOOST_CHECK(ErrorCode(client.Last("")) != 0);
+
+    // Build the header the way a miner does, from nothing but the notification.
+    const UniValue notify = find_value(client.Last("mining.notify"), "params");
+    BOOST_REQUIRE(notify.isArray() && notify.size() == 9);
+    BOOST_CHECK(notify[8].get_bool());
+    std::string strJob = notify[0].get_str();
+    std::vector<unsigned char> vExtraNonce2(STRATUM_EXTRANONCE2_SIZE, 0x5a);
+
+    std::vector<unsigned char> vCoinbase = ParseHex(notify[2].get_str());
+    vCoinbase.insert(vCoinbase.end(), vExtraNonce1.begin(), vExtraNonce1.end());
+    vCoinbase.insert(vCoinbase.end(), vExtraNonce2.begin(), vExtraNonce2.end());
+    std::vector<unsigned char> vCoinbase2 = ParseHex(notify[3].get_str());
+    vCoinbase.insert(vCoinbase.end(), vCoinbase2.begin(), vCoinbase2.end());
+    std::vector<uint256> vBranch;
+    for (size_t i = 0; i < notify[4].size(); i++) {
+        std::vector<unsigned char> vch = ParseHex(notify[4][i].get_str());
+        vBranch.push_back(uint256(vch));
+    }
+
+    std::vector<unsigned char> vPrev = ParseHex(notify[1].get_str());
+    BOOST_REQUIRE_EQUAL(vPrev.size(), 32);
+    for (size_t i = 0; i < vPrev.size(); i += 4) {
+        std::swap(vPrev[i], vPrev[i + 3]);
+        std::swap(vPrev[i + 1], vPrev[i + 2]);
+    }
+
+    CBlockHeader header;
+    header.nVersion = ParseHexUint32(notify[5].get_str());
+    header.hashPrevBlock = uint256(vPrev);
+    header.hashMerkleRoot = ComputeMerkleRootFromBranch(Hash(vCoinbase.begin(), vCoinbase.end()), vBranch, 0);
+    header.nBits = ParseHexUint32(notify[6].get_str());
+    header.nTime = ParseHexUint32(notify[7].get_str());
+    header.nNonce = 0;
+    BOOST_CHECK(header.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+
+    arith_uint256 hashTarget;
+    hashTarget.SetCompact(header.nBits);
+    uint256 hashPoW;
+    while (true) {
+        GetPoWHashes(&header, 1, &hashPoW);
+        if (UintToArith256(hashPoW) <= hashTarget)
+            break;
+        BOOST_REQUIRE(++header.nNonce < 100000);
+    }
+
+    // A share for a job that was never handed out.
+    server.ProcessLine(client, SubmitRequest(5, "ffffffff", HexStr(vExtraNonce2), header.nTime, header.nNonce));
+    BOOST_CHECK_EQUAL(ErrorCode(client.Last("")), 21);
+
+    int nHeight = chainActive.Height();
+    server.ProcessLine(client, SubmitRequest(6, strJob, HexStr(vExtraNonce2), header.nTime, header.nNonce));
+    BOOST_CHECK(find_value(client.Last(""), "result").get_bool());
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight + 1);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == header.GetHash());
+    BOOST_CHECK_EQUAL(client.nAccepted, 1);
+
+    server.ProcessLine(client, SubmitRequest(7, strJob, HexStr(vExtraNonce2), header.nTime, header.nNonce));
+    BOOST_CHECK_EQUAL(ErrorCode(client.Last("")), 22);
+
+    // The new tip makes all work stale, and the next job says so.
+    BOOST_CHECK(server.UpdateJob(false));
+    const UniValue notifyNext = find_value(client.Last("mining.notify"), "params");
+    BOOST_CHECK(notifyNext[0].get_str() != strJob);
+    BOOST_CHECK(notifyNext[8].get_bool());
+    server.ProcessLine(client, SubmitRequest(8, strJob, HexStr(vExtraNonce2), header.nTime, header.nNonce + 1));
+    BOOST_CHECK_EQUAL(ErrorCode(client.Last("")), 21);
+
+    server.RemoveClient(&client);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -16,11 +16,13 @@
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -38,6 +40,7 @@ extern void noui_connect();
 
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
+    SHA256AutoDetect();
     ECC_Start();
     SetupEnvironment();
     SetupNetworking();
@@ -45,6 +48,7 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
     fCheckBlockIndex = true;
     SelectParams(chainName);
     noui_connect();
+    InitSignatureCache();
 }
 
 BasicTestingSetup::~BasicTestingSetup()
@@ -6,9 +6,11 @@
 #include "key.h"
 #include "main.h"
 #include "miner.h"
+#include "policy/policy.h"
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
@@ -72,4 +74,52 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_precheck_cache_entries, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CTransaction tx(spend);
+    CMutableTransaction badSpend(spend);
+    badSpend.vin[0].scriptSig = CScript() << std::vector<unsigned char>(vchSig.size(), 0);
+    CTransaction badTx(badSpend);
+
+    LOCK(cs_main);
+    const CCoins* coins = pcoinsTip->AccessCoins(coinbaseTxns[0].GetHash());
+    BOOST_REQUIRE(coins != NULL);
+    PrecomputedTransactionData txdata(tx), badTxdata(badTx);
+
+    // Verified signatures are collected instead of going into the cache.
+    std::vector<uint256> vEntries;
+    uint64_t nInserts = GetSignatureCacheStats().nInserts;
+    BOOST_CHECK(CScriptCheck(*coins, tx, 0, STANDARD_SCRIPT_VERIFY_FLAGS, false, &txdata, &vEntries)());
+    BOOST_CHECK_EQUAL(vEntries.size(), 1U);
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().nInserts, nInserts);
+
+    // Once added, the signature is not verified again.
+    AddSignatureCacheEntries(vEntries);
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().nInserts, nInserts + 1);
+    uint64_t nHits = GetSignatureCacheStats().nHits;
+    BOOST_CHECK(CScriptCheck(*coins, tx, 0, STANDARD_SCRIPT_VERIFY_FLAGS, true, &txdata)());
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().nHits, nHits + 1);
+    EraseSignatureCacheEntries(vEntries);
+
+    // A failing check that only collects entries does not fail the batch it is in.
+    std::vector<uint256> vBadEntries;
+    BOOST_CHECK(!CScriptCheck(*coins, badTx, 0, STANDARD_SCRIPT_VERIFY_FLAGS, false, &badTxdata)());
+    BOOST_CHECK(CScriptCheck(*coins, badTx, 0, STANDARD_SCRIPT_VERIFY_FLAGS, false, &badTxdata, &vBadEntries)());
+    BOOST_CHECK(vBadEntries.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,66 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coins.h"
+#include "main.h"
+#include "txdb.h"
+#include "utxosnapshot.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(utxosnapshot_roundtrip)
+{
+    boost::filesystem::path path = GetDataDir() / "utxo.dat";
+    CUTXOSnapshotInfo info;
+    {
+        LOCK(cs_main);
+        pcoinsTip->Flush();
+        boost::scoped_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
+        BOOST_CHECK(DumpUTXOSnapshot(pcursor.get(), path, Params(), info));
+        BOOST_CHECK(info.hashBlock == chainActive.Tip()->GetBlockHash());
+    }
+    BOOST_CHECK(info.nTransactions > 0);
+
+    // The header alone tells startup which block the snapshot is for.
+    CUTXOSnapshotInfo infoHeader;
+    BOOST_CHECK(ReadUTXOSnapshotInfo(path, Params(), infoHeader));
+    BOOST_CHECK(infoHeader.hashBlock == info.hashBlock);
+    BOOST_CHECK_EQUAL(infoHeader.nTransactions, info.nTransactions);
+
+    // Nothing is pinned for regtest, so the hash has to be given.
+    CUTXOSnapshotInfo infoLoad;
+    CCoinsViewDB viewUnpinned(GetDataDir() / "chainstate_unpinned", 1 << 20, true);
+    BOOST_CHECK(!LoadUTXOSnapshot(&viewUnpinned, path, Params(), uint256(), infoLoad));
+
+    CCoinsViewDB viewWrongHash(GetDataDir() / "chainstate_wronghash", 1 << 20, true);
+    BOOST_CHECK(!LoadUTXOSnapshot(&viewWrongHash, path, Params(), info.hashBlock, infoLoad));
+    BOOST_CHECK(viewWrongHash.GetBestBlock().IsNull());
+
+    CCoinsViewDB view(GetDataDir() / "chainstate_loaded", 1 << 20, true);
+    BOOST_CHECK(LoadUTXOSnapshot(&view, path, Params(), info.hashSerialized, infoLoad));
+    BOOST_CHECK(infoLoad.hashBlock == info.hashBlock);
+    BOOST_CHECK_EQUAL(infoLoad.nTransactions, info.nTransactions);
+    BOOST_CHECK(infoLoad.hashSerialized == info.hashSerialized);
+    BOOST_CHECK(view.GetBestBlock() == info.hashBlock);
+
+    uint256 hashBase, hashSerialized;
+    BOOST_CHECK(view.ReadSnapshotBase(hashBase, hashSerialized));
+    BOOST_CHECK(hashBase == info.hashBlock);
+    BOOST_CHECK(hashSerialized == info.hashSerialized);
+
+    CCoins coins;
+    BOOST_CHECK(view.GetCoins(coinbaseTxns[0].GetHash(), coins));
+    BOOST_CHECK(coins.fCoinBase);
+
+    // A chainstate is only ever loaded once.
+    BOOST_CHECK(!LoadUTXOSnapshot(&view, path, Params(), info.hashSerialized, infoLoad));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -32,12 +32,18 @@ static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SNAPSHOT_BASE = 'S';
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe)
     : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
 {
 }
 
+CCoinsViewDB::CCoinsViewDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+    : db(path, nCacheSize, fMemory, fWipe, true)
+{
+}
+
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
     return db.Read(make_pair(DB_COINS, txid), coins);
@@ -121,6 +127,26 @@ CCoinsViewCursor* CCoinsViewDB::Cursor() const
     return i;
 }
 
+bool CCoinsViewDB::ReadSnapshotBase(uint256& hashBlock, uint256& hashSerialized) const
+{
+    std::pair<uint256, uint256> base;
+    if (!db.Read(DB_SNAPSHOT_BASE, base))
+        return false;
+    hashBlock = base.first;
+    hashSerialized = base.second;
+    return true;
+}
+
+bool CCoinsViewDB::WriteSnapshotBase(const uint256& hashBlock, const uint256& hashSerialized)
+{
+    return db.Write(DB_SNAPSHOT_BASE, std::make_pair(hashBlock, hashSerialized), true);
+}
+
+bool CCoinsViewDB::EraseSnapshotBase()
+{
+    return db.Erase(DB_SNAPSHOT_BASE, true);
+}
+
 bool CCoinsViewDBCursor::GetKey(uint256& key) const
 {
 
@@ -206,7 +232,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
             CDiskBlockIndex diskindex;
             if (pcursor->GetValue(diskindex)) {
 
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
+                // The key is the block hash, so the header does not need to be hashed again.
+                CBlockIndex* pindexNew = insertBlockIndex(key.second);
                 pindexNew->pprev = insertBlockIndex(diskindex.hashPrev);
                 pindexNew->nHeight = diskindex.nHeight;
                 pindexNew->nFile = diskindex.nFile;
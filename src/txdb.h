@@ -22,6 +22,7 @@
 #include <utility>
 #include <vector>
 
+#include <boost/filesystem/path.hpp>
 #include <boost/function.hpp>
 
 class CBlockIndex;
@@ -77,12 +78,19 @@ protected:
 
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    //! Open a coin database somewhere other than chainstate/, e.g. to replay the chain next to the active one.
+    CCoinsViewDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     CCoinsViewCursor* Cursor() const;
+
+    //! The UTXO snapshot this chainstate was loaded from, kept until the chain up to its base block has been validated.
+    bool ReadSnapshotBase(uint256& hashBlock, uint256& hashSerialized) const;
+    bool WriteSnapshotBase(const uint256& hashBlock, const uint256& hashSerialized);
+    bool EraseSnapshotBase();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
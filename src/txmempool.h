@@ -24,6 +24,8 @@
 #include "sync.h"
 
 #undef foreach
+#include <boost/signals2/signal.hpp>
+
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
@@ -504,6 +506,10 @@ public:
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, bool fCurrentEstimate = true);
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, setEntries& setAncestors, bool fCurrentEstimate = true);
 
+    /** Sent when a transaction enters or leaves the pool, with cs held */
+    boost::signals2::signal<void(const uint256&)> NotifyEntryAdded;
+    boost::signals2::signal<void(const uint256&)> NotifyEntryRemoved;
+
     void removeRecursive(const CTransaction& tx, std::list<CTransaction>& removed);
     void removeForReorg(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight, int flags);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
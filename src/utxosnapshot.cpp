@@ -0,0 +1,313 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxosnapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "hash.h"
+#include "init.h"
+#include "main.h"
+#include "protocol.h"
+#include "streams.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+/** Position of the transaction count in the file header, which is only known once all coins are written */
+static const long UTXO_SNAPSHOT_COUNT_OFFSET = 4 + MESSAGE_START_SIZE + 32;
+
+void UTXOSetHashAdd(CHashWriter& ss, const uint256& txid, const CCoins& coins)
+{
+    ss << txid;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        const CTxOut& out = coins.vout[i];
+        if (!out.IsNull()) {
+            ss << VARINT(i + 1);
+            ss << out;
+        }
+    }
+    ss << VARINT(0);
+}
+
+static bool WriteUTXOSnapshot(CAutoFile& file, CCoinsViewCursor* pcursor, const CChainParams& chainparams, CUTXOSnapshotInfo& info)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    info.hashBlock = pcursor->GetBestBlock();
+    info.nTransactions = 0;
+    ss << info.hashBlock;
+
+    file << UTXO_SNAPSHOT_VERSION;
+    file << FLATDATA(chainparams.MessageStart());
+    file << info.hashBlock;
+    file << info.nTransactions;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        uint256 txid;
+        CCoins coins;
+        if (!pcursor->GetKey(txid) || !pcursor->GetValue(coins))
+            return error("%s: unable to read coin database", __func__);
+        file << txid;
+        file << coins;
+        UTXOSetHashAdd(ss, txid, coins);
+        info.nTransactions++;
+        pcursor->Next();
+    }
+    info.hashSerialized = ss.GetHash();
+    file << info.hashSerialized;
+
+    if (fseek(file.Get(), UTXO_SNAPSHOT_COUNT_OFFSET, SEEK_SET) != 0)
+        return error("%s: unable to seek in snapshot file", __func__);
+    file << info.nTransactions;
+    FileCommit(file.Get());
+    return true;
+}
+
+bool DumpUTXOSnapshot(CCoinsViewCursor* pcursor, const boost::filesystem::path& path, const CChainParams& chainparams, CUTXOSnapshotInfo& info)
+{
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path pathTmp = path.string() + ".new";
+    bool fWritten = false;
+    {
+        FILE* filestr = fopen(pathTmp.string().c_str(), "wb");
+        if (!filestr)
+            return error("%s: unable to open %s", __func__, pathTmp.string());
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        try {
+            fWritten = WriteUTXOSnapshot(file, pcursor, chainparams, info);
+        } catch (const std::exception& e) {
+            error("%s: %s", __func__, e.what());
+        }
+    }
+    if (!fWritten || !RenameOver(pathTmp, path)) {
+        boost::filesystem::remove(pathTmp);
+        return error("%s: failed to write %s", __func__, path.string());
+    }
+    LogPrintf("Dumped UTXO snapshot at block %s: %u transactions in %dms\n", info.hashBlock.ToString(), info.nTransactions, GetTimeMillis() - nStart);
+    return true;
+}
+
+static bool ReadUTXOSnapshotHeader(CAutoFile& file, const CChainParams& chainparams, CUTXOSnapshotInfo& info)
+{
+    int nVersion;
+    unsigned char pchMessageStart[MESSAGE_START_SIZE];
+    file >> nVersion;
+    if (nVersion != UTXO_SNAPSHOT_VERSION)
+        return error("%s: unsupported snapshot version %d", __func__, nVersion);
+    file >> FLATDATA(pchMessageStart);
+    if (memcmp(pchMessageStart, chainparams.MessageStart(), MESSAGE_START_SIZE) != 0)
+        return error("%s: snapshot is for a different network", __func__);
+    file >> info.hashBlock;
+    file >> info.nTransactions;
+    return true;
+}
+
+bool ReadUTXOSnapshotInfo(const boost::filesystem::path& path, const CChainParams& chainparams, CUTXOSnapshotInfo& info)
+{
+    FILE* filestr = fopen(path.string().c_str(), "rb");
+    if (!filestr)
+        return error("%s: unable to open %s", __func__, path.string());
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+    try {
+        return ReadUTXOSnapshotHeader(file, chainparams, info);
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+}
+
+bool LoadUTXOSnapshot(CCoinsViewDB* view, const boost::filesystem::path& path, const CChainParams& chainparams, const uint256& hashAssumed, CUTXOSnapshotInfo& info)
+{
+    int64_t nStart = GetTimeMillis();
+    if (!view->GetBestBlock().IsNull())
+        return error("%s: the chain state is not empty", __func__);
+
+    FILE* filestr = fopen(path.string().c_str(), "rb");
+    if (!filestr)
+        return error("%s: unable to open %s", __func__, path.string());
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+    try {
+        if (!ReadUTXOSnapshotHeader(file, chainparams, info))
+            return false;
+
+        uint256 hashExpected = hashAssumed;
+        if (hashExpected.IsNull()) {
+            MapAssumeUTXO::const_iterator it = chainparams.AssumeUTXO().find(info.hashBlock);
+            if (it == chainparams.AssumeUTXO().end())
+                return error("%s: no UTXO set hash is known for block %s, pass one with -assumeutxohash", __func__, info.hashBlock.ToString());
+            hashExpected = it->second;
+        }
+
+        // Written first so that a load that does not complete is noticed at the next startup.
+        if (!view->WriteSnapshotBase(info.hashBlock, hashExpected))
+            return error("%s: failed to write coin database", __func__);
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << info.hashBlock;
+        CCoinsMap mapCoins;
+        for (uint64_t i = 0; i < info.nTransactions; i++) {
+            if (ShutdownRequested())
+                return false;
+            uint256 txid;
+            file >> txid;
+            CCoinsCacheEntry& entry = mapCoins[txid];
+            file >> entry.coins;
+            entry.flags = CCoinsCacheEntry::DIRTY;
+            UTXOSetHashAdd(ss, txid, entry.coins);
+            if (mapCoins.size() >= UTXO_SNAPSHOT_BATCH_SIZE) {
+                if (!view->BatchWrite(mapCoins, uint256()))
+                    return error("%s: failed to write coin database", __func__);
+                LogPrintf("Loaded %u of %u transactions from UTXO snapshot\n", i + 1, info.nTransactions);
+            }
+        }
+        uint256 hashFile;
+        file >> hashFile;
+        info.hashSerialized = ss.GetHash();
+        if (info.hashSerialized != hashFile)
+            return error("%s: snapshot file is corrupt", __func__);
+        if (info.hashSerialized != hashExpected)
+            return error("%s: snapshot hash %s does not match the expected %s", __func__, info.hashSerialized.ToString(), hashExpected.ToString());
+
+        // Only the last batch sets the best block, making the chain state usable.
+        if (!view->BatchWrite(mapCoins, info.hashBlock))
+            return error("%s: failed to write coin database", __func__);
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+
+    LogPrintf("Loaded UTXO snapshot at block %s: %u transactions in %dms\n", info.hashBlock.ToString(), info.nTransactions, GetTimeMillis() - nStart);
+    return true;
+}
+
+static bool HashUTXOSet(CCoinsViewDB* view, uint256& hashSerialized)
+{
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << pcursor->GetBestBlock();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        uint256 txid;
+        CCoins coins;
+        if (!pcursor->GetKey(txid) || !pcursor->GetValue(coins))
+            return error("%s: unable to read coin database", __func__);
+        UTXOSetHashAdd(ss, txid, coins);
+        pcursor->Next();
+    }
+    hashSerialized = ss.GetHash();
+    return true;
+}
+
+/** The chain below the snapshot does not lead to it, so nothing built on the snapshot can be trusted. */
+static void UTXOSnapshotInvalid(const std::string& strMessage)
+{
+    strMiscWarning = strMessage;
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(
+        _("The UTXO snapshot this node was started from does not match the block chain. Restart with -reindex-chainstate to rebuild the chain state."),
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+void ThreadValidateUTXOSnapshot(CCoinsViewDB* pcoinsdbview)
+{
+    const CChainParams& chainparams = Params();
+    uint256 hashBase;
+    uint256 hashSnapshot;
+    if (!pcoinsdbview->ReadSnapshotBase(hashBase, hashSnapshot))
+        return;
+
+    CBlockIndex* pindexBase;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBase);
+        if (mi == mapBlockIndex.end()) {
+            LogPrintf("%s: snapshot block %s is not in the block index\n", __func__, hashBase.ToString());
+            return;
+        }
+        pindexBase = mi->second;
+    }
+
+    // Progress is kept across restarts as long as the scratch chainstate is still on the way to the snapshot block.
+    boost::filesystem::path pathCheck = GetDataDir() / "chainstate_snapshotcheck";
+    boost::scoped_ptr<CCoinsViewDB> pcheckdb(new CCoinsViewDB(pathCheck, UTXO_SNAPSHOT_CHECK_DBCACHE));
+    CBlockIndex* pindex = NULL;
+    uint256 hashResume = pcheckdb->GetBestBlock();
+    if (!hashResume.IsNull()) {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashResume);
+        if (mi != mapBlockIndex.end() && pindexBase->GetAncestor(mi->second->nHeight) == mi->second) {
+            pindex = mi->second;
+        } else {
+            pcheckdb.reset();
+            pcheckdb.reset(new CCoinsViewDB(pathCheck, UTXO_SNAPSHOT_CHECK_DBCACHE, false, true));
+        }
+    }
+
+    LogPrintf("Validating the chain up to UTXO snapshot block %s (height %d), starting at height %d\n",
+              hashBase.ToString(), pindexBase->nHeight, pindex ? pindex->nHeight + 1 : 0);
+    {
+        CCoinsViewCache view(pcheckdb.get());
+        try {
+            while (pindex != pindexBase) {
+                boost::this_thread::interruption_point();
+                CBlockIndex* pindexNext = pindexBase->GetAncestor(pindex ? pindex->nHeight + 1 : 0);
+                CBlock block;
+                if (!ReadBlockFromDisk(block, pindexNext, chainparams.GetConsensus())) {
+                    LogPrintf("%s: unable to read block %s, will retry at the next startup\n", __func__, pindexNext->GetBlockHash().ToString());
+                    view.Flush();
+                    return;
+                }
+                CValidationState state;
+                bool fValid = CheckBlock(block, state, chainparams.GetConsensus());
+                if (fValid) {
+                    LOCK(cs_main);
+                    fValid = ConnectBlock(block, state, pindexNext, view, chainparams, true);
+                }
+                if (!fValid) {
+                    UTXOSnapshotInvalid(strprintf("Block %s below the UTXO snapshot is invalid: %s", pindexNext->GetBlockHash().ToString(), FormatStateMessage(state)));
+                    return;
+                }
+                view.SetBestBlock(pindexNext->GetBlockHash());
+                pindex = pindexNext;
+
+                if (view.DynamicMemoryUsage() > UTXO_SNAPSHOT_CHECK_CACHE)
+                    view.Flush();
+                if (pindex->nHeight % 10000 == 0)
+                    LogPrintf("Validated the chain under the UTXO snapshot up to height %d\n", pindex->nHeight);
+            }
+        } catch (const boost::thread_interrupted&) {
+            view.Flush();
+            throw;
+        }
+        view.Flush();
+    }
+
+    uint256 hashSerialized;
+    if (!HashUTXOSet(pcheckdb.get(), hashSerialized))
+        return;
+    if (hashSerialized != hashSnapshot) {
+        UTXOSnapshotInvalid(strprintf("UTXO snapshot hash %s does not match %s computed from the chain", hashSnapshot.ToString(), hashSerialized.ToString()));
+        return;
+    }
+
+    LogPrintf("UTXO snapshot at block %s validated against the chain\n", hashBase.ToString());
+    pcoinsdbview->EraseSnapshotBase();
+    pcheckdb.reset();
+    boost::filesystem::remove_all(pathCheck);
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXOSNAPSHOT_H
+#define BITCOIN_UTXOSNAPSHOT_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+
+#include <boost/filesystem/path.hpp>
+
+class CChainParams;
+class CCoins;
+class CCoinsViewCursor;
+class CCoinsViewDB;
+class CHashWriter;
+
+/** Version of the file format written by dumptxoutset */
+static const int UTXO_SNAPSHOT_VERSION = 1;
+/** Number of transactions written to the chainstate per database batch while loading a snapshot */
+static const unsigned int UTXO_SNAPSHOT_BATCH_SIZE = 100000;
+/** Database cache of the scratch chainstate used to validate a loaded snapshot, in bytes */
+static const size_t UTXO_SNAPSHOT_CHECK_DBCACHE = 8 << 20;
+/** Coins cache of the scratch chainstate before it is flushed, in bytes */
+static const size_t UTXO_SNAPSHOT_CHECK_CACHE = 64 << 20;
+
+/** Summary of a UTXO snapshot file */
+struct CUTXOSnapshotInfo {
+    //! Block the snapshot was taken at
+    uint256 hashBlock;
+    //! Number of transactions with unspent outputs
+    uint64_t nTransactions;
+    //! Hash of the set, as reported by gettxoutsetinfo
+    uint256 hashSerialized;
+
+    CUTXOSnapshotInfo() : nTransactions(0) {}
+};
+
+/**
+ * Add the unspent outputs of one transaction to a UTXO set hash. The hash
+ * starts with the best block hash and then covers all transactions in
+ * database order.
+ */
+void UTXOSetHashAdd(CHashWriter& ss, const uint256& txid, const CCoins& coins);
+
+/** Stream the coins under pcursor to a snapshot file at path. */
+bool DumpUTXOSnapshot(CCoinsViewCursor* pcursor, const boost::filesystem::path& path, const CChainParams& chainparams, CUTXOSnapshotInfo& info);
+
+/** Read the block and transaction count from the header of a snapshot file, without loading it. */
+bool ReadUTXOSnapshotInfo(const boost::filesystem::path& path, const CChainParams& chainparams, CUTXOSnapshotInfo& info);
+
+/**
+ * Bulk load a snapshot file into an empty chainstate. The snapshot must hash
+ * to hashAssumed or, if that is null, to the value chainparams pins for its
+ * block. The chainstate is marked so that ThreadValidateUTXOSnapshot checks it.
+ */
+bool LoadUTXOSnapshot(CCoinsViewDB* view, const boost::filesystem::path& path, const CChainParams& chainparams, const uint256& hashAssumed, CUTXOSnapshotInfo& info);
+
+/**
+ * Replay the chain up to the base block of the snapshot the chainstate was
+ * loaded from in a scratch chainstate, and compare the result with the
+ * snapshot. Shuts the node down if they differ.
+ */
+void ThreadValidateUTXOSnapshot(CCoinsViewDB* pcoinsdbview);
+
+#endif // BITCOIN_UTXOSNAPSHOT_H
@@ -12,6 +12,7 @@
 #include "wallet/test/wallet_test_fixture.h"
 
 #include <boost/foreach.hpp>
+#include <boost/uuid/uuid_generators.hpp>
 #include <boost/test/unit_test.hpp>
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
@@ -298,4 +299,105 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
 }
 
+BOOST_AUTO_TEST_CASE(key_owner_index)
+{
+    CAccount* accountA = new CAccount();
+    CAccount* accountB = new CAccount();
+    pwalletMain->addAccount(accountA, "A");
+    pwalletMain->addAccount(accountB, "B");
+
+    LOCK(pwalletMain->cs_wallet);
+
+    CPubKey keyA1 = pwalletMain->GenerateNewKey(*accountA, KEYCHAIN_EXTERNAL);
+    CPubKey keyA2 = pwalletMain->GenerateNewKey(*accountA, KEYCHAIN_CHANGE);
+    CPubKey keyB = pwalletMain->GenerateNewKey(*accountB, KEYCHAIN_EXTERNAL);
+    CKey unknown;
+    unknown.MakeNewKey(true);
+
+    BOOST_CHECK(pwalletMain->HaveKey(keyA1.GetID()));
+    BOOST_CHECK(pwalletMain->HaveKey(keyB.GetID()));
+    BOOST_CHECK(!pwalletMain->HaveKey(unknown.GetPubKey().GetID()));
+
+    CPubKey found;
+    BOOST_CHECK(pwalletMain->GetPubKey(keyA2.GetID(), found));
+    BOOST_CHECK(found == keyA2);
+    CKey secret;
+    BOOST_CHECK(pwalletMain->GetKey(keyB.GetID(), secret));
+    BOOST_CHECK(secret.GetPubKey() == keyB);
+
+    BOOST_CHECK_EQUAL(::IsMine(*pwalletMain, GetScriptForDestination(keyA1.GetID())), ISMINE_SPENDABLE);
+    BOOST_CHECK_EQUAL(::IsMine(*pwalletMain, GetScriptForRawPubKey(keyB)), ISMINE_SPENDABLE);
+    BOOST_CHECK_EQUAL(::IsMine(*pwalletMain, GetScriptForDestination(unknown.GetPubKey().GetID())), ISMINE_NO);
+
+    // A multisig output is only spendable when a single account holds all of its keys.
+    std::vector<CPubKey> vSameAccount = { keyA1, keyA2 };
+    std::vector<CPubKey> vCrossAccount = { keyA1, keyB };
+    BOOST_CHECK_EQUAL(::IsMine(*pwalletMain, GetScriptForMultisig(2, vSameAccount)), ISMINE_SPENDABLE);
+    BOOST_CHECK_EQUAL(::IsMine(*pwalletMain, GetScriptForMultisig(2, vCrossAccount)), ISMINE_NO);
+
+    // Keys already held by an account are picked up when the account is added to the wallet.
+    CAccount* accountC = new CAccount();
+    CPubKey keyC = pwalletMain->GenerateNewKey(*accountC, KEYCHAIN_EXTERNAL);
+    BOOST_CHECK(!pwalletMain->HaveKey(keyC.GetID()));
+    pwalletMain->addAccount(accountC, "C");
+    BOOST_CHECK(pwalletMain->HaveKey(keyC.GetID()));
+    BOOST_CHECK_EQUAL(::IsMine(*pwalletMain, GetScriptForDestination(keyC.GetID())), ISMINE_SPENDABLE);
+
+    CScript redeemScript = GetScriptForMultisig(1, vSameAccount);
+    CScript fetched;
+    BOOST_CHECK(!pwalletMain->HaveCScript(CScriptID(redeemScript)));
+    BOOST_CHECK(pwalletMain->AddCScript(redeemScript));
+    BOOST_CHECK(pwalletMain->HaveCScript(CScriptID(redeemScript)));
+    BOOST_CHECK(pwalletMain->GetCScript(CScriptID(redeemScript), fetched));
+    BOOST_CHECK(fetched == redeemScript);
+}
+
+BOOST_AUTO_TEST_CASE(account_children_index)
+{
+    CAccount* parent = new CAccount();
+    CAccount* child = new CAccount();
+    CAccount* other = new CAccount();
+    parent->AddChild(child);
+    pwalletMain->addAccount(parent, "Parent");
+    pwalletMain->addAccount(child, "Child");
+    pwalletMain->addAccount(other, "Other");
+
+    LOCK(pwalletMain->cs_wallet);
+    BOOST_CHECK_EQUAL(pwalletMain->mapAccountChildren.count(parent->getUUID()), 1U);
+    BOOST_CHECK(pwalletMain->mapAccountChildren.find(parent->getUUID())->second == child);
+    BOOST_CHECK_EQUAL(pwalletMain->mapAccountChildren.count(child->getUUID()), 0U);
+    BOOST_CHECK_EQUAL(pwalletMain->mapAccountChildren.count(""), 0U);
+
+    // Loading an account again replaces its entry rather than adding a second one.
+    pwalletMain->LoadAccount(child);
+    BOOST_CHECK_EQUAL(pwalletMain->mapAccountChildren.count(parent->getUUID()), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(keypool_reserve_with_pending_topup)
+{
+    CExtKey accountKey;
+    const std::vector<unsigned char> hashkey = { 'G', 'u', 'l', 'd', 'e', 'n', ' ', 'b', 'i', 'p', '3', '2' };
+    std::vector<unsigned char> vchSeed(32, 1);
+    accountKey.SetMaster(hashkey, &vchSeed[0], vchSeed.size());
+    CAccountHD* account = new CAccountHD(accountKey, boost::uuids::nil_generator()());
+    pwalletMain->addAccount(account, "HD");
+
+    LOCK(pwalletMain->cs_wallet);
+    BOOST_CHECK(account->setKeyPoolExternal.empty());
+
+    // Another top-up has reserved more keys than the pool needs, but not added them yet.
+    std::pair<const CAccount*, int> pending = std::make_pair((const CAccount*)account, (int)KEYCHAIN_EXTERNAL);
+    pwalletMain->mapKeyPoolPending[pending] = 100;
+
+    int64_t nIndex;
+    CKeyPool keypool;
+    pwalletMain->ReserveKeyFromKeyPool(nIndex, keypool, account, KEYCHAIN_EXTERNAL);
+    BOOST_CHECK(nIndex != -1);
+    BOOST_CHECK(keypool.vchPubKey.IsValid());
+    BOOST_CHECK(account->HaveKey(keypool.vchPubKey.GetID()));
+    BOOST_CHECK_EQUAL(pwalletMain->mapKeyPoolPending[pending], 100U);
+    pwalletMain->ReturnKey(nIndex, account, KEYCHAIN_EXTERNAL);
+    pwalletMain->mapKeyPoolPending.erase(pending);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
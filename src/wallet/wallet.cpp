@@ -19,6 +19,7 @@
 #include "coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/ripemd160.h"
 #include "key.h"
 #include "keystore.h"
 #include "main.h"
@@ -28,6 +29,7 @@
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "script/sign.h"
+#include "script/standard.h"
 #include "timedata.h"
 #include "txmempool.h"
 #include "util.h"
@@ -37,9 +39,11 @@
 #include "init.h"
 
 #include <assert.h>
+#include <atomic>
 #include "script/ismine.h"
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 #include <boost/uuid/nil_generator.hpp>
@@ -70,64 +74,66 @@ void ThreadShadowPoolManager()
         long milliSleep = 100;
 
         if (pwalletMain) {
-            LOCK(pwalletMain->cs_wallet);
-
             milliSleep = 500;
 
             int numNew = 0;
             bool dolock = true;
-            for (const auto& seedIter : pwalletMain->mapSeeds) {
+            {
+                LOCK(pwalletMain->cs_wallet);
+                for (const auto& seedIter : pwalletMain->mapSeeds) {
 
-                if (seedIter.second->m_type != CHDSeed::CHDSeed::BIP44 && seedIter.second->m_type != CHDSeed::CHDSeed::BIP44External && seedIter.second->m_type != CHDSeed::CHDSeed::BIP44NoHardening)
-                    continue;
+                    if (seedIter.second->m_type != CHDSeed::CHDSeed::BIP44 && seedIter.second->m_type != CHDSeed::CHDSeed::BIP44External && seedIter.second->m_type != CHDSeed::CHDSeed::BIP44NoHardening)
+                        continue;
 
-                for (const auto shadowSubType : { AccountSubType::Desktop, AccountSubType::Mobi }) {
-                    int numShadow = 0;
-                    {
-                        for (const auto& accountPair : pwalletMain->mapAccounts) {
-                            if (accountPair.second->IsHD() && ((CAccountHD*)accountPair.second)->getSeedUUID() == seedIter.second->getUUID()) {
-                                if (accountPair.second->m_SubType == shadowSubType) {
-                                    if (accountPair.second->m_Type == AccountType::Shadow) {
-                                        ++numShadow;
+                    for (const auto shadowSubType : { AccountSubType::Desktop, AccountSubType::Mobi }) {
+                        int numShadow = 0;
+                        {
+                            for (const auto& accountPair : pwalletMain->mapAccounts) {
+                                if (accountPair.second->IsHD() && ((CAccountHD*)accountPair.second)->getSeedUUID() == seedIter.second->getUUID()) {
+                                    if (accountPair.second->m_SubType == shadowSubType) {
+                                        if (accountPair.second->m_Type == AccountType::Shadow) {
+                                            ++numShadow;
+                                        }
                                     }
                                 }
                             }
                         }
-                    }
-                    if (numShadow < GetArg("-accountpool", 10)) {
-                        dolock = false;
-                        if (!pwalletMain->IsLocked()) {
-                            pwalletMain->delayLock = true;
-                            CWalletDB db(pwalletMain->strWalletFile);
-                            while (numShadow < GetArg("-accountpool", 10)) {
-                                ++numShadow;
-                                ++numNew;
-                                depth = 1;
+                        if (numShadow < GetArg("-accountpool", 10)) {
+                            dolock = false;
+                            if (!pwalletMain->IsLocked()) {
+                                pwalletMain->delayLock = true;
+                                CWalletDB db(pwalletMain->strWalletFile);
+                                while (numShadow < GetArg("-accountpool", 10)) {
+                                    ++numShadow;
+                                    ++numNew;
+                                    depth = 1;
 
-                                CAccountHD* newShadow = seedIter.second->GenerateAccount(shadowSubType, &db);
+                                    CAccountHD* newShadow = seedIter.second->GenerateAccount(shadowSubType, &db);
 
-                                if (newShadow == NULL)
-                                    break;
+                                    if (newShadow == NULL)
+                                        break;
 
-                                newShadow->m_Type = AccountType::Shadow;
+                                    newShadow->m_Type = AccountType::Shadow;
 
-                                pwalletMain->addAccount(newShadow, "Shadow");
+                                    pwalletMain->addAccount(newShadow, "Shadow");
 
-                                if (numNew > 2) {
-                                    milliSleep = 100;
-                                    break;
+                                    if (numNew > 2) {
+                                        milliSleep = 100;
+                                        break;
+                                    }
+                                }
+                            } else {
+                                pwalletMain->wantDelayLock = true;
+                                if (numShadow < 2) {
+                                    uiInterface.RequestUnlock(pwalletMain, _("Wallet unlock required for account creation"));
                                 }
-                            }
-                        } else {
-                            pwalletMain->wantDelayLock = true;
-                            if (numShadow < 2) {
-                                uiInterface.RequestUnlock(pwalletMain, _("Wallet unlock required for account creation"));
                             }
                         }
                     }
                 }
             }
 
+            // Without cs_wallet, so that HD keys for the pool are derived while the wallet stays usable.
             if (numNew == 0) {
                 int targetPoolDepth = GetArg("-keypool", 40);
                 int numToAllocatePerRound = 5;
@@ -155,6 +161,7 @@ void ThreadShadowPoolManager()
                 }
             }
             if (dolock) {
+                LOCK(pwalletMain->cs_wallet);
                 if (pwalletMain->didDelayLock) {
                     pwalletMain->delayLock = false;
                     pwalletMain->wantDelayLock = false;
@@ -207,13 +214,24 @@ std::string COutput::ToString() const
 }
 
 isminetype IsMine(const CWallet& wallet, const CTxDestination& dest)
+{
+    CScript script = GetScriptForDestination(dest);
+    return IsMine(wallet, script);
+}
+
+isminetype IsMine(const CWallet& wallet, const CScript& scriptPubKey)
 {
     LOCK(wallet.cs_wallet);
 
+    // Only accounts that hold one of the keys or scripts involved can own the output, so there is no need to run the
+    // solver against every other account in the wallet.
+    std::set<CAccount*> setOwners;
+    wallet.GetScriptOwners(scriptPubKey, setOwners);
+
     isminetype ret = isminetype::ISMINE_NO;
-    for (const auto& accountItem : wallet.mapAccounts) {
+    for (const auto& account : setOwners) {
         for (auto keyChain : { KEYCHAIN_EXTERNAL, KEYCHAIN_CHANGE }) {
-            isminetype temp = (keyChain == KEYCHAIN_EXTERNAL ? IsMine(accountItem.second->externalKeyStore, dest) : IsMine(accountItem.second->internalKeyStore, dest));
+            isminetype temp = (keyChain == KEYCHAIN_EXTERNAL ? IsMine(account->externalKeyStore, scriptPubKey) : IsMine(account->internalKeyStore, scriptPubKey));
             if (temp > ret)
                 ret = temp;
         }
@@ -221,19 +239,225 @@ isminetype IsMine(const CWallet& wallet, const CTxDestination& dest)
     return ret;
 }
 
-isminetype IsMine(const CWallet& wallet, const CScript& scriptPubKey)
+void CWallet::IndexKeyOwner(const CKeyID& keyID, CAccount* forAccount)
 {
-    LOCK(wallet.cs_wallet);
+    AssertLockHeld(cs_wallet);
 
-    isminetype ret = isminetype::ISMINE_NO;
-    for (const auto& accountItem : wallet.mapAccounts) {
-        for (auto keyChain : { KEYCHAIN_EXTERNAL, KEYCHAIN_CHANGE }) {
-            isminetype temp = (keyChain == KEYCHAIN_EXTERNAL ? IsMine(accountItem.second->externalKeyStore, scriptPubKey) : IsMine(accountItem.second->internalKeyStore, scriptPubKey));
-            if (temp > ret)
-                ret = temp;
+    auto range = mapKeyOwners.equal_range(keyID);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == forAccount)
+            return;
+    }
+    mapKeyOwners.insert(std::make_pair(keyID, forAccount));
+    if (fAccountTxsStale)
+        return;
+    auto it = mapKeyTxs.find(keyID);
+    if (it != mapKeyTxs.end()) {
+        mapAccountTxs[forAccount].insert(it->second.begin(), it->second.end());
+        MarkBalancesDirty();
+    }
+}
+
+void CWallet::IndexScriptOwner(const CScriptID& scriptID, CAccount* forAccount)
+{
+    AssertLockHeld(cs_wallet);
+
+    auto range = mapScriptOwners.equal_range(scriptID);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == forAccount)
+            return;
+    }
+    mapScriptOwners.insert(std::make_pair(scriptID, forAccount));
+    if (fAccountTxsStale)
+        return;
+    auto it = mapScriptTxs.find(scriptID);
+    if (it != mapScriptTxs.end()) {
+        mapAccountTxs[forAccount].insert(it->second.begin(), it->second.end());
+        MarkBalancesDirty();
+    }
+}
+
+void CWallet::IndexAccountKeys(CAccount* forAccount)
+{
+    AssertLockHeld(cs_wallet);
+
+    std::set<CKeyID> setAddress;
+    forAccount->GetKeys(setAddress);
+    for (const auto& keyID : setAddress)
+        IndexKeyOwner(keyID, forAccount);
+}
+
+void CWallet::GetScriptOwnerIDs(const CScript& scriptPubKey, std::vector<CKeyID>& vKeyIDs, std::vector<CScriptID>& vScriptIDs)
+{
+    // Mirrors the lookups done by IsMine(const CKeyStore&, const CScript&).
+    // Watch-only scripts are not indexed as accounts do not support them.
+    std::vector<std::vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions))
+        return;
+
+    switch (whichType) {
+    case TX_NONSTANDARD:
+    case TX_NULL_DATA:
+        break;
+    case TX_PUBKEY:
+        vKeyIDs.push_back(CPubKey(vSolutions[0]).GetID());
+        break;
+    case TX_PUBKEYHASH:
+    case TX_WITNESS_V0_KEYHASH:
+        vKeyIDs.push_back(CKeyID(uint160(vSolutions[0])));
+        break;
+    case TX_SCRIPTHASH:
+        // The redeem script is only ever resolved against the keystore that holds it, so its owners are sufficient.
+        vScriptIDs.push_back(CScriptID(uint160(vSolutions[0])));
+        break;
+    case TX_WITNESS_V0_SCRIPTHASH: {
+        uint160 hash;
+        CRIPEMD160().Write(&vSolutions[0][0], vSolutions[0].size()).Finalize(hash.begin());
+        vScriptIDs.push_back(CScriptID(hash));
+        break;
+    }
+    case TX_MULTISIG:
+        for (unsigned int i = 1; i + 1 < vSolutions.size(); ++i)
+            vKeyIDs.push_back(CPubKey(vSolutions[i]).GetID());
+        break;
+    }
+}
+
+bool CWallet::HaveAnyOwner(const std::vector<CKeyID>& vKeyIDs, const std::vector<CScriptID>& vScriptIDs) const
+{
+    AssertLockHeld(cs_wallet);
+
+    for (const auto& keyID : vKeyIDs) {
+        if (mapKeyOwners.count(keyID))
+            return true;
+    }
+    for (const auto& scriptID : vScriptIDs) {
+        if (mapScriptOwners.count(scriptID))
+            return true;
+    }
+    return false;
+}
+
+void CWallet::GetScriptOwners(const CScript& scriptPubKey, std::set<CAccount*>& setOwners) const
+{
+    AssertLockHeld(cs_wallet);
+
+    std::vector<CKeyID> vKeyIDs;
+    std::vector<CScriptID> vScriptIDs;
+    GetScriptOwnerIDs(scriptPubKey, vKeyIDs, vScriptIDs);
+
+    for (const auto& keyID : vKeyIDs) {
+        auto range = mapKeyOwners.equal_range(keyID);
+        for (auto it = range.first; it != range.second; ++it)
+            setOwners.insert(it->second);
+    }
+    for (const auto& scriptID : vScriptIDs) {
+        auto range = mapScriptOwners.equal_range(scriptID);
+        for (auto it = range.first; it != range.second; ++it)
+            setOwners.insert(it->second);
+    }
+}
+
+void CWallet::IndexOwnerTxs(const CScript& scriptPubKey, const std::set<uint256>& setTxs) const
+{
+    std::vector<CKeyID> vKeyIDs;
+    std::vector<CScriptID> vScriptIDs;
+    GetScriptOwnerIDs(scriptPubKey, vKeyIDs, vScriptIDs);
+    for (const auto& keyID : vKeyIDs)
+        mapKeyTxs[keyID].insert(setTxs.begin(), setTxs.end());
+    for (const auto& scriptID : vScriptIDs)
+        mapScriptTxs[scriptID].insert(setTxs.begin(), setTxs.end());
+}
+
+void CWallet::IndexAccountTxs(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet);
+
+    const uint256& hash = wtx.GetHash();
+
+    // Accounts receiving an output, together with any wallet transactions already spending it.
+    std::set<CAccount*> setOwners;
+    std::set<uint256> setTxs;
+    for (unsigned int i = 0; i < wtx.vout.size(); ++i) {
+        setTxs.clear();
+        setTxs.insert(hash);
+        std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(hash, i));
+        for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+            setTxs.insert(it->second);
+        IndexOwnerTxs(wtx.vout[i].scriptPubKey, setTxs);
+
+        setOwners.clear();
+        GetScriptOwners(wtx.vout[i].scriptPubKey, setOwners);
+        for (const auto& account : setOwners)
+            mapAccountTxs[account].insert(setTxs.begin(), setTxs.end());
+    }
+
+    // Accounts debited by an input.
+    setTxs.clear();
+    setTxs.insert(hash);
+    setOwners.clear();
+    BOOST_FOREACH (const CTxIn& txin, wtx.vin) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
+        if (mi != mapWallet.end() && txin.prevout.n < mi->second.vout.size()) {
+            IndexOwnerTxs(mi->second.vout[txin.prevout.n].scriptPubKey, setTxs);
+            GetScriptOwners(mi->second.vout[txin.prevout.n].scriptPubKey, setOwners);
         }
     }
-    return ret;
+    for (const auto& account : setOwners)
+        mapAccountTxs[account].insert(hash);
+}
+
+void CWallet::MarkAccountTxsStale()
+{
+    fAccountTxsStale = true;
+    MarkBalancesDirty();
+}
+
+const std::set<uint256>& CWallet::GetAccountTxs(const CAccount* forAccount) const
+{
+    AssertLockHeld(cs_wallet);
+
+    if (fAccountTxsStale) {
+        mapAccountTxs.clear();
+        mapKeyTxs.clear();
+        mapScriptTxs.clear();
+        for (const auto& item : mapWallet)
+            IndexAccountTxs(item.second);
+        fAccountTxsStale = false;
+    }
+    return mapAccountTxs[forAccount];
+}
+
+CWallet::CAccountBalances& CWallet::GetAccountBalances(const CAccount* forAccount) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    CAccountBalances& balances = mapAccountBalances[forAccount];
+    unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    if (balances.nGeneration == nBalanceGeneration && balances.pindexTip == chainActive.Tip() && balances.nMempoolUpdated == nMempoolUpdated)
+        return balances;
+
+    balances = CAccountBalances();
+    balances.nGeneration = nBalanceGeneration;
+    balances.pindexTip = chainActive.Tip();
+    balances.nMempoolUpdated = nMempoolUpdated;
+    for (const auto& hash : GetAccountTxs(forAccount)) {
+        std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            continue;
+        const CWalletTx* pcoin = &(*it).second;
+        if (!::IsMine(forAccount, *pcoin))
+            continue;
+
+        if (pcoin->IsTrusted())
+            balances.nBalance += pcoin->GetAvailableCredit(true, forAccount);
+        else if (pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
+            balances.nUnconfirmed += pcoin->GetAvailableCredit(true, forAccount);
+        balances.nImmature += pcoin->GetImmatureCredit(true, forAccount);
+    }
+    return balances;
 }
 
 CWallet::~CWallet()
@@ -273,6 +497,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey& pubkey, CAccount&
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!forAccount.AddKeyPubKey(secret, pubkey, nKeyChain))
         return false;
+    IndexKeyOwner(pubkey.GetID(), &forAccount);
 
     CScript script;
     script = GetScriptForDestination(pubkey.GetID());
@@ -378,6 +603,7 @@ bool CWallet::AddKeyPubKey(int64_t HDKeyIndex, const CPubKey& pubkey, CAccount&
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!forAccount.AddKeyPubKey(HDKeyIndex, pubkey, keyChain))
         return false;
+    IndexKeyOwner(pubkey.GetID(), &forAccount);
 
     CScript script;
     script = GetScriptForDestination(pubkey.GetID());
@@ -409,7 +635,11 @@ bool CWallet::LoadCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigne
     if (mapAccounts.find(forAccount) == mapAccounts.end())
         return false;
 
-    return mapAccounts[forAccount]->AddCryptedKey(vchPubKey, vchCryptedSecret, nKeyChain);
+    CAccount* account = mapAccounts[forAccount];
+    if (!account->AddCryptedKey(vchPubKey, vchCryptedSecret, nKeyChain))
+        return false;
+    IndexKeyOwner(vchPubKey.GetID(), account);
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
@@ -419,6 +649,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
     bool ret = false;
     for (auto accountPair : mapAccounts) {
         if (accountPair.second->AddCScript(redeemScript)) {
+            IndexScriptOwner(CScriptID(redeemScript), accountPair.second);
             ret = true;
             break;
         }
@@ -449,8 +680,10 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
     bool ret = false;
     for (auto accountPair : mapAccounts) {
         ret = accountPair.second->AddCScript(redeemScript);
-        if (ret == true)
+        if (ret == true) {
+            IndexScriptOwner(CScriptID(redeemScript), accountPair.second);
             break;
+        }
     }
     return ret;
 }
@@ -1071,6 +1304,12 @@ CAccountHD* CWallet::CreateReadOnlyAccount(std::string strAccount, SecureString
     return newAccount;
 }
 
+void CWalletTx::MarkWalletBalancesDirty() const
+{
+    if (pwallet)
+        pwallet->MarkBalancesDirty();
+}
+
 void CWallet::MarkDirty()
 {
     {
@@ -1099,6 +1338,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         AddToSpends(hash);
+        MarkAccountTxsStale();
         BOOST_FOREACH (const CTxIn& txin, wtx.vin) {
             if (mapWallet.count(txin.prevout.hash)) {
                 CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -1188,6 +1428,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             if (!pwalletdb->WriteTx(wtx))
                 return false;
 
+        if (!fAccountTxsStale)
+            IndexAccountTxs(wtx);
         wtx.MarkDirty();
 
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1661,10 +1903,75 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
     }
 }
 
+/** A block read ahead of the wallet during a rescan, with the key and script ids paid to by each of its transactions. */
+struct CRescanBlock {
+    CBlockIndex* pindex;
+    CBlock block;
+    bool fRead;
+    std::vector<std::vector<CKeyID> > vKeyIDs;
+    std::vector<std::vector<CScriptID> > vScriptIDs;
+
+    CRescanBlock(CBlockIndex* pindexIn) : pindex(pindexIn), fRead(false) {}
+};
+
+static void ThreadReadRescanBlocks(std::vector<CRescanBlock>* pvBlocks, std::atomic<unsigned int>* pnNext)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    while (true) {
+        unsigned int nIndex = (*pnNext)++;
+        if (nIndex >= pvBlocks->size())
+            return;
+
+        CRescanBlock& entry = (*pvBlocks)[nIndex];
+        if (!ReadBlockFromDisk(entry.block, entry.pindex, consensusParams))
+            continue;
+        entry.vKeyIDs.resize(entry.block.vtx.size());
+        entry.vScriptIDs.resize(entry.block.vtx.size());
+        for (unsigned int i = 0; i < entry.block.vtx.size(); ++i) {
+            BOOST_FOREACH (const CTxOut& txout, entry.block.vtx[i].vout)
+                CWallet::GetScriptOwnerIDs(txout.scriptPubKey, entry.vKeyIDs[i], entry.vScriptIDs[i]);
+        }
+        entry.fRead = true;
+    }
+}
+
+/**
+ * Fill vBlocks with up to RESCAN_BATCH_SIZE active chain blocks, starting at pindex (or just after it if fAfter is set),
+ * and start reading them. A pindex that is no longer in the active chain resumes from where the chain forks off.
+ */
+static void StartRescanBatch(CBlockIndex* pindex, bool fAfter, std::vector<CRescanBlock>& vBlocks, std::atomic<unsigned int>& nNext, std::vector<boost::thread>& readers, int nThreads)
+{
+    vBlocks.clear();
+    {
+        LOCK(cs_main);
+        if (pindex && !chainActive.Contains(pindex))
+            pindex = chainActive.Next(chainActive.FindFork(pindex));
+        else if (pindex && fAfter)
+            pindex = chainActive.Next(pindex);
+        while (pindex && vBlocks.size() < RESCAN_BATCH_SIZE) {
+            vBlocks.push_back(CRescanBlock(pindex));
+            pindex = chainActive.Next(pindex);
+        }
+    }
+    nNext = 0;
+    for (int i = 0; i < std::min(nThreads, (int)vBlocks.size()); ++i)
+        readers.push_back(boost::thread(boost::bind(&ThreadReadRescanBlocks, &vBlocks, &nNext)));
+}
+
+static void JoinRescanReaders(std::vector<boost::thread>& readers)
+{
+    BOOST_FOREACH (boost::thread& reader, readers)
+        reader.join();
+    readers.clear();
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ * Blocks are read in batches of RESCAN_BATCH_SIZE by up to
+ * MAX_RESCAN_THREADS reader threads, one batch ahead of the one being
+ * added to the wallet, which still happens in chain order.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -1673,6 +1980,8 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart;
+    double dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1680,35 +1989,76 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex) {
-            LEAVE_CRITICAL_SECTION(cs_main)
-            LEAVE_CRITICAL_SECTION(cs_wallet)
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
-
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-            }
-            ENTER_CRITICAL_SECTION(cs_main)
-            ENTER_CRITICAL_SECTION(cs_wallet)
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+    }
+
+    // Blocks are read from disk and their outputs reduced to key and script ids on reader threads, one batch ahead of
+    // the batch being committed. cs_main and cs_wallet are only taken to pick a batch and to hand the transactions
+    // that can involve the wallet to AddToWalletIfInvolvingMe in chain order.
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_RESCAN_THREADS));
+    std::vector<CRescanBlock> vBatch;
+    std::vector<CRescanBlock> vNextBatch;
+    std::atomic<unsigned int> nNext(0);
+    std::vector<boost::thread> readers;
+
+    StartRescanBatch(pindex, false, vNextBatch, nNext, readers, nThreads);
+    while (!vNextBatch.empty()) {
+        JoinRescanReaders(readers);
+        vBatch.swap(vNextBatch);
+        StartRescanBatch(vBatch.back().pindex, true, vNextBatch, nNext, readers, nThreads);
+
+        if (ShutdownRequested()) {
+            JoinRescanReaders(readers);
+            return ret;
+        }
 
-            if (ShutdownRequested())
-                return ret;
+        pindex = vBatch.front().pindex;
+        if (dProgressTip - dProgressStart > 0.0) {
+            ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+        CBlockIndex* pindexReorg = NULL;
+        {
+            LOCK2(cs_main, cs_wallet);
+
+            BOOST_FOREACH (CRescanBlock& entry, vBatch) {
+                if (!chainActive.Contains(entry.pindex)) {
+                    pindexReorg = entry.pindex;
+                    break;
+                }
+                if (!entry.fRead)
+                    continue;
+                for (unsigned int i = 0; i < entry.block.vtx.size(); ++i) {
+                    const CTransaction& tx = entry.block.vtx[i];
+
+                    // Anything AddToWalletIfInvolvingMe could act on pays to a key or script of ours, spends or
+                    // conflicts with a wallet transaction, or is already in the wallet.
+                    bool fInvolvesMe = HaveAnyOwner(entry.vKeyIDs[i], entry.vScriptIDs[i]) || (fUpdate && mapWallet.count(tx.GetHash()));
+                    BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+                        if (fInvolvesMe)
+                            break;
+                        fInvolvesMe = mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout);
+                    }
+                    if (fInvolvesMe && AddToWalletIfInvolvingMe(tx, &entry.block, fUpdate))
+                        ret++;
+                }
+                pindex = entry.pindex;
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+        if (pindexReorg) {
+            // The chain moved under us; drop the read ahead and continue from where the new chain forks off.
+            JoinRescanReaders(readers);
+            StartRescanBatch(pindexReorg, false, vNextBatch, nNext, readers, nThreads);
+        }
+
+        if (GetTime() >= nNow + 60) {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+        }
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -2016,10 +2366,11 @@ CAmount CWallet::GetBalance(const CAccount* forAccount, bool includeChildren) co
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!forAccount || ::IsMine(forAccount, *pcoin)) {
+        if (forAccount) {
+            nTotal = GetAccountBalances(forAccount).nBalance;
+        } else {
+            for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+                const CWalletTx* pcoin = &(*it).second;
                 if (pcoin->IsTrusted()) {
                     nTotal += pcoin->GetAvailableCredit(true, forAccount);
                 }
@@ -2027,12 +2378,10 @@ CAmount CWallet::GetBalance(const CAccount* forAccount, bool includeChildren) co
         }
     }
     if (forAccount && includeChildren) {
-        for (const auto& accountItem : mapAccounts) {
-            const auto& childAccount = accountItem.second;
-            if (childAccount->getParentUUID() == forAccount->getUUID()) {
-                nTotal += GetBalance(childAccount, false);
-            }
-        }
+        LOCK2(cs_main, cs_wallet);
+        auto range = mapAccountChildren.equal_range(forAccount->getUUID());
+        for (auto it = range.first; it != range.second; ++it)
+            nTotal += GetBalance(it->second, false);
     }
 
     return nTotal;
@@ -2043,22 +2392,21 @@ CAmount CWallet::GetUnconfirmedBalance(const CAccount* forAccount, bool includeC
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!forAccount || ::IsMine(forAccount, *pcoin)) {
+        if (forAccount) {
+            nTotal = GetAccountBalances(forAccount).nUnconfirmed;
+        } else {
+            for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+                const CWalletTx* pcoin = &(*it).second;
                 if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                     nTotal += pcoin->GetAvailableCredit(true, forAccount);
             }
         }
     }
     if (forAccount && includeChildren) {
-        for (const auto& accountItem : mapAccounts) {
-            const auto& childAccount = accountItem.second;
-            if (childAccount->getParentUUID() == forAccount->getUUID()) {
-                nTotal += GetUnconfirmedBalance(childAccount, false);
-            }
-        }
+        LOCK2(cs_main, cs_wallet);
+        auto range = mapAccountChildren.equal_range(forAccount->getUUID());
+        for (auto it = range.first; it != range.second; ++it)
+            nTotal += GetUnconfirmedBalance(it->second, false);
     }
     return nTotal;
 }
@@ -2068,9 +2416,11 @@ CAmount CWallet::GetImmatureBalance(const CAccount* forAccount) const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!forAccount || ::IsMine(forAccount, *pcoin)) {
+        if (forAccount) {
+            nTotal = GetAccountBalances(forAccount).nImmature;
+        } else {
+            for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+                const CWalletTx* pcoin = &(*it).second;
                 nTotal += pcoin->GetImmatureCredit(true, forAccount);
             }
         }
@@ -2126,7 +2476,10 @@ void CWallet::AvailableCoins(CAccount* forAccount, vector<COutput>& vCoins, bool
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        for (const auto& hash : GetAccountTxs(forAccount)) {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+            if (it == mapWallet.end())
+                continue;
             const uint256& wtxid = it->first;
             const CWalletTx* pcoin = &(*it).second;
 
@@ -2823,9 +3176,47 @@ bool CWallet::NewKeyPool()
     return true;
 }
 
+/** A keypool entry for an HD account whose key is derived outside of cs_wallet. */
+struct CKeyPoolDerivation {
+    CAccountHD* account;
+    int keyChain;
+    uint32_t nChild;
+    int64_t nIndex;
+    CPubKey pubkey;
+
+    CKeyPoolDerivation(CAccountHD* accountIn, int keyChainIn, uint32_t nChildIn, int64_t nIndexIn) : account(accountIn), keyChain(keyChainIn), nChild(nChildIn), nIndex(nIndexIn) {}
+};
+
+static void ThreadDeriveKeyPool(std::vector<CKeyPoolDerivation>* pvKeys, std::atomic<unsigned int>* pnNext)
+{
+    while (true) {
+        unsigned int nKey = (*pnNext)++;
+        if (nKey >= pvKeys->size())
+            return;
+        CKeyPoolDerivation& key = (*pvKeys)[nKey];
+        CExtPubKey childKey;
+        key.account->DerivePubKey(childKey, key.keyChain, key.nChild);
+        key.pubkey = childKey.pubkey;
+    }
+}
+
+/** Derive the public keys in parallel, they depend only on the (immutable) chain keys of each account. */
+static void DeriveKeyPool(std::vector<CKeyPoolDerivation>& vKeys)
+{
+    std::atomic<unsigned int> nNext(0);
+    unsigned int nThreads = std::min((unsigned int)std::max(1, GetNumCores()), (unsigned int)(vKeys.size() / KEYPOOL_DERIVE_PER_THREAD));
+    std::vector<boost::thread> workers;
+    for (unsigned int i = 1; i < nThreads; ++i)
+        workers.push_back(boost::thread(boost::bind(&ThreadDeriveKeyPool, &vKeys, &nNext)));
+    ThreadDeriveKeyPool(&vKeys, &nNext);
+    BOOST_FOREACH (boost::thread& worker, workers)
+        worker.join();
+}
+
 int CWallet::TopUpKeyPool(unsigned int kpSize, unsigned int maxNew)
 {
     unsigned int nNew = 0;
+    std::vector<CKeyPoolDerivation> vDerive;
     {
         LOCK(cs_wallet);
 
@@ -2840,7 +3231,7 @@ int CWallet::TopUpKeyPool(unsigned int kpSize, unsigned int maxNew)
         else
             nTargetSize = GetArg("-keypool", 5);
 
-        int64_t nIndex = 1;
+        int64_t nIndex = std::max((int64_t)1, nKeyPoolIndexReserved);
         for (auto accountPair : mapAccounts) {
             for (auto keyChain : { KEYCHAIN_EXTERNAL, KEYCHAIN_CHANGE }) {
                 auto& keyPool = (keyChain == KEYCHAIN_EXTERNAL ? accountPair.second->setKeyPoolExternal : accountPair.second->setKeyPoolInternal);
@@ -2852,7 +3243,28 @@ int CWallet::TopUpKeyPool(unsigned int kpSize, unsigned int maxNew)
         for (auto accountPair : mapAccounts) {
             unsigned int accountTargetSize = nTargetSize;
             for (auto& keyChain : { KEYCHAIN_EXTERNAL, KEYCHAIN_CHANGE }) {
+                if (maxNew != 0 && nNew >= maxNew)
+                    break;
                 auto& keyPool = (keyChain == KEYCHAIN_EXTERNAL ? accountPair.second->setKeyPoolExternal : accountPair.second->setKeyPoolInternal);
+                if (accountPair.second->IsHD()) {
+                    // HD keys are only reserved here and derived, written and added to the pool by AddHDKeysToKeyPool.
+                    // Keys another top-up has reserved but not added yet count towards the target. An empty pool
+                    // still gets a key of its own, as the caller may need one before those keys are added.
+                    unsigned int& nPending = mapKeyPoolPending[std::make_pair((const CAccount*)accountPair.second, (int)keyChain)];
+                    unsigned int nHave = keyPool.size() + nPending;
+                    unsigned int nMissing = nHave < (accountTargetSize + 1) ? accountTargetSize + 1 - nHave : 0;
+                    if (keyPool.empty())
+                        nMissing = std::max(nMissing, 1U);
+                    if (maxNew != 0)
+                        nMissing = std::min(nMissing, maxNew - nNew);
+                    CAccountHD* account = (CAccountHD*)accountPair.second;
+                    uint32_t nChild = account->ReserveChildIndexes(keyChain, nMissing);
+                    for (unsigned int i = 0; i < nMissing; ++i)
+                        vDerive.push_back(CKeyPoolDerivation(account, keyChain, nChild + i, ++nIndex));
+                    nPending += nMissing;
+                    nNew += nMissing;
+                    continue;
+                }
                 while (keyPool.size() < (accountTargetSize + 1)) {
                     if (!walletdb.WritePool(++nIndex, CKeyPool(GenerateNewKey(*accountPair.second, keyChain), accountPair.first, keyChain)))
                         throw runtime_error(std::string(__func__) + ": writing generated key failed");
@@ -2861,14 +3273,94 @@ int CWallet::TopUpKeyPool(unsigned int kpSize, unsigned int maxNew)
 
                     ++nNew;
                     if (maxNew != 0 && nNew >= maxNew)
-                        return nNew;
+                        break;
                 }
             }
+            if (maxNew != 0 && nNew >= maxNew)
+                break;
         }
+        nKeyPoolIndexReserved = nIndex;
+    }
+
+    if (!vDerive.empty()) {
+        unsigned int nReserved = vDerive.size();
+        nNew = nNew - nReserved + AddHDKeysToKeyPool(vDerive);
     }
     return nNew;
 }
 
+void CWallet::ReleaseKeyPoolPending(const std::vector<CKeyPoolDerivation>& vKeys)
+{
+    AssertLockHeld(cs_wallet);
+    BOOST_FOREACH (const CKeyPoolDerivation& key, vKeys)
+        --mapKeyPoolPending[std::make_pair((const CAccount*)key.account, key.keyChain)];
+}
+
+unsigned int CWallet::AddHDKeysToKeyPool(std::vector<CKeyPoolDerivation>& vDerive)
+{
+    // Keys that are already known (e.g. derived earlier into another pool) are skipped, as GenerateNewKey does, and the
+    // next child index is derived in their place so that the pool still reaches its target size.
+    std::vector<CKeyPoolDerivation> vAdd;
+    vAdd.reserve(vDerive.size());
+    while (!vDerive.empty()) {
+        DeriveKeyPool(vDerive);
+
+        LOCK(cs_wallet);
+        std::vector<CKeyPoolDerivation> vRetry;
+        BOOST_FOREACH (CKeyPoolDerivation& key, vDerive) {
+            if (HaveKey(key.pubkey.GetID())) {
+                key.nChild = key.account->ReserveChildIndexes(key.keyChain, 1);
+                vRetry.push_back(key);
+            } else {
+                vAdd.push_back(key);
+            }
+        }
+        vDerive.swap(vRetry);
+    }
+    vDerive.swap(vAdd);
+
+    CKeyMetadata metadata(GetTime());
+    {
+        CWalletDB walletdb(strWalletFile);
+        bool fWritten = walletdb.TxnBegin();
+        if (fWritten) {
+            BOOST_FOREACH (const CKeyPoolDerivation& key, vDerive) {
+                if ((fFileBacked && !walletdb.WriteKeyHD(key.pubkey, key.nChild, key.keyChain, metadata, key.account->getUUID()))
+                    || !walletdb.WritePool(key.nIndex, CKeyPool(key.pubkey, key.account->getUUID(), key.keyChain))) {
+                    walletdb.TxnAbort();
+                    fWritten = false;
+                    break;
+                }
+            }
+        }
+        if (fWritten)
+            fWritten = walletdb.TxnCommit();
+        if (!fWritten) {
+            LOCK(cs_wallet);
+            ReleaseKeyPoolPending(vDerive);
+            throw runtime_error(std::string(__func__) + ": writing generated keys failed");
+        }
+    }
+
+    {
+        LOCK(cs_wallet);
+        ReleaseKeyPoolPending(vDerive);
+        BOOST_FOREACH (const CKeyPoolDerivation& key, vDerive) {
+            if (!key.account->AddKeyPubKey(key.nChild, key.pubkey, key.keyChain))
+                throw runtime_error(std::string(__func__) + ": adding generated key failed");
+            IndexKeyOwner(key.pubkey.GetID(), key.account);
+            mapKeyMetadata[key.pubkey.GetID()] = metadata;
+            auto& keyPool = (key.keyChain == KEYCHAIN_EXTERNAL ? key.account->setKeyPoolExternal : key.account->setKeyPoolInternal);
+            keyPool.insert(key.nIndex);
+        }
+        if (!nTimeFirstKey || metadata.nCreateTime < nTimeFirstKey)
+            nTimeFirstKey = metadata.nCreateTime;
+    }
+    LogPrintf("keypool added %u HD keys, indexes %d-%d\n", vDerive.size(), vDerive.front().nIndex, vDerive.back().nIndex);
+
+    return vDerive.size();
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypoolentry, CAccount* forAccount, int64_t keyChain)
 {
     nIndex = -1;
@@ -3129,6 +3621,19 @@ set<set<CTxDestination> > CWallet::GetAddressGroupings()
     return ret;
 }
 
+static CAmount GetAccountTxBalance(const CWalletTx& wtx, const std::string& strAccount, int nMinDepth, const isminefilter& filter)
+{
+    if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
+        return 0;
+
+    CAmount nReceived, nSent, nFee;
+    wtx.GetAccountAmounts(strAccount, nReceived, nSent, nFee, filter);
+
+    if (wtx.GetDepthInMainChain() >= nMinDepth)
+        return nReceived - nSent /*+ nFee*/;
+    return 0;
+}
+
 CAmount CWallet::GetAccountBalance(const std::string& strAccount, int nMinDepth, const isminefilter& filter, bool includeChildren)
 {
     CWalletDB walletdb(strWalletFile);
@@ -3143,30 +3648,35 @@ CAmount CWallet::GetAccountBalance(CWalletDB& walletdb, const std::string& strAc
 
         LOCK2(cs_main, cs_wallet);
 
-        for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx& wtx = (*it).second;
-            if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
-                continue;
-
-            CAmount nReceived, nSent, nFee;
-            wtx.GetAccountAmounts(strAccount, nReceived, nSent, nFee, filter);
-
-            if (wtx.GetDepthInMainChain() >= nMinDepth) {
-                nBalance += nReceived;
-                nBalance -= nSent /*+ nFee*/;
+        std::map<std::string, CAccount*>::const_iterator accountIter = mapAccounts.find(strAccount);
+        if (accountIter != mapAccounts.end() && accountIter->second) {
+            // Only transactions touching the account can have amounts for it; the result is cached until the chain, mempool or wallet changes.
+            CAccountBalances& balances = GetAccountBalances(accountIter->second);
+            std::pair<int, isminefilter> key(nMinDepth, filter);
+            std::map<std::pair<int, isminefilter>, CAmount>::const_iterator cached = balances.mapAccountBalance.find(key);
+            if (cached != balances.mapAccountBalance.end()) {
+                nBalance = cached->second;
+            } else {
+                for (const auto& hash : GetAccountTxs(accountIter->second)) {
+                    map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+                    if (it != mapWallet.end())
+                        nBalance += GetAccountTxBalance(it->second, strAccount, nMinDepth, filter);
+                }
+                balances.mapAccountBalance[key] = nBalance;
             }
+        } else {
+            for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+                nBalance += GetAccountTxBalance(it->second, strAccount, nMinDepth, filter);
         }
     }
 
     nBalance += walletdb.GetAccountCreditDebit(strAccount);
 
     if (includeChildren) {
-        for (const auto& accountItem : mapAccounts) {
-            const auto& childAccount = accountItem.second;
-            if (childAccount->getParentUUID() == strAccount) {
-                nBalance += GetAccountBalance(walletdb, childAccount->getUUID(), nMinDepth, filter, includeChildren);
-            }
-        }
+        LOCK2(cs_main, cs_wallet);
+        auto range = mapAccountChildren.equal_range(strAccount);
+        for (auto it = range.first; it != range.second; ++it)
+            nBalance += GetAccountBalance(walletdb, it->second->getUUID(), nMinDepth, filter, includeChildren);
     }
 
     return nBalance;
@@ -3523,16 +4033,38 @@ void CWallet::deleteAccount(CAccount* account)
     NotifyAccountDeleted(this, account);
 }
 
+void CWallet::LoadAccount(CAccount* account)
+{
+    AssertLockHeld(cs_wallet);
+
+    std::map<std::string, CAccount*>::iterator it = mapAccounts.find(account->getUUID());
+    if (it != mapAccounts.end()) {
+        auto range = mapAccountChildren.equal_range(it->second->getParentUUID());
+        for (auto child = range.first; child != range.second; ++child) {
+            if (child->second == it->second) {
+                mapAccountChildren.erase(child);
+                break;
+            }
+        }
+    }
+    mapAccounts[account->getUUID()] = account;
+    if (!account->getParentUUID().empty())
+        mapAccountChildren.insert(std::make_pair(account->getParentUUID(), account));
+}
+
 void CWallet::addAccount(CAccount* account, const std::string& newName)
 {
     {
         LOCK(cs_wallet);
 
-        CWalletDB walletdb(strWalletFile);
-        if (!walletdb.WriteAccount(account->getUUID(), account)) {
-            throw runtime_error("Writing account failed");
+        if (fFileBacked) {
+            CWalletDB walletdb(strWalletFile);
+            if (!walletdb.WriteAccount(account->getUUID(), account)) {
+                throw runtime_error("Writing account failed");
+            }
         }
-        mapAccounts[account->getUUID()] = account;
+        LoadAccount(account);
+        IndexAccountKeys(account);
         changeAccountName(account, newName, false);
     }
 
@@ -14,6 +14,7 @@
 #define BITCOIN_WALLET_WALLET_H
 
 #include "amount.h"
+#include "crypto/common.h"
 #include "streams.h"
 #include "tinyformat.h"
 #include "ui_interface.h"
@@ -26,6 +27,7 @@
 #include "account.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -37,6 +39,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
 
 extern CWallet* pwalletMain;
 
@@ -54,6 +57,9 @@ extern bool fSendFreeTransactions;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
 
+/** Minimum number of HD keypool keys per derivation thread */
+static const unsigned int KEYPOOL_DERIVE_PER_THREAD = 16;
+
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 
 static const CAmount DEFAULT_FALLBACK_FEE = 20000;
@@ -73,6 +79,11 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 
 static const bool DEFAULT_USE_HD_WALLET = true;
 
+/** Number of blocks read ahead of the wallet at a time while rescanning */
+static const unsigned int RESCAN_BATCH_SIZE = 64;
+/** Maximum number of threads used to read blocks while rescanning */
+static const int MAX_RESCAN_THREADS = 8;
+
 extern const char* DEFAULT_WALLET_DAT;
 
 class CBlockIndex;
@@ -83,6 +94,7 @@ class CScript;
 class CTxMemPool;
 class CWalletTx;
 class CWalletDB;
+struct CKeyPoolDerivation;
 
 /** (client) version numbers for particular wallet features */
 enum WalletFeature {
@@ -284,6 +296,8 @@ class CWalletTx : public CMerkleTx {
 private:
     const CWallet* pwallet;
 
+    void MarkWalletBalancesDirty() const;
+
 public:
     mapValue_t mapValue;
     std::vector<std::pair<std::string, std::string> > vOrderForm;
@@ -412,6 +426,7 @@ public:
 
     void MarkDirty()
     {
+        MarkWalletBalancesDirty();
         fCreditCached = false;
         fAvailableCreditCached = false;
         fWatchDebitCached = false;
@@ -581,10 +596,15 @@ private:
     std::vector<char> _ssExtra;
 };
 
+struct KeyIDHasher {
+    size_t operator()(const uint160& id) const { return ReadLE64(id.begin()); }
+};
+
 isminetype IsMine(const CWallet& wallet, const CTxDestination& dest);
 isminetype RemoveAddressFromKeypoolIfIsMine(CWallet& wallet, const CTxDestination& dest, uint64_t time);
 isminetype IsMine(const CWallet& wallet, const CScript& scriptPubKey);
 isminetype RemoveAddressFromKeypoolIfIsMine(CWallet& wallet, const CScript& scriptPubKey, uint64_t time);
+bool IsMine(const CAccount* forAccount, const CWalletTx& tx);
 
 /** 
  * A CWallet maintains a set of transactions and balances
@@ -617,6 +637,51 @@ private:
      */
     typedef std::multimap<COutPoint, uint256> TxSpends;
     TxSpends mapTxSpends;
+
+    /**
+     * Index from key and script ids to the accounts that hold them.
+     * Lets the ownership lookups below go straight to the right account instead of probing every account in turn.
+     * The same key may be imported into more than one account, hence the multimap.
+     */
+    typedef boost::unordered_multimap<CKeyID, CAccount*, KeyIDHasher> KeyOwnerMap;
+    typedef boost::unordered_multimap<CScriptID, CAccount*, KeyIDHasher> ScriptOwnerMap;
+    KeyOwnerMap mapKeyOwners;
+    ScriptOwnerMap mapScriptOwners;
+    void IndexKeyOwner(const CKeyID& keyID, CAccount* forAccount);
+    void IndexScriptOwner(const CScriptID& scriptID, CAccount* forAccount);
+    void IndexAccountKeys(CAccount* forAccount);
+
+    /**
+     * Per account index of the wallet transactions that may credit or debit the account.
+     * Derived from the owner index above so it is a superset; callers still apply their own IsMine checks.
+     * The wallet transactions paying to or spending from each key and script id, owned or not, are kept
+     * as well, so that a key added to an account brings its older transactions along without a rebuild.
+     * Only rebuilt in full after the wallet is loaded.
+     */
+    mutable std::map<const CAccount*, std::set<uint256> > mapAccountTxs;
+    mutable boost::unordered_map<CKeyID, std::set<uint256>, KeyIDHasher> mapKeyTxs;
+    mutable boost::unordered_map<CScriptID, std::set<uint256>, KeyIDHasher> mapScriptTxs;
+    mutable bool fAccountTxsStale;
+    void IndexAccountTxs(const CWalletTx& wtx) const;
+    void IndexOwnerTxs(const CScript& scriptPubKey, const std::set<uint256>& setTxs) const;
+    void MarkAccountTxsStale();
+    const std::set<uint256>& GetAccountTxs(const CAccount* forAccount) const;
+
+    /** Account balances, valid for as long as the chain tip, mempool and wallet transactions do not change. */
+    struct CAccountBalances {
+        const CBlockIndex* pindexTip;
+        unsigned int nMempoolUpdated;
+        uint64_t nGeneration;
+        CAmount nBalance;
+        CAmount nUnconfirmed;
+        CAmount nImmature;
+        std::map<std::pair<int, isminefilter>, CAmount> mapAccountBalance;
+
+        CAccountBalances() : pindexTip(NULL), nMempoolUpdated(0), nGeneration(0), nBalance(0), nUnconfirmed(0), nImmature(0) {}
+    };
+    mutable std::map<const CAccount*, CAccountBalances> mapAccountBalances;
+    mutable std::atomic<uint64_t> nBalanceGeneration;
+    CAccountBalances& GetAccountBalances(const CAccount* forAccount) const;
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
@@ -670,10 +735,13 @@ public:
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        nKeyPoolIndexReserved = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        fAccountTxsStale = false;
+        nBalanceGeneration = 1;
         activeAccount = NULL;
         activeSeed = NULL;
     }
@@ -745,8 +813,9 @@ public:
     bool GetKey(const CKeyID& address, CKey& keyOut) const
     {
         LOCK(cs_wallet);
-        for (auto accountPair : mapAccounts) {
-            if (accountPair.second->GetKey(address, keyOut))
+        auto range = mapKeyOwners.equal_range(address);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second->GetKey(address, keyOut))
                 return true;
         }
         return false;
@@ -755,8 +824,9 @@ public:
     bool GetPubKey(const CKeyID& address, CPubKey& vchPubKeyOut)
     {
         LOCK(cs_wallet);
-        for (auto accountPair : mapAccounts) {
-            if (accountPair.second->GetPubKey(address, vchPubKeyOut))
+        auto range = mapKeyOwners.equal_range(address);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second->GetPubKey(address, vchPubKeyOut))
                 return true;
         }
         return false;
@@ -785,18 +855,15 @@ public:
     bool HaveCScript(const CScriptID& hash)
     {
         LOCK(cs_wallet);
-        for (auto accountPair : mapAccounts) {
-            if (accountPair.second->HaveCScript(hash))
-                return true;
-        }
-        return false;
+        return mapScriptOwners.count(hash) > 0;
     }
 
     bool GetCScript(const CScriptID& hash, CScript& redeemScriptOut)
     {
         LOCK(cs_wallet);
-        for (auto accountPair : mapAccounts) {
-            if (accountPair.second->GetCScript(hash, redeemScriptOut))
+        auto range = mapScriptOwners.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second->GetCScript(hash, redeemScriptOut))
                 return true;
         }
         return false;
@@ -805,13 +872,16 @@ public:
     bool HaveKey(const CKeyID& address) const
     {
         LOCK(cs_wallet);
-        for (auto accountPair : mapAccounts) {
-            if (accountPair.second->HaveKey(address))
-                return true;
-        }
-        return false;
+        return mapKeyOwners.count(address) > 0;
     }
 
+    /** Collect the accounts holding any key or script that scriptPubKey (or its P2SH/witness redeem script) refers to. */
+    void GetScriptOwners(const CScript& scriptPubKey, std::set<CAccount*>& setOwners) const;
+    /** The key and script ids GetScriptOwners looks up for scriptPubKey; needs no lock. */
+    static void GetScriptOwnerIDs(const CScript& scriptPubKey, std::vector<CKeyID>& vKeyIDs, std::vector<CScriptID>& vScriptIDs);
+    /** True if any of the given ids belongs to an account in this wallet. */
+    bool HaveAnyOwner(const std::vector<CKeyID>& vKeyIDs, const std::vector<CScriptID>& vScriptIDs) const;
+
     bool HaveWatchOnly(const CScript& dest)
     {
         LOCK(cs_wallet);
@@ -827,9 +897,12 @@ public:
 
     std::map<std::string, CHDSeed*> mapSeeds;
     std::map<std::string, CAccount*> mapAccounts;
+    //! Child accounts of each account, keyed by parent UUID; kept in step with mapAccounts by LoadAccount
+    std::multimap<std::string, CAccount*> mapAccountChildren;
     std::map<std::string, std::string> mapAccountLabels;
 
     void changeAccountName(CAccount* account, const std::string& newName, bool notify = true);
+    void LoadAccount(CAccount* account);
     void addAccount(CAccount* account, const std::string& newName);
     void deleteAccount(CAccount* account);
 
@@ -838,6 +911,10 @@ public:
     TxItems wtxOrdered;
 
     int64_t nOrderPosNext;
+    /** Highest keypool index handed out, including HD keys that are still being derived */
+    int64_t nKeyPoolIndexReserved;
+    /** Number of HD keys per account and key chain that TopUpKeyPool reserved but AddHDKeysToKeyPool has not added yet */
+    std::map<std::pair<const CAccount*, int>, unsigned int> mapKeyPoolPending;
     std::map<uint256, int> mapRequestCount;
 
     std::map<std::string, CAddressBookData> mapAddressBook;
@@ -889,12 +966,20 @@ public:
     bool LoadKey(const CKey& key, const CPubKey& pubkey, const std::string& forAccount, int64_t nKeyChain)
     {
         LOCK(cs_wallet);
-        return mapAccounts[forAccount]->AddKeyPubKey(key, pubkey, nKeyChain);
+        CAccount* account = mapAccounts[forAccount];
+        if (!account->AddKeyPubKey(key, pubkey, nKeyChain))
+            return false;
+        IndexKeyOwner(pubkey.GetID(), account);
+        return true;
     }
     bool LoadKey(int64_t HDKeyIndex, int64_t keyChain, const CPubKey& pubkey, const std::string& forAccount)
     {
         LOCK(cs_wallet);
-        return mapAccounts[forAccount]->AddKeyPubKey(HDKeyIndex, pubkey, keyChain);
+        CAccount* account = mapAccounts[forAccount];
+        if (!account->AddKeyPubKey(HDKeyIndex, pubkey, keyChain))
+            return false;
+        IndexKeyOwner(pubkey.GetID(), account);
+        return true;
     }
 
     bool LoadKeyMetadata(const CPubKey& pubkey, const CKeyMetadata& metadata);
@@ -943,6 +1028,8 @@ public:
     CAccountHD* CreateReadOnlyAccount(std::string strAccount, SecureString encExtPubKey);
 
     void MarkDirty();
+    /** Invalidate the cached account balances; called whenever a wallet transaction's cached amounts are reset. */
+    void MarkBalancesDirty() const { ++nBalanceGeneration; }
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
@@ -989,6 +1076,8 @@ public:
 
     bool NewKeyPool();
     int TopUpKeyPool(unsigned int kpSize = 0, unsigned int maxNew = 0);
+    unsigned int AddHDKeysToKeyPool(std::vector<CKeyPoolDerivation>& vDerive);
+    void ReleaseKeyPoolPending(const std::vector<CKeyPoolDerivation>& vKeys);
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, CAccount* forAccount, int64_t keyChain);
     void KeepKey(int64_t nIndex);
     void MarkKeyUsed(CKeyID keyID, uint64_t usageTime);
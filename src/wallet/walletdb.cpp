@@ -654,7 +654,7 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 CAccount* newAccount = new CAccount();
                 newAccount->setUUID(strAccountUUID);
                 ssValue >> *newAccount;
-                pwallet->mapAccounts[strAccountUUID] = newAccount;
+                pwallet->LoadAccount(newAccount);
 
                 if (!pwallet->activeAccount)
                     pwallet->activeAccount = newAccount;
@@ -666,7 +666,7 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 CAccountHD* newAccount = new CAccountHD();
                 newAccount->setUUID(strAccountUUID);
                 ssValue >> *newAccount;
-                pwallet->mapAccounts[strAccountUUID] = newAccount;
+                pwallet->LoadAccount(newAccount);
 
                 if (!pwallet->activeAccount)
                     pwallet->activeAccount = newAccount;
@@ -787,7 +787,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet, bool& firstRunRet)
 
                 pwallet->activeAccount = new CAccount();
                 pwallet->activeAccount->setLabel("Legacy", NULL);
-                pwallet->mapAccounts[pwallet->activeAccount->getUUID()] = pwallet->activeAccount;
+                pwallet->LoadAccount(pwallet->activeAccount);
                 pwallet->mapAccountLabels[pwallet->activeAccount->getUUID()] = "Legacy";
             }
         }